@@ -1,5 +1,248 @@
 var ActiveX = module.exports = require('./build/Release/node_activex');
+var stream = require('stream');
 
 global.ActiveXObject = function(id, opt) {
     return new ActiveX.Object(id, opt);
 };
+
+// Property gets inside fn are memoized until put or method call on the same object, fn is synchronous
+ActiveX.withCache = function(fn) {
+    ActiveX.cache(true);
+    try { return fn(); }
+    finally { ActiveX.cache(false); }
+};
+
+// Object mode readable stream of range tiles ({ row, rows, values }), tiles are read on worker apartment
+ActiveX.createRangeReadStream = function(range, opt) {
+    var started = false;
+    var readable = new stream.Readable({
+        objectMode: true,
+        read: function() {
+            if (started) return;
+            started = true;
+            ActiveX.readRange(range, opt || {}, function(err, tile) {
+                if (err) return readable.emit('error', err);
+                readable.push(tile);
+                return !readable.destroyed;
+            });
+        }
+    });
+    return readable;
+};
+
+// ArrayBuffers of typed arrays in value, so result is moved to other thread without copy:
+// parentPort.postMessage(result, ActiveX.transferList(result))
+ActiveX.transferList = function(value, buffers) {
+    buffers = buffers || new Set();
+    if (ArrayBuffer.isView(value)) {
+        if (value.byteOffset === 0 && value.byteLength === value.buffer.byteLength) buffers.add(value.buffer);
+    }
+    else if (Array.isArray(value)) value.forEach(function(item) { ActiveX.transferList(item, buffers); });
+    else if (value && Object.getPrototypeOf(value) === Object.prototype) {
+        Object.keys(value).forEach(function(key) { ActiveX.transferList(value[key], buffers); });
+    }
+    return Array.from(buffers);
+};
+
+// Async objects live on worker apartment, member access returns promises.
+// obj.Method(args) calls method, await obj.Prop reads property, obj.Prop = value posts put.
+// Members of properties and of pending call results are pipelined: obj.A.B(1).C is sent to the worker
+// as one chain and intermediate objects never return to the loop
+var async_kinds = { get: 0, put: 1, call: 2 };
+var async_errors = new WeakMap(); // Failed puts are reported by the next operation on the object
+var async_refs = new WeakMap(); // Proxies to their source and path: { source, path, name }
+
+function asyncAbortError() {
+    var error = new Error('The operation was aborted');
+    error.name = 'AbortError';
+    error.hresult = 0x80004004; // E_ABORT
+    return error;
+}
+
+// Handle of async object behind proxy, pending result once it is settled
+function asyncHandle(value) {
+    var ref = async_refs.get(value);
+    if (!ref || ref.name !== undefined) return value;
+    return (ref.source instanceof ActiveX.AsyncObject) ? ref.source : (ref.source.handle || value);
+}
+
+function asyncResult(value) {
+    return (value instanceof ActiveX.AsyncObject) ? asyncProxy(value) : value;
+}
+
+// Async object handle, id of pending call while its result is not settled, null for result that is not an object
+function asyncTarget(source) {
+    if (source instanceof ActiveX.AsyncObject) return source;
+    return source.handle || (source.settled ? null : source.id);
+}
+
+// Proxies in arguments: async objects are passed as handles and pending results as promises of their calls,
+// so they are resolved on the worker. Property of async object is read first
+function asyncArgument(value, deps) {
+    var ref = async_refs.get(value);
+    if (!ref) return value;
+    if (ref.name !== undefined) ref = async_refs.get(asyncPending(asyncInvoke(ref.source, 'get', ref.name, [], null, ref.path)));
+    var source = ref.source;
+    if (source instanceof ActiveX.AsyncObject) return source;
+    if (source.handle) return source.handle;
+    if (source.error) deps.error = source.error;
+    else if (!source.settled) deps.pending.push(source);
+    return source.settled ? source.value : source.promise;
+}
+
+function asyncInvoke(source, kind, name, args, opt, path) {
+    var error = async_errors.get(source) || source.error;
+    if (error) {
+        async_errors.delete(source);
+        return Promise.reject(error);
+    }
+    var signal = opt && opt.signal;
+    if (signal && signal.aborted) return Promise.reject(asyncAbortError());
+    var target = asyncTarget(source), deps = { pending: [], error: null }, promise;
+    var convert = function(arg) { return asyncArgument(arg, deps); };
+    var items = args.map(convert);
+    var steps = (path || []).map(function(step) { return [async_kinds[step[0]], step[1], step[2].map(convert)]; });
+    if (deps.error) return Promise.reject(deps.error);
+    if (!(source instanceof ActiveX.AsyncObject) && !source.settled) deps.pending.push(source);
+    try {
+        promise = ActiveX.asyncInvoke(target, async_kinds[kind], name, items, opt || {}, steps);
+    }
+    catch (e) {
+
+        // Pending call completed before its result was recorded or is queued in other lane,
+        // the call is made again from settled results
+        if (deps.pending.length == 0) throw e;
+        return Promise.all(deps.pending.map(function(dep) { return dep.result.catch(function() {}); })).then(function() {
+            return asyncInvoke(source, kind, name, args, opt, path);
+        });
+    }
+    if (signal) {
+        var abort = function() { ActiveX.asyncCancel(promise.id); };
+        var detach = function() { signal.removeEventListener('abort', abort); };
+        signal.addEventListener('abort', abort);
+        promise.then(detach, detach);
+    }
+    var result = promise.then(asyncResult);
+    result.id = promise.id;
+    return result;
+}
+
+function asyncPut(source, path, name, value) {
+    asyncInvoke(source, 'put', name, [value], null, path).catch(function(e) { async_errors.set(source, e); });
+}
+
+// Member of async object or of pending result: called, awaited as property or used as object.
+// Function properties (apply, call, bind, length, name) are not members
+function asyncMember(source, path, name) {
+    var member = function() { return asyncPending(asyncInvoke(source, 'call', name, Array.prototype.slice.call(arguments), null, path)); };
+    var proxy = new Proxy(member, {
+        get: function(target, key) {
+            if (key === 'then') return function(resolve, reject) { return asyncInvoke(source, 'get', name, [], null, path).then(resolve, reject); };
+            if (typeof key !== 'string' || key === 'inspect') return undefined;
+            if (key in Function.prototype) return target[key];
+            return asyncMember(source, path.concat([['get', name, []]]), key);
+        },
+        set: function(target, key, value) {
+            asyncPut(source, path.concat([['get', name, []]]), key, value);
+            return true;
+        }
+    });
+    async_refs.set(proxy, { source: source, path: path, name: name });
+    return proxy;
+}
+
+// Result of started call, thenable. Its members are queued behind the call on the worker
+function asyncPending(promise) {
+    var source = { id: promise.id, promise: promise, settled: false };
+    source.result = promise.then(function(value) {
+        var ref = async_refs.get(value);
+        if (ref) source.handle = ref.source;
+        else source.value = value;
+        source.settled = true;
+        return value;
+    }, function(e) {
+        source.error = e;
+        source.settled = true;
+        throw e;
+    });
+    var proxy = new Proxy({}, {
+        get: function(target, key) {
+            if (key === 'id') return promise.id;
+            if (key === 'then' || key === 'catch' || key === 'finally') return source.result[key].bind(source.result);
+            if (typeof key !== 'string' || key === 'inspect') return undefined;
+            return asyncMember(source, [], key);
+        },
+        set: function(target, key, value) {
+            asyncPut(source, [], key, value);
+            return true;
+        }
+    });
+    async_refs.set(proxy, { source: source, path: [] });
+    return proxy;
+}
+
+function asyncProxy(handle) {
+    var proxy = new Proxy(function() {}, {
+        get: function(target, name) {
+            if (typeof name !== 'string' || name === 'then' || name === 'inspect') return undefined;
+            return asyncMember(handle, [], name);
+        },
+        set: function(target, name, value) {
+            asyncPut(handle, [], name, value);
+            return true;
+        }
+    });
+    async_refs.set(proxy, { source: handle, path: [] });
+    return proxy;
+}
+
+ActiveX.createAsync = function(progid, opt) {
+    return ActiveX.asyncCreate(progid, opt || {}).then(asyncResult);
+};
+
+// Explicit form with options: { timeout, signal, priority }, kind is 'get', 'put' or 'call'
+ActiveX.invoke = function(obj, kind, name, args, opt) {
+    var ref = async_refs.get(obj);
+    if (ref && ref.name !== undefined) return asyncInvoke(ref.source, kind, name, args || [], opt, ref.path.concat([['get', ref.name, []]]));
+    return asyncInvoke(ref ? ref.source : obj, kind, name, args || [], opt);
+};
+
+// Readable stream over async object that returns byte chunks, for example ADODB.Stream (Read) or ADODB.Field (GetChunk).
+// Chunks are read by async calls on the worker apartment of the object, one call at a time: { chunkSize, method, timeout, priority }
+ActiveX.createReadStream = function(source, opt) {
+    if (!async_refs.has(source)) throw new TypeError('stream source is not async object');
+    var chunk_size = (opt && opt.chunkSize) || 65536;
+    var method = (opt && opt.method) || 'Read';
+    var readable = new stream.Readable({
+        highWaterMark: chunk_size,
+        read: function() {
+            ActiveX.invoke(source, 'call', method, [chunk_size], opt).then(function(chunk) {
+                readable.push((chunk && chunk.length > 0) ? chunk : null);
+            }, function(e) {
+                readable.emit('error', e);
+            });
+        }
+    });
+    return readable;
+};
+
+// Writable stream over async object that accepts byte chunks, for example ADODB.Stream (Write) or ADODB.Field (AppendChunk)
+ActiveX.createWriteStream = function(target, opt) {
+    if (!async_refs.has(target)) throw new TypeError('stream target is not async object');
+    var method = (opt && opt.method) || 'Write';
+    return new stream.Writable({
+        highWaterMark: (opt && opt.chunkSize) || 65536,
+        write: function(chunk, encoding, callback) {
+            ActiveX.invoke(target, 'call', method, [chunk], opt).then(function() { callback(); }, callback);
+        }
+    });
+};
+
+// Command is executed for every row of columns on worker apartment: { transaction: rows per commit }
+ActiveX.executeMany = function(command, columns, opt) {
+    return new Promise(function(resolve, reject) {
+        ActiveX.bulkExecute(asyncHandle(command), columns, opt || {}, function(err, result) {
+            if (err) reject(err); else resolve(result);
+        });
+    });
+};
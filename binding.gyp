@@ -5,7 +5,20 @@
       'sources': [
         'src/main.cpp',
         'src/utils.cpp',
-        'src/disp.cpp'
+        'src/disp.cpp',
+        'src/typecache.cpp',
+        'src/pool.cpp',
+        'src/events.cpp',
+        'src/apartment.cpp',
+        'src/range.cpp',
+        'src/async.cpp',
+        'src/writer.cpp',
+        'src/arrow.cpp',
+        'src/export.cpp',
+        'src/bulk.cpp'
+      ],
+      'defines': [
+        'NOMINMAX'
       ],
       'dependencies': [
       ]
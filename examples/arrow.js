@@ -0,0 +1,43 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Export ADO recordset to Arrow IPC stream, compare with reading fields row by row
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var count = 100000;
+
+var rs = new ActiveXObject("ADODB.Recordset");
+rs.Fields.Append("Id", 3); // adInteger
+rs.Fields.Append("Name", 202, 50); // adVarWChar
+rs.Fields.Append("Price", 5); // adDouble
+rs.Fields.Append("Created", 7); // adDate
+rs.Open();
+var now = new Date();
+for (var i = 0; i < count; i++) {
+    rs.AddNew();
+    rs.Fields("Id").Value = i;
+    rs.Fields("Name").Value = "name" + i;
+    rs.Fields("Price").Value = i * 0.5;
+    rs.Fields("Created").Value = now;
+}
+rs.Update();
+
+var ms = function(t) { return t[0] * 1e3 + t[1] / 1e6; };
+
+rs.MoveFirst();
+var started = process.hrtime();
+var fields = rs.Fields, rows = [];
+while (!rs.EOF) {
+    rows.push([fields(0).Value, fields(1).Value, fields(2).Value, fields(3).Value]);
+    rs.MoveNext();
+}
+console.log("==> fields: " + rows.length + " rows in " + ms(process.hrtime(started)).toFixed(0) + " ms");
+
+rs.MoveFirst();
+started = process.hrtime();
+var buf = ActiveX.exportArrow(rs, { batch: 65536 });
+console.log("==> arrow: " + buf.length + " bytes in " + ms(process.hrtime(started)).toFixed(0) + " ms");
+// var table = require('apache-arrow').tableFromIPC(buf);
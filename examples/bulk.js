@@ -0,0 +1,57 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure parameterized inserts to DBF, JS loop over Command parameters and executeMany
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var path = require('path'); 
+var data_path = path.join(__dirname, '../data/');
+var filename = "bulk.dbf";
+var constr = "Provider=Microsoft.ACE.OLEDB.12.0;Data Source=" + data_path + ";Extended Properties=\"DBASE IV;\"";
+var count = 100000;
+
+var fso = new ActiveXObject("Scripting.FileSystemObject");
+if (!fso.FolderExists(data_path)) fso.CreateFolder(data_path);
+if (fso.FileExists(data_path + filename)) fso.DeleteFile(data_path + filename);
+var con = new ActiveXObject("ADODB.Connection");
+con.Open(constr, "", "");
+con.Execute("create Table " + filename + " (Name char(50), Zip decimal(5))");
+
+var names = [], zips = new Int32Array(count);
+for (var i = 0; i < count; i++) {
+    names.push("name" + i);
+    zips[i] = i % 100000;
+}
+var sql = "insert into " + filename + " (Name, Zip) values(?, ?)";
+var ms = function(t) { return t[0] * 1e3 + t[1] / 1e6; };
+
+console.log("==> JS loop");
+var cmd = new ActiveXObject("ADODB.Command");
+cmd.ActiveConnection = con;
+cmd.CommandText = sql;
+var params = cmd.Parameters;
+var started = process.hrtime();
+con.BeginTrans();
+for (var i = 0; i < count; i++) {
+    params(0).Value = names[i];
+    params(1).Value = zips[i];
+    cmd.Execute();
+}
+con.CommitTrans();
+var elapsed = ms(process.hrtime(started));
+console.log((count / elapsed * 1000).toFixed(0) + " rows per second");
+con.Close();
+
+console.log("==> executeMany");
+ActiveX.createAsync("ADODB.Command").then(function(cmd) {
+    cmd.ActiveConnection = constr;
+    cmd.CommandText = sql;
+    return ActiveX.executeMany(cmd, [names, zips], { transaction: count });
+}).then(function(result) {
+    console.log((result.rows / result.elapsed * 1000).toFixed(0) + " rows per second", result);
+}).catch(function(e) {
+    console.log(e.message);
+});
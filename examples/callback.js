@@ -0,0 +1,57 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure latency of callbacks to JS object from script control on the loop thread, 
+//              where it is called in the same apartment, and on worker apartment, where free-threaded 
+//              object is called directly and waits for the loop thread (script control is 32-bit only)
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var count = 10000;
+var statement = "For i = 1 To " + count + ": cb.tick i: Next";
+
+function report(title, calls, started, direct) {
+    var t = process.hrtime(started), ms = t[0] * 1e3 + t[1] / 1e6;
+    console.log("==> " + title + ": " + calls + " callbacks, " + (ms * 1000 / count).toFixed(1) + " us per call, " +
+        (ActiveX.stats().direct - direct) + " from other thread");
+}
+
+function measureLoop() {
+    var calls = 0;
+    var callback = new ActiveXObject({ tick: function(i) { calls++; return i; } });
+    var sc = new ActiveXObject("MSScriptControl.ScriptControl");
+    sc.Language = "VBScript";
+    sc.AddObject("cb", callback, true);
+    var direct = ActiveX.stats().direct, started = process.hrtime();
+    sc.ExecuteStatement(statement);
+    report("loop thread", calls, started, direct);
+}
+
+function measureWorker() {
+    var calls = 0;
+    var callback = new ActiveXObject({ tick: function(i) { calls++; return i; } }, { freeThreaded: true });
+    var direct, started;
+    return ActiveX.createAsync("MSScriptControl.ScriptControl").then(function(sc) {
+        return ActiveX.invoke(sc, 'put', 'Language', ["VBScript"]).then(function() {
+            return sc.AddObject("cb", callback, true);
+        }).then(function() {
+            direct = ActiveX.stats().direct;
+            started = process.hrtime();
+            return sc.ExecuteStatement(statement);
+        }).then(function() {
+            report("worker apartment", calls, started, direct);
+        });
+    });
+}
+
+try {
+    measureLoop();
+    measureWorker().catch(function(e) {
+        console.log(e.message);
+    });
+}
+catch(e) {
+    console.log(e.message);
+}
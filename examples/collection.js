@@ -0,0 +1,37 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Compare projection of collection items by JS loop and by native toArray
+//-------------------------------------------------------------------------------------------------------
+
+//require('winax');
+require('../activex');
+
+var count = 1000;
+var repeat = 10;
+
+// Disconnected recordset is used as collection of fields
+var rs = new ActiveXObject("ADODB.Recordset");
+for (var i = 0; i < count; i++) rs.Fields.Append("F" + i, 3); // adInteger
+
+function measure(title, func) {
+    var started = process.hrtime();
+    for (var n = 0; n < repeat; n++) func();
+    var elapsed = process.hrtime(started);
+    var ms = (elapsed[0] * 1e3 + elapsed[1] / 1e6) / repeat;
+    console.log("==> " + title + ": " + ms.toFixed(2) + " ms per " + count + " items");
+    return ms;
+}
+
+var loop = measure("JS loop", function() {
+    var fields = rs.Fields, out = [];
+    for (var i = 0; i < fields.Count; i++) {
+        out.push({ Name: fields.Item(i).Name, Type: fields.Item(i).Type });
+    }
+});
+
+var native = measure("toArray", function() {
+    rs.Fields.toArray(['Name', 'Type']);
+});
+
+console.log("==> speedup: " + (loop / native).toFixed(1) + "x");
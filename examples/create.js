@@ -0,0 +1,29 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure creation rate of short-lived COM objects with and without class cache
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var count = 10000;
+var progids = ['ADODB.Command', 'ADODB.Recordset', 'MSXML2.DOMDocument'];
+
+function measure(progid) {
+    new ActiveXObject(progid, { type: false }); // warm up
+    var started = process.hrtime();
+    for (var i = 0; i < count; i++) {
+        var obj = new ActiveXObject(progid, { type: false });
+    }
+    var elapsed = process.hrtime(started);
+    return (elapsed[0] * 1e6 + elapsed[1] / 1e3) / count;
+}
+
+progids.forEach(function(progid) {
+    ActiveX.classCache(false); // CLSIDFromProgID and CoCreateInstance every time
+    var uncached = measure(progid);
+    ActiveX.classCache(true);
+    var cached = measure(progid);
+    console.log("==> " + progid + ": " + uncached.toFixed(2) + " us uncached, " + cached.toFixed(2) + " us cached per object");
+});
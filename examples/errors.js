@@ -0,0 +1,25 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure cost of failed calls, with and without reading error message
+//-------------------------------------------------------------------------------------------------------
+
+//require('winax');
+require('../activex');
+
+var count = 10000;
+var fso = new ActiveXObject("Scripting.FileSystemObject");
+
+function measure(title, read_message) {
+    var started = process.hrtime();
+    for (var i = 0; i < count; i++) {
+        try { fso.GetFile("c:\\missing\\file" + i); }
+        catch (e) { if (read_message) e.message; }
+    }
+    var elapsed = process.hrtime(started);
+    var us = (elapsed[0] * 1e6 + elapsed[1] / 1e3) / count;
+    console.log("==> " + title + ": " + us.toFixed(2) + " us per error");
+}
+
+measure("swallowed", false);
+measure("message read", true);
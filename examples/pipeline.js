@@ -0,0 +1,70 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure chain of calls on async objects, awaiting every step and pipelining the chain.
+//              Nested dictionaries are the server, busy loop adds delay to every return to the loop
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var depth = 5, rounds = 100, hop_delay = 2;
+var ms = function(t) { return t[0] * 1e3 + t[1] / 1e6; };
+
+// Loop is busy for hop_delay ms on every turn, as with other work of the application
+var busy = setInterval(function() {
+    var started = process.hrtime();
+    while (ms(process.hrtime(started)) < hop_delay);
+}, 0);
+
+function build() {
+    var root, parent, level = 0;
+    var next = function(child) {
+        if (level++ == depth) return parent.Add("value", "leaf");
+        return parent.Add("next", child).then(function() {
+            parent = child;
+            return ActiveX.createAsync("Scripting.Dictionary").then(next);
+        });
+    };
+    return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+        root = parent = dict;
+        return ActiveX.createAsync("Scripting.Dictionary").then(next);
+    }).then(function() {
+        return root;
+    });
+}
+
+// Every member is called after result of previous one is returned to the loop
+function stepwise(root) {
+    var chain = Promise.resolve(root);
+    for (var i = 0; i < depth; i++) chain = chain.then(function(obj) { return obj.Item("next"); });
+    return chain.then(function(obj) { return obj.Item("value"); });
+}
+
+// Whole chain is queued to the apartment at once, only last result is returned
+function pipelined(root) {
+    var obj = root;
+    for (var i = 0; i < depth; i++) obj = obj.Item("next");
+    return obj.Item("value");
+}
+
+function measure(name, chain, root) {
+    var started = process.hrtime(), round = 0;
+    var next = function(value) {
+        if (round > 0 && value !== "leaf") throw new Error("unexpected " + value);
+        if (round++ < rounds) return chain(root).then(next);
+        var elapsed = ms(process.hrtime(started));
+        console.log(name + ": " + (elapsed / rounds).toFixed(2) + " ms per chain of " + (depth + 1) + " calls");
+    };
+    return next();
+}
+
+build().then(function(root) {
+    return measure("await every step", stepwise, root).then(function() {
+        return measure("pipelined", pipelined, root);
+    });
+}).catch(function(e) {
+    console.log(e.message);
+}).then(function() {
+    clearInterval(busy);
+});
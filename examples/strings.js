@@ -0,0 +1,38 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure string round trips through Scripting.Dictionary, short, medium and large strings
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var dict = new ActiveXObject("Scripting.Dictionary");
+var ms = function(t) { return t[0] * 1e3 + t[1] / 1e6; };
+
+function measure(title, value, count) {
+    dict.RemoveAll();
+    var heap = process.memoryUsage().heapUsed;
+    var started = process.hrtime(), items = [];
+    for (var i = 0; i < count; i++) {
+        dict.Add(i, value);
+        items.push(dict.Item(i));
+    }
+    var elapsed = ms(process.hrtime(started));
+    var bytes = (process.memoryUsage().heapUsed - heap) / count;
+    console.log("==> " + title + " (" + value.length + " chars): " + (count / elapsed * 1000).toFixed(0) + 
+        " round trips per second, ~" + bytes.toFixed(0) + " heap bytes per result");
+}
+
+function repeat(text, length) {
+    var result = text;
+    while (result.length < length) result += result;
+    return result.substr(0, length);
+}
+
+measure("short ascii", "value-01", 200000);
+measure("short unicode", "значение", 200000);
+measure("medium ascii", repeat("Lorem ipsum dolor sit amet ", 256), 100000);
+measure("medium latin-1", repeat("Größe café naïve ", 256), 100000);
+measure("large ascii", repeat("Lorem ipsum dolor sit amet ", 1 << 20), 200);
+measure("large unicode", repeat("Съешь же ещё этих мягких булок ", 1 << 20), 200);
@@ -0,0 +1,37 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure conversion rate of values by type, values make round trip through dictionary
+//-------------------------------------------------------------------------------------------------------
+
+//require('winax');
+require('../activex');
+
+var count = 10000;
+var dict = new ActiveXObject("Scripting.Dictionary");
+var values = {
+    int: 12345,
+    double: 1.2345,
+    bool: true,
+    string: 'string value',
+    date: new Date(),
+    null: null
+};
+
+Object.keys(values).forEach(function(type) {
+    var value = values[type];
+    dict.RemoveAll();
+    for (var i = 0; i < count; i++) dict.Add(i, value);
+    var started = process.hrtime();
+    for (var i = 0; i < count; i++) dict.Item(i);
+    var elapsed = process.hrtime(started);
+    var us = (elapsed[0] * 1e6 + elapsed[1] / 1e3) / count;
+    console.log("==> " + type + ": " + us.toFixed(2) + " us per value");
+});
+
+// Arrays are converted at once
+var arr = dict.Items();
+var started = process.hrtime();
+for (var n = 0; n < 100; n++) dict.Items();
+var elapsed = process.hrtime(started);
+console.log("==> array of " + arr.length + " variants: " + ((elapsed[0] * 1e3 + elapsed[1] / 1e6) / 100).toFixed(2) + " ms");
@@ -0,0 +1,30 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure member access rate and wrapper allocations, every access creates short lived wrappers
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var count = 100000;
+var rs = new ActiveXObject("ADODB.Recordset");
+rs.Fields.Append("Name", 200, 50); // adVarChar
+rs.Fields.Append("Value", 5); // adDouble
+rs.Open();
+rs.AddNew();
+rs.Fields("Name").Value = "item";
+rs.Fields("Value").Value = 1.5;
+rs.Update();
+
+var before = ActiveX.stats();
+var started = process.hrtime();
+for (var i = 0; i < count; i++) rs.Fields("Value").Value;
+var elapsed = process.hrtime(started);
+var after = ActiveX.stats();
+
+var us = (elapsed[0] * 1e6 + elapsed[1] / 1e3) / count;
+console.log("==> member access: " + us.toFixed(2) + " us per rs.Fields(name).Value");
+console.log("==> pooled blocks: " + ((after.blocks - before.blocks) / count).toFixed(2) + " per access");
+console.log("==> heap slabs: " + (after.slabs - before.slabs) + " during " + count + " accesses");
+console.log("==> interned names: " + after.names);
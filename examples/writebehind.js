@@ -0,0 +1,30 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: node-activex
+// Author: Yuri Dursin
+// Description: Measure throughput of property puts to Excel range, synchronous and write-behind
+//-------------------------------------------------------------------------------------------------------
+
+//var ActiveX = require('winax');
+var ActiveX = require('../activex');
+
+var count = 100000;
+
+function measure(title, opt) {
+    var excel = new ActiveXObject("Excel.Application", opt);
+    var wbk = excel.Workbooks.Add();
+    var range = wbk.Worksheets(1).Range("A1");
+    var started = process.hrtime();
+    for (var i = 0; i < count; i++) range.Value2 = i;
+    var posted = process.hrtime(started);
+    var value = range.Value2; // flushed before read
+    var elapsed = process.hrtime(started);
+    var ms = function(t) { return t[0] * 1e3 + t[1] / 1e6; };
+    console.log("==> " + title + ": " + (count / ms(elapsed) * 1000).toFixed(0) + " puts per second, " +
+        "loop released after " + ms(posted).toFixed(0) + " ms of " + ms(elapsed).toFixed(0) + " ms, last value " + value);
+    wbk.Close(false);
+    excel.Quit();
+}
+
+measure("synchronous", {});
+measure("write-behind", { writeBehind: true });
+console.log(ActiveX.writeBehind()); // { limit, pending, posted, executed, skipped, failed }
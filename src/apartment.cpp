@@ -0,0 +1,465 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: GlobalPtr and Apartment class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+//-------------------------------------------------------------------------------------------------------
+// GlobalPtr implemetation
+
+IGlobalInterfaceTable *GlobalPtr::table = 0;
+std::mutex GlobalPtr::locker;
+
+HRESULT GlobalPtr::Table(IGlobalInterfaceTable **git) {
+	std::lock_guard<std::mutex> lock(locker);
+
+	// Table is process wide and free threaded, never released because it may outlive COM on unload
+	if (!table) {
+		HRESULT hrcode = CoCreateInstance(CLSID_StdGlobalInterfaceTable, 0, CLSCTX_INPROC_SERVER, IID_IGlobalInterfaceTable, (void**)&table);
+		if FAILED(hrcode) return hrcode;
+	}
+	*git = table;
+	return S_OK;
+}
+
+GlobalPtr::GlobalPtr(IDispatch *disp) : cookie(0) {
+	IGlobalInterfaceTable *git;
+	hrcode = disp ? Table(&git) : E_POINTER;
+	if SUCCEEDED(hrcode) hrcode = git->RegisterInterfaceInGlobal(disp, IID_IDispatch, &cookie);
+}
+
+GlobalPtr::~GlobalPtr() {
+	IGlobalInterfaceTable *git;
+	if (cookie != 0 && SUCCEEDED(Table(&git))) git->RevokeInterfaceFromGlobal(cookie);
+}
+
+HRESULT GlobalPtr::Get(IDispatch **disp) {
+	IGlobalInterfaceTable *git;
+	if FAILED(hrcode) return hrcode;
+	HRESULT hr = Table(&git);
+	if SUCCEEDED(hr) hr = git->GetInterfaceFromGlobal(cookie, IID_IDispatch, (void**)disp);
+	return hr;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Apartment implemetation
+
+std::vector<ApartmentPtr> Apartment::workers;
+size_t Apartment::next = 0;
+std::recursive_mutex Apartment::workers_locker;
+ULONG Apartment::quarantined = 0;
+DWORD Apartment::stop_timeout = 5000;
+std::mutex Apartment::policies_locker;
+
+// Interactive calls get 8 of 13 turns while all lanes are busy, bulk lane is never starved
+Apartment::policy_t Apartment::policies[lane_count] = {
+	{ 8, 0, false, 0 },
+	{ 4, 0, false, 0 },
+	{ 1, 0, false, 0 }
+};
+
+static const char *lane_names[lane_count] = { "interactive", "normal", "bulk" };
+
+static inline uint64_t ElapsedMicroseconds(const LARGE_INTEGER &from, const LARGE_INTEGER &to) {
+	static LARGE_INTEGER frequency = { 0 };
+	if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	return (to.QuadPart > from.QuadPart) ? (uint64_t)((to.QuadPart - from.QuadPart) * 1000000 / frequency.QuadPart) : 0;
+}
+
+void Apartment::timing_t::Add(uint64_t us) {
+	int bucket = 0;
+	while (bucket < 31 && (us >> bucket) > 1) bucket++;
+	buckets[bucket]++;
+	count++;
+	sum += us;
+	if (us > max) max = us;
+}
+
+// Upper bound of the bucket containing percentile
+uint64_t Apartment::timing_t::Percentile(double p) const {
+	if (count == 0) return 0;
+	uint64_t rank = (uint64_t)ceil(count * p), total = 0;
+	for (int bucket = 0; bucket < 32; bucket++) {
+		total += buckets[bucket];
+		if (total >= rank) return std::min(((uint64_t)2 << bucket) - 1, max);
+	}
+	return max;
+}
+
+Apartment::policy_t Apartment::Policy(int lane) {
+	std::lock_guard<std::mutex> lock(policies_locker);
+	return policies[lane];
+}
+
+Apartment::Apartment() : thread(0), thread_id(0), stopping(false), object_next(0) {
+	wakeup = CreateEvent(0, FALSE, FALSE, 0);
+}
+
+Apartment::~Apartment() {
+	if (thread) CloseHandle(thread);
+	if (wakeup) CloseHandle(wakeup);
+	NODE_DEBUG_MSG("Apartment destructor");
+}
+
+HRESULT Apartment::Start() {
+	if (thread) return S_FALSE;
+	if (!wakeup) return HRESULT_FROM_WIN32(GetLastError());
+
+	// Thread holds reference to apartment until it exits
+	ApartmentPtr *self = new ApartmentPtr(shared_from_this());
+	thread = CreateThread(0, 0, Run, self, 0, &thread_id);
+	if (!thread) {
+		delete self;
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+	return S_OK;
+}
+
+void Apartment::Stop(bool wait) {
+	std::vector<waiter_t> waiters;
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (stopping) return;
+		stopping = true;
+		for (lane_state_t &state : lanes) {
+			for (waiter_t &waiter : state.waiting) waiters.push_back(std::move(waiter));
+			state.waiting.clear();
+		}
+	}
+	for (waiter_t &waiter : waiters) waiter.rejected(RPC_E_DISCONNECTED);
+	SetEvent(wakeup);
+
+	// Hung server call should not hang process exit
+	if (wait && thread && !IsCurrent()) WaitForSingleObject(thread, stop_timeout);
+}
+
+bool Apartment::Post(const std::function<void()> &func, int lane) {
+	task_t task = { func };
+	QueryPerformanceCounter(&task.queued);
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (stopping) return false;
+		lanes[lane].tasks.push_back(std::move(task));
+	}
+	SetEvent(wakeup);
+	return true;
+}
+
+HRESULT Apartment::Submit(const std::function<void()> &func, int lane, const std::function<void(HRESULT)> &rejected) {
+	policy_t policy = Policy(lane);
+	task_t task = { func };
+	QueryPerformanceCounter(&task.queued);
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (stopping) return RPC_E_DISCONNECTED;
+		lane_state_t &state = lanes[lane];
+		if (policy.limit > 0 && (state.tasks.size() >= policy.limit || !state.waiting.empty())) {
+			if (!policy.wait || policy.timeout == 0) {
+				state.rejected++;
+				return RPC_E_SERVERCALL_RETRYLATER;
+			}
+
+			// Worker wakes up to schedule expiration of the waiter
+			waiter_t waiter = { std::move(task), rejected, GetTickCount64() + policy.timeout };
+			state.waiting.push_back(std::move(waiter));
+		}
+		else state.tasks.push_back(std::move(task));
+	}
+	SetEvent(wakeup);
+	return S_OK;
+}
+
+// Smooth weighted round robin over lanes with tasks, idle lane does not save credit
+bool Apartment::Next(task_t &task, int &lane) {
+	int total = 0;
+	lane = -1;
+	for (int i = 0; i < lane_count; i++) {
+		lane_state_t &state = lanes[i];
+		if (state.tasks.empty()) {
+			state.credit = 0;
+			continue;
+		}
+		int weight = std::max(policies[i].weight, 1);
+		state.credit += weight;
+		total += weight;
+		if (lane < 0 || state.credit > lanes[lane].credit) lane = i;
+	}
+	if (lane < 0) return false;
+	lane_state_t &state = lanes[lane];
+	state.credit -= total;
+	task = std::move(state.tasks.front());
+	state.tasks.pop_front();
+
+	// Slot is passed to waiters, limit may be changed meanwhile
+	size_t limit = policies[lane].limit;
+	while (!state.waiting.empty() && (limit == 0 || state.tasks.size() < limit)) {
+		state.tasks.push_back(std::move(state.waiting.front().task));
+		state.waiting.pop_front();
+	}
+	return true;
+}
+
+DWORD Apartment::Expire() {
+	std::vector<waiter_t> expired;
+	ULONGLONG now = GetTickCount64(), next = 0;
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		for (lane_state_t &state : lanes) {
+			std::deque<waiter_t>::iterator it = state.waiting.begin();
+			while (it != state.waiting.end()) {
+				if (it->deadline > now) {
+					if (next == 0 || it->deadline < next) next = it->deadline;
+					++it;
+					continue;
+				}
+				expired.push_back(std::move(*it));
+				it = state.waiting.erase(it);
+				state.rejected++;
+			}
+		}
+	}
+	for (waiter_t &waiter : expired) waiter.rejected(RPC_E_SERVERCALL_RETRYLATER);
+	return (next == 0) ? INFINITE : (DWORD)(next - now);
+}
+
+ULONG Apartment::Attach(IDispatch *disp) {
+	ULONG id = ++object_next;
+	objects[id] = disp;
+	return id;
+}
+
+IDispatch *Apartment::Find(ULONG id) {
+	std::map<ULONG, CComPtr<IDispatch>>::iterator it = objects.find(id);
+	return (it != objects.end()) ? (IDispatch*)it->second : 0;
+}
+
+void Apartment::Detach(ULONG id) {
+	objects.erase(id);
+}
+
+DWORD WINAPI Apartment::Run(LPVOID param) {
+	ApartmentPtr self(*(ApartmentPtr*)param);
+	delete (ApartmentPtr*)param;
+	CoInitializeEx(0, COINIT_APARTMENTTHREADED);
+
+	// Hung calls of other threads may be cancelled by CoCancelCall
+	CoEnableCallCancellation(0);
+	self->Process();
+	self->objects.clear();
+	ClassClear();
+	CoDisableCallCancellation(0);
+	CoUninitialize();
+	return 0;
+}
+
+void Apartment::Process() {
+	MSG msg;
+	for (;;) {
+
+		// STA must dispatch window messages, proxies and servers use them for calls and callbacks
+		DWORD rc = MsgWaitForMultipleObjectsEx(1, &wakeup, Expire(), QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+		if (rc == WAIT_OBJECT_0 + 1) {
+			while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+			continue;
+		}
+		if (rc == WAIT_FAILED) break;
+		if (rc == WAIT_TIMEOUT) continue;
+
+		// Lane is chosen again after every task, so task of other lane posted meanwhile is not queued behind
+		for (;;) {
+			task_t task;
+			int lane;
+			{
+				std::lock_guard<std::mutex> lock(policies_locker);
+				std::lock_guard<std::mutex> lock_tasks(locker);
+				if (!Next(task, lane)) break;
+			}
+			LARGE_INTEGER started, finished;
+			QueryPerformanceCounter(&started);
+			task.func();
+			QueryPerformanceCounter(&finished);
+			{
+				std::lock_guard<std::mutex> lock(locker);
+				lane_state_t &state = lanes[lane];
+				state.executed++;
+				state.wait.Add(ElapsedMicroseconds(task.queued, started));
+				state.exec.Add(ElapsedMicroseconds(started, finished));
+			}
+			while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+			Expire();
+		}
+		std::lock_guard<std::mutex> lock(locker);
+		if (stopping) break;
+	}
+}
+
+bool Apartment::Wait(HANDLE handle, DWORD timeout) {
+	DWORD index;
+	HRESULT hrcode = CoWaitForMultipleHandles(0, timeout, 1, &handle, &index);
+	if (hrcode == RPC_S_CALLPENDING) return false;
+	if SUCCEEDED(hrcode) return true;
+	return WaitForSingleObject(handle, timeout) == WAIT_OBJECT_0;
+}
+
+ApartmentPtr Apartment::Get(int index) {
+	std::lock_guard<std::recursive_mutex> lock(workers_locker);
+	if (workers.empty() && FAILED(Configure(1))) return ApartmentPtr();
+	if (index < 0) index = (int)(next++ % workers.size());
+	return workers[index % workers.size()];
+}
+
+HRESULT Apartment::Configure(size_t count) {
+	std::lock_guard<std::recursive_mutex> lock(workers_locker);
+	while (workers.size() > count) {
+		workers.back()->Stop();
+		workers.pop_back();
+	}
+	while (workers.size() < count) {
+		ApartmentPtr worker(new Apartment());
+		HRESULT hrcode = worker->Start();
+		if FAILED(hrcode) return hrcode;
+		workers.push_back(worker);
+	}
+	return S_OK;
+}
+
+void Apartment::Quarantine(const ApartmentPtr &apartment) {
+	std::unique_lock<std::recursive_mutex> lock(workers_locker);
+	for (ApartmentPtr &worker : workers) {
+		if (worker != apartment) continue;
+		ApartmentPtr replacement(new Apartment());
+		if SUCCEEDED(replacement->Start()) worker = replacement;
+		break;
+	}
+	quarantined++;
+	lock.unlock();
+	apartment->Stop(false);
+}
+
+void Apartment::Clear() {
+	std::lock_guard<std::recursive_mutex> lock(workers_locker);
+	for (ApartmentPtr &worker : workers) worker->Stop();
+	workers.clear();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void Apartment::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "apartments", NodeApartments);
+	NODE_SET_METHOD(target, "lanes", NodeLanes);
+	NODE_DEBUG_MSG("Apartment initialized");
+}
+
+void Apartment::NodeApartments(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() > 0) {
+		if (!args[0]->IsUint32() || args[0]->Uint32Value() == 0) {
+			isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+			return;
+		}
+		HRESULT hrcode = Configure(args[0]->Uint32Value());
+		if FAILED(hrcode) {
+			isolate->ThrowException(Win32Error(isolate, hrcode, L"ApartmentStart"));
+			return;
+		}
+	}
+	std::lock_guard<std::recursive_mutex> lock(workers_locker);
+	args.GetReturnValue().Set(Uint32::New(isolate, (uint32_t)workers.size()));
+}
+
+int Apartment::Lane(Isolate *isolate, const Local<Value> &opt, int def) {
+	if (!opt->IsObject()) return def;
+	Local<Value> val = opt->ToObject()->Get(String::NewFromUtf8(isolate, "priority"));
+	if (!val->IsString()) return def;
+	String::Utf8Value name(val);
+	for (int lane = 0; lane < lane_count; lane++) {
+		if (*name && strcmp(*name, lane_names[lane]) == 0) return lane;
+	}
+	return def;
+}
+
+static Local<Object> LaneTiming(Isolate *isolate, uint64_t count, uint64_t sum, uint64_t max, uint64_t p99) {
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "avg"), Number::New(isolate, count ? (double)sum / count / 1000.0 : 0));
+	result->Set(String::NewFromUtf8(isolate, "p99"), Number::New(isolate, (double)p99 / 1000.0));
+	result->Set(String::NewFromUtf8(isolate, "max"), Number::New(isolate, (double)max / 1000.0));
+	return result;
+}
+
+void Apartment::NodeLanes(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+
+	// Policies by lane name: { weight, limit, policy: 'reject' or 'wait', timeout }
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opt = args[0]->ToObject();
+		std::lock_guard<std::mutex> lock(policies_locker);
+		for (int lane = 0; lane < lane_count; lane++) {
+			Local<Value> item = opt->Get(String::NewFromUtf8(isolate, lane_names[lane]));
+			if (!item->IsObject()) continue;
+			Local<Object> conf = item->ToObject();
+			policy_t &policy = policies[lane];
+			Local<Value> val = conf->Get(String::NewFromUtf8(isolate, "weight"));
+			if (val->IsUint32() && val->Uint32Value() > 0) policy.weight = (int)std::min(val->Uint32Value(), (uint32_t)1000);
+			val = conf->Get(String::NewFromUtf8(isolate, "limit"));
+			if (val->IsUint32()) policy.limit = val->Uint32Value();
+			val = conf->Get(String::NewFromUtf8(isolate, "policy"));
+			if (val->IsString()) policy.wait = (strcmp(*String::Utf8Value(val), "wait") == 0);
+			val = conf->Get(String::NewFromUtf8(isolate, "timeout"));
+			if (val->IsUint32()) policy.timeout = val->Uint32Value();
+		}
+	}
+
+	// Counters of all workers, percentiles from merged histograms
+	std::vector<ApartmentPtr> items;
+	{
+		std::lock_guard<std::recursive_mutex> lock(workers_locker);
+		items = workers;
+	}
+	Local<Object> result(Object::New(isolate));
+	for (int lane = 0; lane < lane_count; lane++) {
+		uint64_t queued = 0, waiting = 0, executed = 0, rejected = 0;
+		timing_t wait, exec;
+		for (ApartmentPtr &worker : items) {
+			std::lock_guard<std::mutex> lock(worker->locker);
+			const lane_state_t &state = worker->lanes[lane];
+			queued += state.tasks.size();
+			waiting += state.waiting.size();
+			executed += state.executed;
+			rejected += state.rejected;
+			const timing_t *src[] = { &state.wait, &state.exec };
+			timing_t *dst[] = { &wait, &exec };
+			for (int i = 0; i < 2; i++) {
+				dst[i]->count += src[i]->count;
+				dst[i]->sum += src[i]->sum;
+				dst[i]->max = std::max(dst[i]->max, src[i]->max);
+				for (int b = 0; b < 32; b++) dst[i]->buckets[b] += src[i]->buckets[b];
+			}
+		}
+		policy_t policy = Policy(lane);
+		Local<Object> item(Object::New(isolate));
+		item->Set(String::NewFromUtf8(isolate, "weight"), Int32::New(isolate, policy.weight));
+		item->Set(String::NewFromUtf8(isolate, "limit"), Number::New(isolate, (double)policy.limit));
+		item->Set(String::NewFromUtf8(isolate, "policy"), String::NewFromUtf8(isolate, policy.wait ? "wait" : "reject"));
+		item->Set(String::NewFromUtf8(isolate, "timeout"), Number::New(isolate, policy.timeout));
+		item->Set(String::NewFromUtf8(isolate, "queued"), Number::New(isolate, (double)queued));
+		item->Set(String::NewFromUtf8(isolate, "waiting"), Number::New(isolate, (double)waiting));
+		item->Set(String::NewFromUtf8(isolate, "executed"), Number::New(isolate, (double)executed));
+		item->Set(String::NewFromUtf8(isolate, "rejected"), Number::New(isolate, (double)rejected));
+		item->Set(String::NewFromUtf8(isolate, "wait"), LaneTiming(isolate, wait.count, wait.sum, wait.max, wait.Percentile(0.99)));
+		item->Set(String::NewFromUtf8(isolate, "exec"), LaneTiming(isolate, exec.count, exec.sum, exec.max, exec.Percentile(0.99)));
+		result->Set(String::NewFromUtf8(isolate, lane_names[lane]), item);
+	}
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
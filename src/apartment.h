@@ -0,0 +1,142 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: Apartment class declarations. Worker STA threads executing COM calls outside of the loop,
+//              results are returned to the loop through LoopQueue
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+// Interface registered in global interface table, may be used from any apartment of the process
+class GlobalPtr {
+public:
+	GlobalPtr(IDispatch *disp);
+	~GlobalPtr();
+	HRESULT Get(IDispatch **disp);
+	inline HRESULT Status() { return hrcode; }
+
+private:
+	DWORD cookie;
+	HRESULT hrcode;
+	static IGlobalInterfaceTable *table;
+	static std::mutex locker;
+	static HRESULT Table(IGlobalInterfaceTable **git);
+};
+
+typedef std::shared_ptr<GlobalPtr> GlobalPtrPtr;
+
+//-------------------------------------------------------------------------------------------------------
+
+// Lanes of worker tasks, served by weights so short interactive calls are not queued behind bulk work
+enum lane_t { lane_interactive = 0, lane_normal = 1, lane_bulk = 2, lane_count = 3 };
+
+class Apartment : public std::enable_shared_from_this<Apartment> {
+public:
+	Apartment();
+	~Apartment();
+
+	HRESULT Start();
+	void Stop(bool wait = true);
+
+	// Execute on apartment thread in posting order of the lane, false when apartment is stopped
+	bool Post(const std::function<void()> &func, int lane = lane_normal);
+
+	// Post with admission control of the lane: RPC_E_SERVERCALL_RETRYLATER when lane is full and its policy
+	// rejects, RPC_E_DISCONNECTED when apartment is stopped. With policy 'wait' the caller is not blocked, task 
+	// waits for free slot and rejected is called on some thread when timeout elapses or apartment stops meanwhile
+	HRESULT Submit(const std::function<void()> &func, int lane, const std::function<void(HRESULT)> &rejected);
+
+	inline DWORD ThreadId() { return thread_id; }
+	inline bool IsCurrent() { return GetCurrentThreadId() == thread_id; }
+	inline bool IsStopped() { return stopping; }
+
+	// Objects owned by apartment, used and released only on apartment thread
+	ULONG Attach(IDispatch *disp);
+	IDispatch *Find(ULONG id);
+	void Detach(ULONG id);
+
+	// Worker by index or next worker in round robin order
+	static std::shared_ptr<Apartment> Get(int index = -1);
+	static HRESULT Configure(size_t count);
+	static void Clear();
+
+	// Hung worker is replaced by new one and stops when its call returns, its objects are disconnected
+	static void Quarantine(const std::shared_ptr<Apartment> &apartment);
+	static ULONG quarantined;
+
+	// Wait for handle and dispatch COM calls of the current apartment meanwhile
+	static bool Wait(HANDLE handle, DWORD timeout = INFINITE);
+
+	// Lane by option priority: 'interactive', 'normal' or 'bulk'
+	static int Lane(Isolate *isolate, const Local<Value> &opt, int def);
+
+	static void NodeInit(Handle<Object> target);
+
+private:
+	HANDLE thread, wakeup;
+	DWORD thread_id;
+	volatile bool stopping;
+	std::mutex locker;
+	std::map<ULONG, CComPtr<IDispatch>> objects;
+	ULONG object_next;
+
+	// Queue wait and execution times are kept separately, histograms by powers of two microseconds
+	struct timing_t {
+		uint64_t count, sum, max;
+		uint32_t buckets[32];
+		timing_t() : count(0), sum(0), max(0) { memset(buckets, 0, sizeof(buckets)); }
+		void Add(uint64_t us);
+		uint64_t Percentile(double p) const;
+	};
+	struct task_t {
+		std::function<void()> func;
+		LARGE_INTEGER queued;
+	};
+	struct waiter_t {
+		task_t task;
+		std::function<void(HRESULT)> rejected;
+		ULONGLONG deadline;
+	};
+	struct lane_state_t {
+		std::deque<task_t> tasks;
+		std::deque<waiter_t> waiting; // Admitted in order as tasks leave the lane
+		int credit;
+		uint64_t executed, rejected;
+		timing_t wait, exec;
+		lane_state_t() : credit(0), executed(0), rejected(0) {}
+	};
+	lane_state_t lanes[lane_count];
+	bool Next(task_t &task, int &lane);
+
+	// Rejects waiters past deadline, returns milliseconds to the next deadline
+	DWORD Expire();
+
+	// Lane policies are shared by all workers
+	struct policy_t {
+		int weight;
+		size_t limit; // Queued tasks of the lane, 0 is not bounded
+		bool wait;    // Task waits for free slot instead of rejection
+		DWORD timeout;
+	};
+	static policy_t policies[lane_count];
+	static std::mutex policies_locker;
+	static policy_t Policy(int lane);
+
+	static DWORD WINAPI Run(LPVOID param);
+	void Process();
+
+	// Workers are shared by all isolates of the process
+	static std::vector<std::shared_ptr<Apartment>> workers;
+	static std::recursive_mutex workers_locker;
+	static size_t next;
+	static DWORD stop_timeout;
+
+	static void NodeApartments(const FunctionCallbackInfo<Value> &args);
+	static void NodeLanes(const FunctionCallbackInfo<Value> &args);
+};
+
+typedef std::shared_ptr<Apartment> ApartmentPtr;
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,312 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: FlatBuilder and ArrowWriter class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "arrow.h"
+
+//-------------------------------------------------------------------------------------------------------
+// FlatBuilder implemetation
+
+void FlatBuilder::Reserve(size_t size) {
+	if (head >= size) return;
+	size_t used = buf.size() - head;
+	std::vector<uint8_t> items(std::max(buf.size() * 2, used + size + 256));
+	if (used > 0) memcpy(&items[items.size() - used], &buf[head], used);
+	head = items.size() - used;
+	buf.swap(items);
+}
+
+void FlatBuilder::PushBytes(const void *data, size_t size) {
+	Reserve(size);
+	head -= size;
+	if (size > 0) memcpy(&buf[head], data, size);
+}
+
+void FlatBuilder::Pad(size_t size) {
+	Reserve(size);
+	head -= size;
+	memset(&buf[head], 0, size);
+}
+
+// Padding so data of size pushed next ends aligned
+void FlatBuilder::Align(size_t size, size_t align) {
+	if (align > minalign) minalign = align;
+	Pad((~(Size() + size) + 1) & (align - 1));
+}
+
+FlatBuilder::offset_t FlatBuilder::String(const std::string &str) {
+	Align(str.size() + 1, sizeof(offset_t));
+	Push<uint8_t>(0);
+	PushBytes(str.data(), str.size());
+	Push<uint32_t>((uint32_t)str.size());
+	return Size();
+}
+
+FlatBuilder::offset_t FlatBuilder::Structs(const void *data, size_t size, size_t count, size_t align) {
+	Align(size * count, sizeof(offset_t));
+	Align(size * count, align);
+	PushBytes(data, size * count);
+	Push<uint32_t>((uint32_t)count);
+	return Size();
+}
+
+FlatBuilder::offset_t FlatBuilder::Offsets(const std::vector<offset_t> &items) {
+	Align(items.size() * sizeof(offset_t), sizeof(offset_t));
+	for (size_t i = items.size(); i > 0; i--) Push<uint32_t>(Refer(items[i - 1]));
+	Push<uint32_t>((uint32_t)items.size());
+	return Size();
+}
+
+void FlatBuilder::StartTable() {
+	fields.clear();
+	table = Size();
+}
+
+void FlatBuilder::AddOffset(int slot, offset_t offset) {
+	offset_t value = Refer(offset);
+	Push<uint32_t>(value);
+	fields.push_back(std::make_pair(slot, Size()));
+}
+
+FlatBuilder::offset_t FlatBuilder::EndTable() {
+
+	// Table starts with signed offset to its vtable, vtable is placed just before the table
+	Prepend<int32_t>(0);
+	offset_t object = Size();
+	int slots = 0;
+	for (const std::pair<int, offset_t> &field : fields) slots = std::max(slots, field.first + 1);
+	std::vector<uint16_t> vtable(slots, 0);
+	for (const std::pair<int, offset_t> &field : fields) vtable[field.first] = (uint16_t)(object - field.second);
+	for (int i = slots - 1; i >= 0; i--) Push<uint16_t>(vtable[i]);
+	Push<uint16_t>((uint16_t)(object - table));
+	Push<uint16_t>((uint16_t)(sizeof(uint16_t) * (slots + 2)));
+	int32_t vtable_offset = (int32_t)(Size() - object);
+	memcpy(&buf[buf.size() - object], &vtable_offset, sizeof(int32_t));
+	fields.clear();
+	return object;
+}
+
+void FlatBuilder::Finish(offset_t root, std::vector<uint8_t> &result) {
+	Align(sizeof(offset_t), minalign);
+	Push<uint32_t>(Refer(root));
+	result.assign(buf.begin() + head, buf.end());
+}
+
+//-------------------------------------------------------------------------------------------------------
+// ArrowWriter implemetation
+
+// Message header and type ids of Arrow format flatbuffers
+enum { header_schema = 1, header_batch = 3 };
+enum { arrow_int = 2, arrow_float = 3, arrow_binary = 4, arrow_utf8 = 5, arrow_bool = 6, arrow_timestamp = 10 };
+static const int16_t metadata_v5 = 4;
+
+static FlatBuilder::offset_t Message(FlatBuilder &fb, uint8_t type, FlatBuilder::offset_t header, int64_t body) {
+	fb.StartTable();
+	fb.AddScalar<int64_t>(3, body);
+	fb.AddOffset(2, header);
+	fb.AddScalar<int16_t>(0, metadata_v5);
+	fb.AddScalar<uint8_t>(1, type);
+	return fb.EndTable();
+}
+
+size_t ArrowWriter::AddColumn(const std::string &name, type_t type) {
+	column_t column;
+	column.name = name;
+	column.type = type;
+	column.nulls = 0;
+	if (type == type_utf8 || type == type_binary) Put<int32_t>(column, 0);
+	columns.push_back(column);
+	return columns.size() - 1;
+}
+
+void ArrowWriter::Valid(column_t &column, bool valid) {
+	if (rows % 8 == 0) column.validity.push_back(0);
+	if (valid) column.validity.back() |= (uint8_t)(1 << (rows % 8));
+	else column.nulls++;
+}
+
+void ArrowWriter::AppendNull(size_t col) {
+	column_t &column = columns[col];
+	Valid(column, false);
+	switch (column.type) {
+	case type_bool: if (rows % 8 == 0) column.values.push_back(0); break;
+	case type_int32: Put<int32_t>(column, 0); break;
+	case type_utf8: case type_binary: Put<int32_t>(column, (int32_t)column.data.size()); break;
+	default: Put<int64_t>(column, 0); break;
+	}
+}
+
+void ArrowWriter::AppendBool(size_t col, bool value) {
+	column_t &column = columns[col];
+	if (column.type != type_bool) {
+		AppendInt(col, value ? 1 : 0);
+		return;
+	}
+	Valid(column, true);
+	if (rows % 8 == 0) column.values.push_back(0);
+	if (value) column.values.back() |= (uint8_t)(1 << (rows % 8));
+}
+
+void ArrowWriter::AppendInt(size_t col, int64_t value) {
+	column_t &column = columns[col];
+	switch (column.type) {
+	case type_int32: Valid(column, true); Put<int32_t>(column, (int32_t)value); break;
+	case type_int64: case type_timestamp: Valid(column, true); Put<int64_t>(column, value); break;
+	case type_float64: Valid(column, true); Put<double>(column, (double)value); break;
+	case type_bool: AppendBool(col, value != 0); break;
+	default: {
+		std::string text(std::to_string(value));
+		AppendBytes(col, text.data(), text.size());
+	}}
+}
+
+void ArrowWriter::AppendDouble(size_t col, double value) {
+	column_t &column = columns[col];
+	switch (column.type) {
+	case type_float64: Valid(column, true); Put<double>(column, value); break;
+	case type_utf8: case type_binary: {
+		char text[32];
+		int size = snprintf(text, sizeof(text), "%.17g", value);
+		AppendBytes(col, text, (size_t)size);
+		break;
+	}
+	default: AppendInt(col, (int64_t)value); break;
+	}
+}
+
+void ArrowWriter::AppendBytes(size_t col, const void *data, size_t size) {
+	column_t &column = columns[col];
+	if (column.type != type_utf8 && column.type != type_binary) {
+		AppendNull(col);
+		return;
+	}
+	Valid(column, true);
+	column.data.insert(column.data.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	Put<int32_t>(column, (int32_t)column.data.size());
+}
+
+bool ArrowWriter::EndRow() {
+	rows++;
+	total++;
+	if (rows >= batch) return Flush();
+	return !failed;
+}
+
+// Encapsulated message: continuation marker, metadata size, metadata and body padded to 8 bytes
+bool ArrowWriter::Write(const std::vector<uint8_t> &metadata, const std::vector<const std::vector<uint8_t>*> &body, int64_t body_size) {
+	static const uint8_t zeros[8] = { 0 };
+	size_t padded = (metadata.size() + 7) & ~(size_t)7;
+	uint32_t prefix[2] = { 0xFFFFFFFF, (uint32_t)padded };
+	bool ok = sink(prefix, sizeof(prefix)) && sink(metadata.data(), metadata.size());
+	if (ok && padded > metadata.size()) ok = sink(zeros, padded - metadata.size());
+	for (const std::vector<uint8_t> *items : body) {
+		size_t size = items->size(), pad = ((size + 7) & ~(size_t)7) - size;
+		if (ok && size > 0) ok = sink(items->data(), size);
+		if (ok && pad > 0) ok = sink(zeros, pad);
+	}
+	bytes += sizeof(prefix) + padded + body_size;
+	if (!ok) failed = true;
+	return ok;
+}
+
+bool ArrowWriter::Schema() {
+	started = true;
+	FlatBuilder fb;
+	std::vector<FlatBuilder::offset_t> fields;
+	for (column_t &column : columns) {
+		FlatBuilder::offset_t name = fb.String(column.name);
+		FlatBuilder::offset_t children = fb.Offsets(std::vector<FlatBuilder::offset_t>());
+		uint8_t type_id;
+		fb.StartTable();
+		switch (column.type) {
+		case type_bool: type_id = arrow_bool; break;
+		case type_int32: type_id = arrow_int; fb.AddScalar<int32_t>(0, 32); fb.AddScalar<uint8_t>(1, 1); break;
+		case type_int64: type_id = arrow_int; fb.AddScalar<int32_t>(0, 64); fb.AddScalar<uint8_t>(1, 1); break;
+		case type_float64: type_id = arrow_float; fb.AddScalar<int16_t>(0, 2); break; // Double
+		case type_timestamp: type_id = arrow_timestamp; fb.AddScalar<int16_t>(0, 1); break; // Milliseconds, no time zone
+		case type_binary: type_id = arrow_binary; break;
+		default: type_id = arrow_utf8; break;
+		}
+		FlatBuilder::offset_t type = fb.EndTable();
+		fb.StartTable();
+		fb.AddOffset(0, name);
+		fb.AddOffset(3, type);
+		fb.AddOffset(5, children);
+		fb.AddScalar<uint8_t>(1, 1); // Nullable
+		fb.AddScalar<uint8_t>(2, type_id);
+		fields.push_back(fb.EndTable());
+	}
+	FlatBuilder::offset_t items = fb.Offsets(fields);
+	fb.StartTable();
+	fb.AddOffset(1, items);
+	fb.AddScalar<int16_t>(0, 0); // Little endian
+	FlatBuilder::offset_t schema = fb.EndTable();
+	std::vector<uint8_t> metadata;
+	fb.Finish(Message(fb, header_schema, schema, 0), metadata);
+	return Write(metadata, std::vector<const std::vector<uint8_t>*>(), 0);
+}
+
+bool ArrowWriter::Flush() {
+	if (failed) return false;
+	if (!started && !Schema()) return false;
+	if (rows == 0) return true;
+
+	// Buffers of every column in schema order, validity is empty when column has no nulls
+	struct node_t { int64_t length, nulls; };
+	struct buffer_t { int64_t offset, length; };
+	static const std::vector<uint8_t> none;
+	std::vector<node_t> nodes;
+	std::vector<buffer_t> buffers;
+	std::vector<const std::vector<uint8_t>*> body;
+	int64_t offset = 0;
+	auto add = [&](const std::vector<uint8_t> &items) {
+		buffer_t buffer = { offset, (int64_t)items.size() };
+		buffers.push_back(buffer);
+		body.push_back(&items);
+		offset += (items.size() + 7) & ~(size_t)7;
+	};
+	for (column_t &column : columns) {
+		node_t node = { (int64_t)rows, column.nulls };
+		nodes.push_back(node);
+		add(column.nulls > 0 ? column.validity : none);
+		add(column.values);
+		if (column.type == type_utf8 || column.type == type_binary) add(column.data);
+	}
+
+	FlatBuilder fb;
+	FlatBuilder::offset_t items = fb.Structs(buffers.data(), sizeof(buffer_t), buffers.size(), sizeof(int64_t));
+	FlatBuilder::offset_t fields = fb.Structs(nodes.data(), sizeof(node_t), nodes.size(), sizeof(int64_t));
+	fb.StartTable();
+	fb.AddScalar<int64_t>(0, (int64_t)rows);
+	fb.AddOffset(1, fields);
+	fb.AddOffset(2, items);
+	FlatBuilder::offset_t record = fb.EndTable();
+	std::vector<uint8_t> metadata;
+	fb.Finish(Message(fb, header_batch, record, offset), metadata);
+	if (!Write(metadata, body, offset)) return false;
+	batches++;
+
+	// Column buffers are reused by next batch
+	rows = 0;
+	for (column_t &column : columns) {
+		column.validity.clear();
+		column.values.clear();
+		column.data.clear();
+		column.nulls = 0;
+		if (column.type == type_utf8 || column.type == type_binary) Put<int32_t>(column, 0);
+	}
+	return true;
+}
+
+bool ArrowWriter::End() {
+	static const uint32_t eos[2] = { 0xFFFFFFFF, 0 };
+	if (!Flush()) return false;
+	bytes += sizeof(eos);
+	if (!sink(eos, sizeof(eos))) failed = true;
+	return !failed;
+}
+
+//-------------------------------------------------------------------------------------------------------
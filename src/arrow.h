@@ -0,0 +1,100 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: ArrowWriter class declarations. Apache Arrow IPC stream encoder, values are appended by rows
+//              into column buffers of one record batch, every full batch is written to sink and reset.
+//              Message metadata is encoded as flatbuffers without external library
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+// Minimal flatbuffer builder, buffer is built from the end like reference implementation
+class FlatBuilder {
+public:
+	typedef uint32_t offset_t; // Position counted from the end of buffer
+
+	FlatBuilder() : head(0), minalign(1) {}
+
+	offset_t String(const std::string &str);
+	offset_t Structs(const void *data, size_t size, size_t count, size_t align);
+	offset_t Offsets(const std::vector<offset_t> &items);
+
+	void StartTable();
+	template<typename T> void AddScalar(int slot, T value) { Prepend(value); fields.push_back(std::make_pair(slot, Size())); }
+	void AddOffset(int slot, offset_t offset);
+	offset_t EndTable();
+
+	// Root offset is prepended, result is aligned to the largest scalar
+	void Finish(offset_t root, std::vector<uint8_t> &result);
+
+private:
+	std::vector<uint8_t> buf;
+	size_t head; // Data occupies buf[head..]
+	size_t minalign;
+	offset_t table;
+	std::vector<std::pair<int, offset_t>> fields;
+
+	inline offset_t Size() { return (offset_t)(buf.size() - head); }
+	void Reserve(size_t size);
+	void Pad(size_t size);
+	void Align(size_t size, size_t align);
+	void PushBytes(const void *data, size_t size);
+	template<typename T> void Push(T value) { PushBytes(&value, sizeof(T)); }
+	template<typename T> void Prepend(T value) { Align(sizeof(T), sizeof(T)); Push(value); }
+	inline offset_t Refer(offset_t offset) { Align(sizeof(offset_t), sizeof(offset_t)); return Size() - offset + sizeof(offset_t); }
+};
+
+//-------------------------------------------------------------------------------------------------------
+
+class ArrowWriter {
+public:
+	enum type_t { type_bool, type_int32, type_int64, type_float64, type_timestamp, type_utf8, type_binary };
+
+	// Receives encoded messages, false stops writing
+	typedef std::function<bool(const void *data, size_t size)> sink_t;
+
+	ArrowWriter(const sink_t &sink, size_t batch = 65536) : sink(sink), batch(batch), rows(0), total(0), batches(0), bytes(0), started(false), failed(false) {}
+
+	size_t AddColumn(const std::string &name, type_t type);
+	inline size_t Columns() { return columns.size(); }
+	inline type_t Type(size_t col) { return columns[col].type; }
+
+	// Every column gets one value per row, timestamps are milliseconds since epoch
+	void AppendNull(size_t col);
+	void AppendBool(size_t col, bool value);
+	void AppendInt(size_t col, int64_t value);
+	void AppendDouble(size_t col, double value);
+	void AppendBytes(size_t col, const void *data, size_t size);
+	bool EndRow();
+
+	// Schema is written before the first batch, end marks end of stream
+	bool Flush();
+	bool End();
+
+	inline uint64_t Rows() { return total; }
+	inline uint64_t Batches() { return batches; }
+	inline uint64_t Bytes() { return bytes; }
+
+private:
+	struct column_t {
+		std::string name;
+		type_t type;
+		std::vector<uint8_t> validity, values, data; // Values are offsets of data for utf8 and binary
+		int64_t nulls;
+	};
+
+	sink_t sink;
+	size_t batch, rows;
+	uint64_t total, batches, bytes;
+	bool started, failed;
+	std::vector<column_t> columns;
+
+	void Valid(column_t &column, bool valid);
+	template<typename T> void Put(column_t &column, T value) { const uint8_t *ptr = (const uint8_t*)&value; column.values.insert(column.values.end(), ptr, ptr + sizeof(T)); }
+	bool Write(const std::vector<uint8_t> &metadata, const std::vector<const std::vector<uint8_t>*> &body, int64_t body_size);
+	bool Schema();
+};
+
+//-------------------------------------------------------------------------------------------------------
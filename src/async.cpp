@@ -0,0 +1,557 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: AsyncObject class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+thread_local Persistent<FunctionTemplate> AsyncObject::clazz;
+thread_local std::map<ULONG, AsyncCallPtr> AsyncObject::calls;
+thread_local ULONG AsyncObject::call_next = 0;
+thread_local std::map<std::wstring, AsyncObject::breaker_t> AsyncObject::breakers;
+thread_local ULONG AsyncObject::breaker_threshold = 3;
+thread_local DWORD AsyncObject::breaker_reset = 30000;
+
+static const HRESULT timeout_hrcode = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+
+static inline LPCOLESTR AsyncOperation(int kind) {
+	return (kind == AsyncCall::kind_create) ? L"CreateInstance" : (kind == AsyncCall::kind_put) ? L"DispPropertyPut" : (kind == AsyncCall::kind_get) ? L"DispPropertyGet" : L"DispInvoke";
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+AsyncObject::AsyncObject(const ApartmentPtr &_apartment, ULONG _id, const std::wstring &_progid, DWORD _timeout, int _lane)
+	: apartment(_apartment), id(_id), progid(_progid), timeout(_timeout), lane(_lane)
+{
+}
+
+AsyncObject::~AsyncObject() {
+
+	// Object is released on its apartment behind calls of its lane, calls of other lanes referenced it until
+	// completion. Stopped apartment releases all objects on exit
+	ApartmentPtr owner(apartment);
+	ULONG object = id;
+	owner->Post([owner, object]() { owner->Detach(object); }, lane);
+	NODE_DEBUG_MSG("AsyncObject destructor");
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Circuit breaker, executed on the loop thread
+
+HRESULT AsyncObject::Admit(const std::wstring &progid) {
+	breaker_t &breaker = breakers[progid];
+	breaker.calls++;
+	if (!breaker.open) return S_OK;
+
+	// One probe call is let through after reset period, others fail fast until it completes
+	if (!breaker.probing && GetTickCount() - breaker.opened >= breaker_reset) {
+		breaker.probing = true;
+		return S_OK;
+	}
+	breaker.rejected++;
+	return RPC_E_SERVERCALL_RETRYLATER;
+}
+
+void AsyncObject::Record(const std::wstring &progid, HRESULT hrcode) {
+	breaker_t &breaker = breakers[progid];
+	breaker.probing = false;
+	if (hrcode == E_ABORT) {
+		breaker.cancelled++;
+		return;
+	}
+
+	// Rejected by lane of the worker, server was not called
+	if (hrcode == RPC_E_SERVERCALL_RETRYLATER) return;
+	if (hrcode != timeout_hrcode) {
+
+		// Server answered, even with error
+		breaker.failures = 0;
+		breaker.open = false;
+		return;
+	}
+	breaker.timeouts++;
+	if (++breaker.failures >= breaker_threshold && breaker_threshold > 0) {
+		breaker.open = true;
+		breaker.opened = GetTickCount();
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Call execution
+
+Local<Promise> AsyncObject::Start(Isolate *isolate, const AsyncCallPtr &call) {
+	Local<Promise::Resolver> resolver = Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+	Local<Promise> promise = resolver->GetPromise();
+	call->id = ++call_next;
+	promise->Set(String::NewFromUtf8(isolate, "id"), Uint32::New(isolate, call->id));
+
+	// Apartment is checked first, so probe call admitted by open breaker always reaches the server
+	HRESULT hrcode = (!call->apartment || call->apartment->IsStopped()) ? RPC_E_DISCONNECTED : Admit(call->progid);
+	if FAILED(hrcode) {
+		resolver->Reject(Win32Error(isolate, hrcode, L"AsyncAdmit", call->name.c_str()));
+		return promise;
+	}
+
+	call->resolver.Reset(isolate, resolver);
+	call->queue = LoopQueue::Current();
+	calls[call->id] = call;
+	for (AsyncObject *obj : call->objects) obj->Ref();
+	for (AsyncCallPtr &depend : call->depends) depend->pipelined++;
+	LoopQueue::Ref();
+	if (call->timeout > 0) {
+		call->timer = new uv_timer_t;
+		uv_timer_init(call->queue->Loop(), call->timer);
+		call->timer->data = (void*)(uintptr_t)call->id;
+		uv_timer_start(call->timer, Timeout, call->timeout, 0);
+	}
+
+	// Call waiting for a slot of its lane may be abandoned by timer or cancellation meanwhile
+	auto rejected = [call](HRESULT hrcode) {
+		if (InterlockedCompareExchange(&call->state, AsyncCall::state_done, AsyncCall::state_queued) != AsyncCall::state_queued) return;
+		call->hrcode = hrcode;
+		call->queue->Post([call]() { Complete(call); });
+	};
+	hrcode = call->apartment->Submit([call]() { Execute(call); }, call->lane, rejected);
+	if FAILED(hrcode) rejected(hrcode);
+	return promise;
+}
+
+// Pending call was executed before on this thread, its failure is reported as failure of the dependent call
+HRESULT AsyncObject::Depend(AsyncCall *call, AsyncCall *base, bool &inherited) {
+	if (base->state != AsyncCall::state_done) return E_ABORT;
+	if SUCCEEDED(base->hrcode) return S_OK;
+	inherited = true;
+	call->name = base->name;
+	call->desc = base->desc;
+	call->source = base->source;
+	return base->hrcode;
+}
+
+// Objects of the apartment and pending results passed as arguments
+HRESULT AsyncObject::Resolve(AsyncCall *call, std::vector<CComVariant> &args, const std::vector<ULONG> &arg_objects, const std::vector<AsyncCallPtr> &arg_calls, bool &inherited) {
+	for (size_t i = 0; i < args.size(); i++) {
+		ULONG object = arg_objects[i];
+		AsyncCall *arg = arg_calls[i].get();
+		if (arg) {
+			HRESULT hrcode = Depend(call, arg, inherited);
+			if FAILED(hrcode) return hrcode;
+			if (!arg->result_object) {
+				VariantCopy(&args[i], &arg->result);
+				continue;
+			}
+			object = arg->result_object;
+		}
+		if (object == 0) continue;
+		IDispatch *disp = call->apartment->Find(object);
+		if (!disp) return RPC_E_DISCONNECTED;
+		VariantClear(&args[i]);
+		args[i].vt = VT_DISPATCH;
+		args[i].pdispVal = disp;
+		disp->AddRef();
+	}
+	return S_OK;
+}
+
+void AsyncObject::Execute(const AsyncCallPtr &call) {
+	if (InterlockedCompareExchange(&call->state, AsyncCall::state_running, AsyncCall::state_queued) != AsyncCall::state_queued) return;
+	call->thread = GetCurrentThreadId();
+	Apartment *apartment = call->apartment.get();
+	HRESULT hrcode = S_OK;
+	bool inherited = false; // Error of base call
+	CComVariant result;
+	if (call->kind == AsyncCall::kind_create) {
+		CLSID clsid;
+		CComPtr<IDispatch> disp;
+		hrcode = ClassFind(call->name.c_str(), &clsid);
+		if SUCCEEDED(hrcode) hrcode = ClassCreate(clsid, CLSCTX_INPROC_SERVER | CLSCTX_LOCAL_SERVER, &disp);
+		if SUCCEEDED(hrcode) {
+			result.vt = VT_DISPATCH;
+			result.pdispVal = disp.Detach();
+		}
+	}
+	else {
+		IDispatch *target = 0;
+		if (call->base) {
+
+			// Result object of base call is still attached
+			hrcode = Depend(call, call->base.get(), inherited);
+			if (SUCCEEDED(hrcode) && (target = apartment->Find(call->base->result_object)) == 0) hrcode = DISP_E_TYPEMISMATCH;
+		}
+		else if ((target = apartment->Find(call->object)) == 0) hrcode = RPC_E_DISCONNECTED;
+
+		// Pipelined members, intermediate objects stay on worker and are released here
+		CComPtr<IDispatch> current;
+		for (AsyncStep &step : call->path) {
+			if FAILED(hrcode) break;
+			CComVariant value;
+			CComPtr<IDispatch> next;
+			WORD flags = (step.kind == AsyncCall::kind_get) ? DISPATCH_PROPERTYGET : (DISPATCH_METHOD | DISPATCH_PROPERTYGET);
+			hrcode = Resolve(call.get(), step.args, step.arg_objects, step.arg_calls, inherited);
+			if FAILED(hrcode) break;
+			hrcode = DispInvoke(target, (LPOLESTR)step.name.c_str(), (UINT)step.args.size(), step.args.empty() ? 0 : &step.args[0], &value, flags);
+			if (SUCCEEDED(hrcode) && (!VariantDispGet(&value, &next) || !next)) hrcode = DISP_E_TYPEMISMATCH;
+			if FAILED(hrcode) call->name = step.name;
+			current = next;
+			target = current;
+		}
+		call->path.clear();
+
+		UINT argcnt = (UINT)call->args.size();
+		if SUCCEEDED(hrcode) hrcode = Resolve(call.get(), call->args, call->arg_objects, call->arg_calls, inherited);
+		if SUCCEEDED(hrcode) {
+			WORD flags = (call->kind == AsyncCall::kind_put) ? DISPATCH_PROPERTYPUT : (call->kind == AsyncCall::kind_get) ? DISPATCH_PROPERTYGET : (DISPATCH_METHOD | DISPATCH_PROPERTYGET);
+			VARIANT *args = argcnt > 0 ? &call->args[0] : 0;
+			hrcode = DispInvoke(target, (LPOLESTR)call->name.c_str(), argcnt, args, (call->kind == AsyncCall::kind_put) ? 0 : &result, flags);
+		}
+		call->args.clear();
+	}
+	std::wstring desc(call->desc), source(call->source);
+	if (FAILED(hrcode) && !inherited) DispErrorInfo(desc, source);
+
+	// Returned objects stay in apartment, loop receives handles
+	CComPtr<IDispatch> disp;
+	ULONG result_object = 0;
+	if (SUCCEEDED(hrcode) && VariantDispGet(&result, &disp)) {
+		VariantClear(&result);
+		if (disp) result_object = apartment->Attach(disp);
+	}
+
+	// Call timed out or cancelled meanwhile was already rejected by the loop, its result is abandoned
+	if (InterlockedCompareExchange(&call->state, AsyncCall::state_done, AsyncCall::state_running) != AsyncCall::state_running) {
+		if (result_object) apartment->Detach(result_object);
+		return;
+	}
+	call->hrcode = hrcode;
+	call->desc.swap(desc);
+	call->source.swap(source);
+	call->result_object = result_object;
+	VariantCopy(&call->result, &result);
+	if (!call->queue->Post([call]() { Complete(call); }) && result_object) apartment->Detach(result_object);
+}
+
+bool AsyncObject::Abandon(const AsyncCallPtr &call, AsyncCall::state_t state, bool deferred) {
+	LONG prev = InterlockedCompareExchange(&call->state, state, AsyncCall::state_queued);
+	if (prev == AsyncCall::state_running) prev = InterlockedCompareExchange(&call->state, state, AsyncCall::state_running);
+	if (prev != AsyncCall::state_queued && prev != AsyncCall::state_running) return false;
+
+	// Outgoing call of the worker is cancelled, it returns when server or proxy honors cancellation
+	bool running = (prev == AsyncCall::state_running);
+	if (running && call->thread) CoCancelCall(call->thread, 0);
+
+	// Worker hung in the call is replaced, its objects are lost
+	if (running && state == AsyncCall::state_timedout) Apartment::Quarantine(call->apartment);
+	call->hrcode = (state == AsyncCall::state_timedout) ? timeout_hrcode : E_ABORT;
+
+	// Cancelled from JS, promise is settled on next loop turn so its reactions do not run inside the caller
+	if (!deferred) Complete(call);
+	else call->queue->Post([call]() { Complete(call); });
+	return true;
+}
+
+void AsyncObject::Timeout(uv_timer_t *handle) {
+	std::map<ULONG, AsyncCallPtr>::iterator it = calls.find((ULONG)(uintptr_t)handle->data);
+	if (it == calls.end()) return;
+	AsyncCallPtr call(it->second);
+	Abandon(call, AsyncCall::state_timedout);
+}
+
+void AsyncObject::Stop(const AsyncCallPtr &call) {
+	calls.erase(call->id);
+	for (AsyncObject *obj : call->objects) obj->Unref();
+	call->objects.clear();
+	if (call->timer) {
+		uv_timer_stop(call->timer);
+		uv_close((uv_handle_t*)call->timer, [](uv_handle_t *handle) { delete (uv_timer_t*)handle; });
+		call->timer = 0;
+	}
+	LoopQueue::Unref();
+}
+
+void AsyncObject::Clear() {
+
+	// Environment cleanup, pending promises are never settled and their handles are closed before the loop
+	std::map<ULONG, AsyncCallPtr> items;
+	items.swap(calls);
+	for (std::map<ULONG, AsyncCallPtr>::value_type &it : items) {
+		AsyncCallPtr &call = it.second;
+		InterlockedExchange(&call->state, AsyncCall::state_cancelled);
+		Stop(call);
+		call->resolver.Reset();
+		call->keep.Reset();
+		for (AsyncCallPtr &depend : call->depends) depend->keep.Reset();
+	}
+	breakers.clear();
+	clazz.Reset();
+}
+
+void AsyncObject::Complete(const AsyncCallPtr &call) {
+
+	// Deferred completion after environment cleanup
+	if (calls.find(call->id) == calls.end()) return;
+	Stop(call);
+	Record(call->progid, call->hrcode);
+	for (AsyncCallPtr &depend : call->depends) {
+		if (--depend->pipelined == 0) depend->keep.Reset();
+	}
+
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	Local<Promise::Resolver> resolver = Local<Promise::Resolver>::New(isolate, call->resolver);
+	call->resolver.Reset();
+	if FAILED(call->hrcode) {
+		resolver->Reject(DispError(isolate, call->hrcode, AsyncOperation(call->kind), call->name.c_str(), call->desc, call->source));
+	}
+	else if (call->result_object) {
+		Local<Object> obj = NodeCreate(isolate, call->apartment, call->result_object, call->progid, call->object_timeout, call->object_lane);
+		if (call->pipelined > 0) call->keep.Reset(isolate, obj);
+		resolver->Resolve(obj);
+	}
+	else {
+
+		// Result read by pipelined calls on worker is not detached
+		resolver->Resolve(Variant2Value(isolate, call->result, call->pipelined == 0));
+	}
+
+	// Completion is not called from JS, reactions are run here
+	isolate->RunMicrotasks();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void AsyncObject::NodeInit(Handle<Object> target) {
+	Isolate *isolate = target->GetIsolate();
+
+	// Handles are created by asyncCreate and results of calls, constructor is exported for instanceof
+	Local<FunctionTemplate> t = FunctionTemplate::New(isolate, NodeHandle);
+	clazz.Reset(isolate, t);
+	t->SetClassName(String::NewFromUtf8(isolate, "AsyncObject"));
+	t->InstanceTemplate()->SetInternalFieldCount(1);
+	target->Set(String::NewFromUtf8(isolate, "AsyncObject"), t->GetFunction());
+
+	NODE_SET_METHOD(target, "asyncCreate", NodeCreateAsync);
+	NODE_SET_METHOD(target, "asyncInvoke", NodeInvoke);
+	NODE_SET_METHOD(target, "asyncCancel", NodeCancel);
+	NODE_SET_METHOD(target, "breaker", NodeBreaker);
+	NODE_DEBUG_MSG("AsyncObject initialized");
+}
+
+Local<Object> AsyncObject::NodeCreate(Isolate *isolate, const ApartmentPtr &apartment, ULONG id, const std::wstring &progid, DWORD timeout, int lane) {
+	Local<Object> self;
+	Local<FunctionTemplate> t = Local<FunctionTemplate>::New(isolate, clazz);
+	if (!t->InstanceTemplate()->NewInstance(isolate->GetCurrentContext()).ToLocal(&self)) return self;
+	(new AsyncObject(apartment, id, progid, timeout, lane))->Wrap(self);
+	return self;
+}
+
+bool AsyncObject::Resolve(const Local<Value> &value, ApartmentPtr &apartment, ULONG &id) {
+	Isolate *isolate = Isolate::GetCurrent();
+	Local<FunctionTemplate> t = Local<FunctionTemplate>::New(isolate, clazz);
+	if (!t->HasInstance(value)) return false;
+	AsyncObject *self = ObjectWrap::Unwrap<AsyncObject>(value->ToObject());
+	apartment = self->apartment;
+	id = self->id;
+	return true;
+}
+
+void AsyncObject::NodeHandle(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	isolate->ThrowException(TypeError(isolate, "use asyncCreate"));
+}
+
+static DWORD AsyncTimeout(Isolate *isolate, Local<Value> opt, DWORD timeout) {
+	if (!opt->IsObject()) return timeout;
+	Local<Value> val = opt->ToObject()->Get(String::NewFromUtf8(isolate, "timeout"));
+	return val->IsUint32() ? val->Uint32Value() : timeout;
+}
+
+void AsyncObject::NodeCreateAsync(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() < 1 || !args[0]->IsString()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+	AsyncCallPtr call(new AsyncCall(AsyncCall::kind_create));
+	String::Value vname(args[0]);
+	call->name = (LPOLESTR)*vname;
+	call->progid = call->name;
+	int apartment = -1;
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		Local<Value> val = args[1]->ToObject()->Get(String::NewFromUtf8(isolate, "apartment"));
+		if (val->IsUint32()) apartment = (int)val->Uint32Value();
+		call->timeout = call->object_timeout = AsyncTimeout(isolate, args[1], 0);
+		call->lane = call->object_lane = Apartment::Lane(isolate, args[1], lane_normal);
+	}
+	call->apartment = Apartment::Get(apartment);
+	args.GetReturnValue().Set(Start(isolate, call));
+}
+
+// Arguments are converted here in reverse order, handles and pending results are resolved on worker.
+// Pending result is a promise of call with its id, it must be queued before the call in the same lane
+bool AsyncObject::Arguments(Isolate *isolate, const Local<Value> &items, const AsyncCallPtr &call, std::vector<CComVariant> &args, std::vector<ULONG> &arg_objects, std::vector<AsyncCallPtr> &arg_calls) {
+	if (!items->IsArray()) return true;
+	Local<FunctionTemplate> t = Local<FunctionTemplate>::New(isolate, clazz);
+	Local<v8::Array> list = Local<v8::Array>::Cast(items);
+	UINT argcnt = list->Length();
+	args.resize(argcnt);
+	arg_objects.resize(argcnt, 0);
+	arg_calls.resize(argcnt);
+	for (UINT i = 0; i < argcnt; i++) {
+		Local<Value> val = list->Get(argcnt - i - 1);
+		if (t->HasInstance(val)) {
+			AsyncObject *arg = ObjectWrap::Unwrap<AsyncObject>(val->ToObject());
+			if (arg->apartment != call->apartment) {
+				isolate->ThrowException(TypeError(isolate, "object of other apartment"));
+				return false;
+			}
+			arg_objects[i] = arg->id;
+			call->objects.push_back(arg);
+		}
+		else if (val->IsPromise()) {
+			Local<Value> id = val->ToObject()->Get(String::NewFromUtf8(isolate, "id"));
+			std::map<ULONG, AsyncCallPtr>::iterator it = id->IsUint32() ? calls.find(id->Uint32Value()) : calls.end();
+			if (it == calls.end() || it->second->kind == AsyncCall::kind_put) {
+				isolate->ThrowException(TypeError(isolate, "call is not pending"));
+				return false;
+			}
+			if (it->second->apartment != call->apartment || it->second->lane != call->lane) {
+				isolate->ThrowException(TypeError(isolate, "call of other apartment or lane"));
+				return false;
+			}
+			arg_calls[i] = it->second;
+			call->depends.push_back(it->second);
+		}
+		else if (val->IsObject() && !val->IsDate() && !Buffer::HasInstance(val)) {
+
+			// JS and synchronous objects live on the loop thread, worker would call them without marshaling,
+			// only free-threaded ones are passed as is
+			CComPtr<IDispatch> disp;
+			if (FAILED(DispObject::GetDispatch(val, &disp)) || !IsAgile(disp)) {
+				isolate->ThrowException(TypeError(isolate, "only plain values, async and free-threaded objects are allowed"));
+				return false;
+			}
+			args[i] = (IDispatch*)disp;
+		}
+		else Value2Variant(val, args[i]);
+	}
+	return true;
+}
+
+void AsyncObject::NodeInvoke(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	Local<FunctionTemplate> t = Local<FunctionTemplate>::New(isolate, clazz);
+	if (args.Length() < 3 || !(t->HasInstance(args[0]) || args[0]->IsUint32() || args[0]->IsNull()) || !args[1]->IsUint32() || args[1]->Uint32Value() > AsyncCall::kind_call || !args[2]->IsString()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+	AsyncCallPtr call(new AsyncCall((AsyncCall::kind_t)args[1]->Uint32Value()));
+	String::Value vname(args[2]);
+	call->name = (LPOLESTR)*vname;
+	if (args[0]->IsNull()) {
+
+		// Target is settled result that is not an object, rejected as the call pipelined on it by worker
+		Local<Promise::Resolver> resolver = Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+		resolver->Reject(DispError(isolate, DISP_E_TYPEMISMATCH, AsyncOperation(call->kind), call->name.c_str(), std::wstring(), std::wstring()));
+		args.GetReturnValue().Set(resolver->GetPromise());
+		return;
+	}
+	if (args[0]->IsUint32()) {
+
+		// Target is pending result of other call, this call is queued behind it in its lane
+		std::map<ULONG, AsyncCallPtr>::iterator it = calls.find(args[0]->Uint32Value());
+		if (it == calls.end() || it->second->kind == AsyncCall::kind_put) {
+			isolate->ThrowException(TypeError(isolate, "call is not pending"));
+			return;
+		}
+		AsyncCallPtr &base = it->second;
+		call->base = base;
+		call->depends.push_back(base);
+		call->apartment = base->apartment;
+		call->progid = base->progid;
+		call->object_timeout = base->object_timeout;
+		call->object_lane = base->object_lane;
+		call->lane = base->lane;
+		call->timeout = (args.Length() > 4) ? AsyncTimeout(isolate, args[4], base->object_timeout) : base->object_timeout;
+	}
+	else {
+		AsyncObject *self = ObjectWrap::Unwrap<AsyncObject>(args[0]->ToObject());
+		call->apartment = self->apartment;
+		call->object = self->id;
+		call->objects.push_back(self);
+		call->progid = self->progid;
+		call->object_timeout = self->timeout;
+		call->timeout = (args.Length() > 4) ? AsyncTimeout(isolate, args[4], self->timeout) : self->timeout;
+		call->object_lane = self->lane;
+		call->lane = (args.Length() > 4) ? Apartment::Lane(isolate, args[4], self->lane) : self->lane;
+	}
+	if (args.Length() > 3 && !Arguments(isolate, args[3], call, call->args, call->arg_objects, call->arg_calls)) return;
+
+	// Members read before the target member: [[kind, name, args], ...]
+	if (args.Length() > 5 && args[5]->IsArray()) {
+		Local<v8::Array> path = Local<v8::Array>::Cast(args[5]);
+		call->path.resize(path->Length());
+		for (uint32_t i = 0; i < path->Length(); i++) {
+			AsyncStep &step = call->path[i];
+			Local<Value> item = path->Get(i);
+			Local<v8::Array> desc = item->IsArray() ? Local<v8::Array>::Cast(item) : v8::Array::New(isolate, 0);
+			if (desc->Length() < 2 || !desc->Get(0)->IsUint32() || desc->Get(0)->Uint32Value() == AsyncCall::kind_put || desc->Get(0)->Uint32Value() > AsyncCall::kind_call || !desc->Get(1)->IsString()) {
+				isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+				return;
+			}
+			step.kind = (int)desc->Get(0)->Uint32Value();
+			String::Value vstep(desc->Get(1));
+			step.name = (LPOLESTR)*vstep;
+			if (!Arguments(isolate, desc->Get(2), call, step.args, step.arg_objects, step.arg_calls)) return;
+		}
+	}
+	args.GetReturnValue().Set(Start(isolate, call));
+}
+
+void AsyncObject::NodeCancel(const FunctionCallbackInfo<Value> &args) {
+	bool cancelled = false;
+	if (args.Length() > 0 && args[0]->IsUint32()) {
+		std::map<ULONG, AsyncCallPtr>::iterator it = calls.find(args[0]->Uint32Value());
+		if (it != calls.end()) {
+			AsyncCallPtr call(it->second);
+			cancelled = Abandon(call, AsyncCall::state_cancelled, true);
+		}
+	}
+	args.GetReturnValue().Set(cancelled);
+}
+
+void AsyncObject::NodeBreaker(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opt = args[0]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "threshold"));
+		if (val->IsUint32()) breaker_threshold = val->Uint32Value();
+		val = opt->Get(String::NewFromUtf8(isolate, "reset"));
+		if (val->IsUint32()) breaker_reset = val->Uint32Value();
+	}
+
+	// Metrics by ProgID
+	Local<Object> progids(Object::New(isolate));
+	for (std::map<std::wstring, breaker_t>::iterator it = breakers.begin(); it != breakers.end(); it++) {
+		breaker_t &breaker = it->second;
+		Local<Object> item(Object::New(isolate));
+		const char *state = !breaker.open ? "closed" : breaker.probing ? "half-open" : "open";
+		item->Set(String::NewFromUtf8(isolate, "state"), String::NewFromUtf8(isolate, state));
+		item->Set(String::NewFromUtf8(isolate, "failures"), Uint32::New(isolate, breaker.failures));
+		item->Set(String::NewFromUtf8(isolate, "calls"), Number::New(isolate, (double)breaker.calls));
+		item->Set(String::NewFromUtf8(isolate, "timeouts"), Number::New(isolate, (double)breaker.timeouts));
+		item->Set(String::NewFromUtf8(isolate, "cancelled"), Number::New(isolate, (double)breaker.cancelled));
+		item->Set(String::NewFromUtf8(isolate, "rejected"), Number::New(isolate, (double)breaker.rejected));
+		progids->Set(String::NewFromTwoByte(isolate, (uint16_t*)it->first.c_str()), item);
+	}
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "threshold"), Uint32::New(isolate, breaker_threshold));
+	result->Set(String::NewFromUtf8(isolate, "reset"), Uint32::New(isolate, breaker_reset));
+	result->Set(String::NewFromUtf8(isolate, "pending"), Uint32::New(isolate, (uint32_t)calls.size()));
+	result->Set(String::NewFromUtf8(isolate, "quarantined"), Uint32::New(isolate, Apartment::quarantined));
+	result->Set(String::NewFromUtf8(isolate, "progids"), progids);
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,130 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: AsyncObject class declarations. Dispatch objects owned by worker apartment, property gets,
+//              puts and method calls are executed there and return promises. Calls have deadlines, may be
+//              cancelled and fail fast while circuit breaker of the ProgID is open
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+struct AsyncCall;
+typedef std::shared_ptr<AsyncCall> AsyncCallPtr;
+class AsyncObject;
+
+// Member of pipelined chain, executed on the intermediate result without returning to the loop
+struct AsyncStep {
+	int kind;
+	std::wstring name;
+	std::vector<CComVariant> args;  // Reverse order
+	std::vector<ULONG> arg_objects;
+	std::vector<AsyncCallPtr> arg_calls;
+	inline AsyncStep() : kind(0) {}
+};
+
+struct AsyncCall {
+	enum kind_t { kind_get = 0, kind_put = 1, kind_call = 2, kind_create = 3 };
+	enum state_t { state_queued = 0, state_running, state_done, state_cancelled, state_timedout };
+
+	ULONG id;
+	kind_t kind;
+	ApartmentPtr apartment;
+	LoopQueuePtr queue;
+	ULONG object;                   // Target object in apartment, 0 for creation
+	std::wstring name;              // Member name or ProgID
+	std::wstring progid;            // ProgID of root object, key of circuit breaker
+	std::vector<CComVariant> args;  // Reverse order
+	std::vector<ULONG> arg_objects; // Arguments referencing objects of the same apartment
+	std::vector<AsyncCallPtr> arg_calls; // Arguments referencing pending results of the same apartment and lane
+	std::vector<AsyncStep> path;    // Members read before the target member
+
+	// Target and argument objects are referenced until the call completes, so they are detached only after it,
+	// even when the call is queued in other lane than the object
+	std::vector<AsyncObject*> objects;
+
+	// Call pipelined on pending result of base call is queued behind it in the same lane, pending results
+	// passed as arguments are resolved the same way. Results of these calls are kept referenced until 
+	// pipelined calls complete
+	AsyncCallPtr base;
+	std::vector<AsyncCallPtr> depends;
+	LONG pipelined;
+	Persistent<Object> keep;
+	DWORD timeout, object_timeout;
+	int lane, object_lane;          // Worker lane of the call and default of returned objects
+	volatile LONG state;
+	volatile DWORD thread;
+
+	// Result, filled on worker
+	HRESULT hrcode;
+	CComVariant result;
+	ULONG result_object;
+	std::wstring desc, source;
+
+	Persistent<Promise::Resolver> resolver;
+	uv_timer_t *timer;
+
+	inline AsyncCall(kind_t knd) : id(0), kind(knd), object(0), timeout(0), object_timeout(0), lane(lane_normal), object_lane(lane_normal), pipelined(0), state(state_queued), thread(0), hrcode(S_OK), result_object(0), timer(0) {}
+};
+
+//-------------------------------------------------------------------------------------------------------
+
+class AsyncObject : public ObjectWrap {
+public:
+	AsyncObject(const ApartmentPtr &apartment, ULONG id, const std::wstring &progid, DWORD timeout, int lane);
+	~AsyncObject();
+
+	static void NodeInit(Handle<Object> target);
+	static void Clear();
+
+	// Apartment and object id of async object handle, false for other values
+	static bool Resolve(const Local<Value> &value, ApartmentPtr &apartment, ULONG &id);
+
+private:
+	ApartmentPtr apartment;
+	ULONG id;
+	std::wstring progid;
+	DWORD timeout;
+	int lane;
+
+	// Addon state is per isolate, every isolate runs on its own thread
+	static thread_local Persistent<FunctionTemplate> clazz;
+	static Local<Object> NodeCreate(Isolate *isolate, const ApartmentPtr &apartment, ULONG id, const std::wstring &progid, DWORD timeout, int lane);
+
+	// Calls in flight by id, completed exactly once by worker, timer or cancellation
+	static thread_local std::map<ULONG, AsyncCallPtr> calls;
+	static thread_local ULONG call_next;
+
+	// Circuit breaker by ProgID, opens after threshold of successive timeouts and lets one probe call after reset
+	struct breaker_t {
+		ULONG failures;
+		DWORD opened;
+		bool open, probing;
+		uint64_t calls, timeouts, cancelled, rejected;
+		breaker_t() : failures(0), opened(0), open(false), probing(false), calls(0), timeouts(0), cancelled(0), rejected(0) {}
+	};
+	static thread_local std::map<std::wstring, breaker_t> breakers;
+	static thread_local ULONG breaker_threshold;
+	static thread_local DWORD breaker_reset;
+	static HRESULT Admit(const std::wstring &progid);
+	static void Record(const std::wstring &progid, HRESULT hrcode);
+
+	static bool Arguments(Isolate *isolate, const Local<Value> &items, const AsyncCallPtr &call, std::vector<CComVariant> &args, std::vector<ULONG> &arg_objects, std::vector<AsyncCallPtr> &arg_calls);
+	static HRESULT Depend(AsyncCall *call, AsyncCall *base, bool &inherited);
+	static HRESULT Resolve(AsyncCall *call, std::vector<CComVariant> &args, const std::vector<ULONG> &arg_objects, const std::vector<AsyncCallPtr> &arg_calls, bool &inherited);
+	static Local<Promise> Start(Isolate *isolate, const AsyncCallPtr &call);
+	static void Execute(const AsyncCallPtr &call);
+	static void Complete(const AsyncCallPtr &call);
+	static void Stop(const AsyncCallPtr &call);
+	static bool Abandon(const AsyncCallPtr &call, AsyncCall::state_t state, bool deferred = false);
+	static void Timeout(uv_timer_t *handle);
+
+	static void NodeHandle(const FunctionCallbackInfo<Value> &args);
+	static void NodeCreateAsync(const FunctionCallbackInfo<Value> &args);
+	static void NodeInvoke(const FunctionCallbackInfo<Value> &args);
+	static void NodeCancel(const FunctionCallbackInfo<Value> &args);
+	static void NodeBreaker(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,282 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: BulkCommand class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+//-------------------------------------------------------------------------------------------------------
+// Values, reference column data without copy, callee copies input arguments
+
+void BulkCommand::column_t::Get(LONG row, VARIANT &value) const {
+	if (vt == VT_VARIANT) {
+		value = values[row];
+		return;
+	}
+	const uint8_t *ptr = &data[row * elsize];
+	value.vt = vt;
+	switch (vt) {
+	case VT_I1: value.cVal = *(const CHAR*)ptr; break;
+	case VT_UI1: value.bVal = *ptr; break;
+	case VT_I2: value.iVal = *(const SHORT*)ptr; break;
+	case VT_UI2: value.uiVal = *(const USHORT*)ptr; break;
+	case VT_I4: value.lVal = *(const LONG*)ptr; break;
+	case VT_UI4: value.ulVal = *(const ULONG*)ptr; break;
+	case VT_R4: value.fltVal = *(const FLOAT*)ptr; break;
+	case VT_R8: value.dblVal = *(const DOUBLE*)ptr; break;
+	}
+
+	// NaN is written as null, as blank cells of ranges
+	if ((vt == VT_R8 && value.dblVal != value.dblVal) || (vt == VT_R4 && value.fltVal != value.fltVal)) value.vt = VT_NULL;
+}
+
+bool BulkCommand::Column(Isolate *isolate, const Local<Value> &val, column_t &column, LONG &rows) {
+	if (val->IsArrayBufferView() && !Buffer::HasInstance(val)) {
+		if (val->IsFloat64Array()) { column.vt = VT_R8; column.elsize = sizeof(DOUBLE); }
+		else if (val->IsFloat32Array()) { column.vt = VT_R4; column.elsize = sizeof(FLOAT); }
+		else if (val->IsInt32Array()) { column.vt = VT_I4; column.elsize = sizeof(LONG); }
+		else if (val->IsUint32Array()) { column.vt = VT_UI4; column.elsize = sizeof(ULONG); }
+		else if (val->IsInt16Array()) { column.vt = VT_I2; column.elsize = sizeof(SHORT); }
+		else if (val->IsUint16Array()) { column.vt = VT_UI2; column.elsize = sizeof(USHORT); }
+		else if (val->IsInt8Array()) { column.vt = VT_I1; column.elsize = sizeof(CHAR); }
+		else if (val->IsUint8Array() || val->IsUint8ClampedArray()) { column.vt = VT_UI1; column.elsize = sizeof(BYTE); }
+		else return false;
+		Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(val);
+		column.data.resize(view->ByteLength());
+		if (!column.data.empty()) view->CopyContents(&column.data[0], column.data.size());
+		rows = (LONG)(column.data.size() / column.elsize);
+		return true;
+	}
+	if (!val->IsArray()) return false;
+
+	// Plain values only, interfaces can not be used on worker apartment
+	Local<v8::Array> items = Local<v8::Array>::Cast(val);
+	rows = (LONG)items->Length();
+	column.vt = VT_VARIANT;
+	column.values.resize(rows);
+	for (LONG i = 0; i < rows; i++) {
+		Local<Value> item = items->Get(i);
+		CComVariant &value = column.values[i];
+		Value2Variant(item, value);
+		VARTYPE vt = (value.vt & VT_TYPEMASK);
+		if (vt == VT_DISPATCH || vt == VT_UNKNOWN) return false;
+		if (value.vt == VT_EMPTY) value.vt = VT_NULL;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Execution, executed on worker apartment
+
+static const LONG chunk_rows = 256;
+
+HRESULT BulkCommand::Prepare(const job_ptr &job) {
+
+	// Parameters and members are resolved once
+	size_t cols = job->columns.size();
+	CComPtr<IDispatch> &command = job->target, params;
+	std::wstring &member = job->member;
+	member = L"Parameters";
+	job->items.resize(cols);
+	job->value_ids.resize(cols);
+	HRESULT hrcode = S_OK;
+	if ((command = job->apartment->Find(job->object)) == 0) hrcode = RPC_E_DISCONNECTED;
+	if SUCCEEDED(hrcode) hrcode = DispGet(command, L"Parameters", &params);
+	if (SUCCEEDED(hrcode) && !params) hrcode = DISP_E_TYPEMISMATCH;
+	for (size_t i = 0; SUCCEEDED(hrcode) && i < cols; i++) {
+		const column_t &column = job->columns[i];
+		member = column.name.empty() ? std::to_wstring(i) : column.name;
+		if (column.name.empty()) hrcode = DispGet(params, L"Item", &job->items[i], (LONG)i);
+		else hrcode = DispGet(params, L"Item", &job->items[i], column.name);
+		if (SUCCEEDED(hrcode) && !job->items[i]) hrcode = DISP_E_TYPEMISMATCH;
+		if SUCCEEDED(hrcode) hrcode = DispFind(job->items[i], L"Value", &job->value_ids[i]);
+	}
+	if SUCCEEDED(hrcode) {
+		member = L"Execute";
+		hrcode = DispFind(command, L"Execute", &job->execute_id);
+	}
+	if (SUCCEEDED(hrcode) && job->transaction > 0) {
+		member = L"ActiveConnection";
+		hrcode = DispGet(command, L"ActiveConnection", &job->connection);
+		if (SUCCEEDED(hrcode) && !job->connection) hrcode = DISP_E_TYPEMISMATCH;
+	}
+	return hrcode;
+}
+
+void BulkCommand::Execute(const job_ptr &job) {
+	HRESULT hrcode = S_OK;
+	if (!job->target) {
+		QueryPerformanceCounter(&job->started);
+		hrcode = Prepare(job);
+	}
+
+	// Execute(RecordsAffected, Parameters, Options), arguments are in reverse order
+	size_t cols = job->columns.size();
+	CComPtr<IDispatch> &command = job->target, &connection = job->connection;
+	std::wstring &member = job->member;
+	LONG &batch = job->batch;
+	LONG last = std::min(job->rows, job->row + chunk_rows);
+	for (; SUCCEEDED(hrcode) && job->row < last; job->row++) {
+		LONG row = job->row;
+		if (connection && batch == 0) {
+			member = L"BeginTrans";
+			hrcode = DispCall(connection, L"BeginTrans", nullptr);
+			if SUCCEEDED(hrcode) job->transacting = true;
+		}
+		for (size_t i = 0; SUCCEEDED(hrcode) && i < cols; i++) {
+			VARIANT value;
+			job->columns[i].Get(row, value);
+			hrcode = DispPut(job->items[i], job->value_ids[i], value);
+			if FAILED(hrcode) member = job->columns[i].name.empty() ? std::to_wstring(i) : job->columns[i].name;
+		}
+
+		// Execute(RecordsAffected, Parameters, Options)
+		LONG affected = 0;
+		if SUCCEEDED(hrcode) {
+			member = L"Execute";
+			hrcode = DispCall(command, job->execute_id, nullptr, &affected, DispMissing(), 0x80L); // adExecuteNoRecords
+		}
+		if FAILED(hrcode) {
+			job->failed = row;
+			break;
+		}
+		job->executed++;
+		job->affected += affected;
+		batch++;
+		if (connection && (batch == job->transaction || row + 1 == job->rows)) {
+			member = L"CommitTrans";
+			hrcode = DispCall(connection, L"CommitTrans", nullptr);
+			if SUCCEEDED(hrcode) {
+				job->transacting = false;
+				job->commits++;
+				batch = 0;
+			}
+			else job->failed = row;
+		}
+	}
+
+	// Next chunk is queued behind tasks of the lane, open transaction stays open meanwhile
+	if (SUCCEEDED(hrcode) && job->row < job->rows) {
+		if (job->apartment->Post([job]() { Execute(job); }, job->lane)) return;
+		hrcode = RPC_E_DISCONNECTED;
+	}
+	Finish(job, hrcode);
+}
+
+void BulkCommand::Finish(const job_ptr &job, HRESULT hrcode) {
+
+	// Rows of the failed transaction are not counted
+	if FAILED(hrcode) {
+		DispErrorInfo(job->desc, job->source);
+		if (job->transacting) {
+			DispCall(job->connection, L"RollbackTrans", nullptr);
+			job->transacting = false;
+			job->executed -= job->batch;
+		}
+	}
+	job->items.clear();
+	job->connection.Release();
+	job->target.Release();
+	job->hrcode = hrcode;
+	LARGE_INTEGER frequency, finished;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&finished);
+	job->elapsed = (double)(finished.QuadPart - job->started.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+	job->queue->Post([job]() { Complete(job); });
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Completion, executed on the loop thread
+
+void BulkCommand::Complete(const job_ptr &job) {
+	LoopQueue::Unref();
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	Local<Function> callback = Local<Function>::New(isolate, job->callback);
+	job->callback.Reset();
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "rows"), Int32::New(isolate, job->executed));
+	result->Set(String::NewFromUtf8(isolate, "affected"), Int32::New(isolate, job->affected));
+	result->Set(String::NewFromUtf8(isolate, "commits"), Int32::New(isolate, job->commits));
+	result->Set(String::NewFromUtf8(isolate, "elapsed"), Number::New(isolate, job->elapsed));
+	Local<Value> argv[] = { Null(isolate), result };
+	if FAILED(job->hrcode) {
+		argv[0] = DispError(isolate, job->hrcode, L"ExecuteMany", job->member.c_str(), job->desc, job->source);
+		if (job->failed >= 0 && argv[0]->IsObject()) argv[0]->ToObject()->Set(String::NewFromUtf8(isolate, "row"), Int32::New(isolate, job->failed));
+	}
+	node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(), callback, 2, argv);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void BulkCommand::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "bulkExecute", NodeExecute);
+	NODE_DEBUG_MSG("BulkCommand initialized");
+}
+
+void BulkCommand::NodeExecute(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	ApartmentPtr owner;
+	int argcnt = args.Length();
+	job_ptr job(new job_t);
+	if (argcnt < 3 || !args[argcnt - 1]->IsFunction() || !args[1]->IsObject()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+
+	// Object of the loop thread would be called by worker through the loop apartment, which is not pumped
+	if (!AsyncObject::Resolve(args[0], owner, job->object)) {
+		isolate->ThrowException(TypeError(isolate, "command must be async object"));
+		return;
+	}
+
+	// Columns as array in order of parameters or as object by parameter names
+	Local<Object> columns = args[1]->ToObject();
+	Local<v8::Array> keys;
+	if (args[1]->IsArray()) keys = v8::Array::New(isolate, 0);
+	else keys = columns->GetOwnPropertyNames();
+	uint32_t count = args[1]->IsArray() ? Local<v8::Array>::Cast(args[1])->Length() : keys->Length();
+	job->columns.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		column_t &column = job->columns[i];
+		Local<Value> val;
+		if (args[1]->IsArray()) val = columns->Get(i);
+		else {
+			Local<Value> key = keys->Get(i);
+			String::Value vname(key);
+			column.name.assign((LPOLESTR)*vname, vname.length());
+			val = columns->Get(key);
+		}
+		LONG rows = 0;
+		if (!Column(isolate, val, column, rows) || (i > 0 && rows != job->rows)) {
+			isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+			return;
+		}
+		job->rows = rows;
+	}
+
+	// Options: rows per transaction (0 executes without transaction), lane priority
+	if (argcnt > 3 && args[2]->IsObject()) {
+		Local<Object> opt = args[2]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "transaction"));
+		if (val->IsUint32()) job->transaction = (LONG)std::min(val->Uint32Value(), (uint32_t)LONG_MAX);
+		job->lane = Apartment::Lane(isolate, opt, lane_bulk);
+	}
+
+	// Async object is used in its own apartment
+	job->callback.Reset(isolate, Local<Function>::Cast(args[argcnt - 1]));
+	job->queue = LoopQueue::Current();
+	job->apartment = owner;
+	LoopQueue::Ref();
+	auto rejected = [job](HRESULT hrcode) {
+		job->hrcode = hrcode;
+		job->queue->Post([job]() { Complete(job); });
+	};
+	HRESULT hrcode = job->apartment->Submit([job]() { Execute(job); }, job->lane, rejected);
+	if FAILED(hrcode) rejected(hrcode);
+}
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,69 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: BulkCommand class declarations. Parameterized ADO command is executed for every row of
+//              columnar values on worker apartment, parameters and members are resolved once
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+class BulkCommand {
+public:
+	static void NodeInit(Handle<Object> target);
+
+private:
+
+	// Values of one parameter, typed arrays are copied as raw data, other arrays as variants
+	struct column_t {
+		std::wstring name; // Parameter name, index is used when empty
+		VARTYPE vt;
+		size_t elsize;
+		std::vector<uint8_t> data;
+		std::vector<CComVariant> values;
+		column_t() : vt(VT_VARIANT), elsize(0) {}
+		void Get(LONG row, VARIANT &value) const;
+	};
+
+	struct job_t {
+		ULONG object; // Id of async object in the apartment
+		ApartmentPtr apartment;
+		LoopQueuePtr queue;
+		std::vector<column_t> columns;
+		LONG rows, transaction;
+		int lane;
+		Persistent<Function> callback;
+
+		// Resolved members and position, used only on worker and released there when done
+		CComPtr<IDispatch> target, connection;
+		std::vector<CComPtr<IDispatch>> items;
+		std::vector<DISPID> value_ids;
+		DISPID execute_id;
+		LONG row, batch;
+		bool transacting; // Transaction is open on connection, rolled back when failed
+		LARGE_INTEGER started;
+
+		// Result, filled on worker
+		HRESULT hrcode;
+		LONG executed, affected, commits, failed; // Failed row is -1 when failed before rows
+		std::wstring member, desc, source;
+		double elapsed;
+		job_t() : object(0), rows(0), transaction(0), lane(lane_bulk), execute_id(DISPID_UNKNOWN), row(0), batch(0), transacting(false), hrcode(S_OK), executed(0), affected(0), commits(0), failed(-1), elapsed(0) {}
+	};
+	typedef std::shared_ptr<job_t> job_ptr;
+
+	static bool Column(Isolate *isolate, const Local<Value> &val, column_t &column, LONG &rows);
+
+	// Worker side, rows are executed in chunks posted one after another, so other calls of the apartment run in between
+	static HRESULT Prepare(const job_ptr &job);
+	static void Execute(const job_ptr &job);
+	static void Finish(const job_ptr &job, HRESULT hrcode);
+
+	// Loop side
+	static void Complete(const job_ptr &job);
+
+	static void NodeExecute(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
@@ -7,15 +7,120 @@
 #include "stdafx.h"
 #include "disp.h"
 
-Persistent<ObjectTemplate> DispObject::inst_template;
-Persistent<Function> DispObject::constructor;
+thread_local Persistent<FunctionTemplate> DispObject::clazz;
+thread_local Persistent<ObjectTemplate> DispObject::inst_template;
+thread_local Persistent<Function> DispObject::constructor;
+volatile LONG DispObject::count = 0;
+
+volatile LONG DispInfo::count = 0;
+thread_local ULONG DispInfo::cache_scope = 0;
+thread_local ULONG DispInfo::cache_epoch_current = 0;
+thread_local uint64_t DispInfo::cache_hits = 0;
+thread_local uint64_t DispInfo::cache_misses = 0;
+thread_local uint64_t DispInfo::cache_invalidations = 0;
+thread_local int64_t DispInfo::memory_default = 4096;
+thread_local std::map<std::wstring, int64_t> DispInfo::memory_by_type = {
+	{ L"_Recordset", 1024 * 1024 },
+	{ L"_Workbook", 8 * 1024 * 1024 },
+	{ L"_Document", 8 * 1024 * 1024 },
+	{ L"IXMLDOMDocument", 1024 * 1024 },
+	{ L"IXMLDOMDocument2", 1024 * 1024 },
+	{ L"IXMLDOMDocument3", 1024 * 1024 }
+};
+
+//-------------------------------------------------------------------------------------------------------
+// DispInfo implemetation
+
+DispInfoPtr DispInfo::Create(IDispatch *disp, const MemberName &nm, int opt, DispInfoPtr *parnt) {
+	DispInfoPtr ptr(std::allocate_shared<DispInfo>(PoolAllocator<DispInfo>(), disp, nm, opt, parnt));
+	if (parnt && *parnt) {
+		std::vector<std::weak_ptr<DispInfo>> &items = (*parnt)->children;
+		if (items.size() >= 16 && items.size() == items.capacity()) {
+			items.erase(std::remove_if(items.begin(), items.end(), [](const std::weak_ptr<DispInfo> &item) { return item.expired(); }), items.end());
+		}
+		items.push_back(ptr);
+	}
+	return ptr;
+}
+
+void DispInfo::Release() {
+	for (std::weak_ptr<DispInfo> &item : children) {
+		DispInfoPtr child = item.lock();
+		if (child) child->Release();
+	}
+	children.clear();
+	Drop();
+}
+
+void DispInfo::Drop() {
+	cache.clear();
+	if (events) {
+		events->Disconnect();
+		events.Release();
+	}
+	if ((options & option_leased) != 0) {
+		options &= ~option_leased;
+		if (ptr) InstancePool::Release(name.c_str(), ptr);
+	}
+	WriteBehind::Release(writer);
+	ptr.Release();
+	if (memsize != 0) {
+		Isolate *isolate = Isolate::GetCurrent();
+		if (isolate) isolate->AdjustAmountOfExternalAllocatedMemory(-memsize);
+		memsize = 0;
+	}
+}
+
+bool DispInfo::CacheGet(DISPID dispid, LONG index, VARIANT *value) {
+
+	// Values stored in previous scope are stale
+	if (cache_epoch != cache_epoch_current) {
+		cache.clear();
+		cache_epoch = cache_epoch_current;
+	}
+	cache_t::iterator it = cache.find(std::make_pair(dispid, index));
+	if (it == cache.end() || FAILED(VariantCopy(value, &it->second))) {
+		cache_misses++;
+		return false;
+	}
+	cache_hits++;
+	return true;
+}
+
+void DispInfo::CachePut(DISPID dispid, LONG index, const VARIANT *value) {
+	VariantCopy(&cache[std::make_pair(dispid, index)], value);
+}
+
+void DispInfo::CacheClear() {
+	if (cache.empty()) return;
+	cache.clear();
+	cache_invalidations++;
+}
+
+void DispInfo::Track() {
+	if (!ptr) return;
+	int64_t size = memory_default;
+	for (const TypeDescPtr &type : types) {
+		std::map<std::wstring, int64_t>::const_iterator it = memory_by_type.find(type->name);
+		if (it != memory_by_type.end()) {
+			size = it->second;
+			break;
+		}
+	}
+	Isolate *isolate = Isolate::GetCurrent();
+	if (isolate && size > 0) {
+		isolate->AdjustAmountOfExternalAllocatedMemory(size);
+		memsize = size;
+	}
+}
 
 //-------------------------------------------------------------------------------------------------------
 // DispObject implemetation
 
-DispObject::DispObject(const DispInfoPtr &ptr, const std::wstring &nm, DISPID id, LONG indx)
+DispObject::DispObject(const DispInfoPtr &ptr, const MemberName &nm, DISPID id, LONG indx)
 	: disp(ptr), options(ptr->options & option_mask), name(nm), dispid(id), index(indx)
 {	
+	InterlockedIncrement(&count);
 	if (dispid == DISPID_UNKNOWN) {
 		dispid = DISPID_VALUE;
         options |= option_prepared;
@@ -25,6 +130,7 @@ DispObject::DispObject(const DispInfoPtr &ptr, const std::wstring &nm, DISPID id
 }
 
 DispObject::~DispObject() {
+	InterlockedDecrement(&count);
 	NODE_DEBUG_FMT("DispObject '%S' destructor", name.c_str());
 }
 
@@ -38,8 +144,9 @@ HRESULT DispObject::prepare(VARIANT *value) {
         options |= option_prepared;
 		CComPtr<IDispatch> ptr;
 		if (VariantDispGet(value, &ptr)) {
-			disp.reset(new DispInfo(ptr, name, options, &disp));
+			disp = DispInfo::Create(ptr, name, options, &disp);
 			dispid = DISPID_VALUE;
+			options &= ~option_owned;
 		}
 	}
 
@@ -48,7 +155,10 @@ HRESULT DispObject::prepare(VARIANT *value) {
 
 bool DispObject::get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value> &args) {
 	Isolate *isolate = args.GetIsolate();
-	if (!is_prepared()) prepare();
+	if (!is_prepared()) {
+		if (!flush(isolate)) return false;
+		prepare();
+	}
 
 	// Search dispid
     HRESULT hrcode;
@@ -68,6 +178,7 @@ bool DispObject::get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value>
 
     // Return as property value
 	if (disp->IsProperty(propid)) {
+		if (!flush(isolate)) return false;
 		CComVariant value;
 		hrcode = disp->GetProperty(propid, index, &value);
 		if FAILED(hrcode) {
@@ -76,12 +187,13 @@ bool DispObject::get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value>
 		}
 		CComPtr<IDispatch> ptr;
 		if (VariantDispGet(&value, &ptr)) {
-			DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
-			Local<Object> result = DispObject::NodeCreate(isolate, args.This(), disp_result, tag);
+			MemberName result_name(tag);
+			DispInfoPtr disp_result(DispInfo::Create(ptr, result_name, options, &disp));
+			Local<Object> result = DispObject::NodeCreate(isolate, args.This(), disp_result, result_name);
 			args.GetReturnValue().Set(result);
 		}
 		else {
-			args.GetReturnValue().Set(Variant2Value(isolate, value));
+			args.GetReturnValue().Set(Variant2Value(isolate, value, true));
 		}
 	}
 
@@ -95,7 +207,10 @@ bool DispObject::get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value>
 
 bool DispObject::set(LPOLESTR tag, LONG index, const Local<Value> &value, const PropertyCallbackInfo<Value> &args) {
 	Isolate *isolate = args.GetIsolate();
-	if (!is_prepared()) prepare();
+	if (!is_prepared()) {
+		if (!flush(isolate)) return false;
+		prepare();
+	}
 
 	// Search dispid
 	HRESULT hrcode;
@@ -117,6 +232,20 @@ bool DispObject::set(LPOLESTR tag, LONG index, const Local<Value> &value, const
     CComVariant ret;
     VarArguments vargs(value);
 	if (index >= 0) vargs.items.push_back(CComVariant(index));
+
+	// Deferred put, its result is not converted
+	if (disp->IsWriteBehind()) {
+		hrcode = disp->PostWrite(propid, DISPATCH_PROPERTYPUT, vargs.items, tag);
+		if (hrcode == S_OK) {
+			args.GetReturnValue().Set(value);
+			return true;
+		}
+		if FAILED(hrcode) {
+			isolate->ThrowException(DispError(isolate, hrcode, L"DispPropertyPut", tag));
+			return false;
+		}
+	}
+	if (!flush(isolate)) return false;
 	size_t argcnt = vargs.items.size();
     VARIANT *pargs = (argcnt > 0) ? &vargs.items.front() : 0;
 	hrcode = disp->SetProperty(propid, argcnt, pargs, &ret);
@@ -132,7 +261,7 @@ bool DispObject::set(LPOLESTR tag, LONG index, const Local<Value> &value, const
 		rtag.reserve(32);
 		rtag += L"@";
 		rtag += tag;
-		DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
+		DispInfoPtr disp_result(DispInfo::Create(ptr, tag, options, &disp));
 		Local<Object> result = DispObject::NodeCreate(isolate, args.This(), disp_result, rtag);
 		args.GetReturnValue().Set(result);
 	}
@@ -146,9 +275,21 @@ void DispObject::call(Isolate *isolate, const FunctionCallbackInfo<Value> &args)
 {
 	CComVariant ret;
 	VarArguments vargs(args);
+	HRESULT hrcode;
+
+	// Deferred call of method without result
+	if (disp->IsWriteBehind() && disp->IsVoid(dispid)) {
+		hrcode = disp->PostWrite(dispid, DISPATCH_METHOD, vargs.items, name.c_str());
+		if (hrcode == S_OK) return;
+		if FAILED(hrcode) {
+			isolate->ThrowException(DispError(isolate, hrcode, L"DispInvoke", name.c_str()));
+			return;
+		}
+	}
+	if (!flush(isolate)) return;
 	size_t argcnt = vargs.items.size();
 	VARIANT *pargs = (argcnt > 0) ? &vargs.items.front() : 0;
-	HRESULT hrcode = disp->ExecuteMethod(dispid, argcnt, pargs, &ret);
+	hrcode = disp->ExecuteMethod(dispid, argcnt, pargs, &ret);
     if FAILED(hrcode) {
         isolate->ThrowException(DispError(isolate, hrcode, L"DispInvoke", name.c_str()));
         return;
@@ -161,25 +302,259 @@ void DispObject::call(Isolate *isolate, const FunctionCallbackInfo<Value> &args)
         std::wstring tag;
         tag.reserve(32);
         tag += L"@";
-        tag += name;
-		DispInfoPtr disp_result(new DispInfo(ptr, tag, options, &disp));
-		result = DispObject::NodeCreate(isolate, args.This(), disp_result, tag);
+        tag += name.str();
+        MemberName result_name(tag);
+		DispInfoPtr disp_result(DispInfo::Create(ptr, result_name, options, &disp));
+		result = DispObject::NodeCreate(isolate, args.This(), disp_result, result_name);
 	}
 	else {
-		result = Variant2Value(isolate, ret);
+		result = Variant2Value(isolate, ret, true);
 	}
     args.GetReturnValue().Set(result);
 }
 
+bool DispObject::release() {
+	if (!disp) return false;
+	bool released = disp->ptr || (disp->options & option_leased) != 0;
+	if (!is_owned()) disp->Release();
+	disp.reset();
+	return released;
+}
+
+void DispObject::on(Isolate *isolate, const FunctionCallbackInfo<Value> &args) {
+	if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsFunction()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+	if (!flush(isolate)) return;
+	if (!is_prepared()) prepare();
+	String::Value vname(args[0]);
+	LPOLESTR tag = (vname.length() > 0) ? (LPOLESTR)*vname : L"";
+
+	// Advise sink on first subscription, sink keeps this object until release
+	HRESULT hrcode = disp->ptr ? S_OK : E_POINTER;
+	if (SUCCEEDED(hrcode) && !disp->events) hrcode = EventSink::Connect(disp->ptr, args.This(), &disp->events);
+	if SUCCEEDED(hrcode) hrcode = disp->events->Subscribe(isolate, tag, Local<Function>::Cast(args[1]));
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"DispAdvise", tag));
+		return;
+	}
+	args.GetReturnValue().Set(args.This());
+}
+
+// Member of collection item, searched in cached type description first
+static DISPID FindMember(IDispatch *item, const std::wstring &name) {
+	CComPtr<ITypeInfo> info;
+	TypeDescPtr desc;
+	if (item->GetTypeInfo(0, 0, &info) == S_OK) desc = TypeCache::Get(info);
+	if (desc) {
+		for (const TypeFunc &func : desc->funcs) {
+			if ((func.invkind & (INVOKE_PROPERTYGET | INVOKE_FUNC)) != 0 && _wcsicmp(func.name.c_str(), name.c_str()) == 0) 
+				return func.dispid;
+		}
+	}
+	DISPID dispid;
+	if FAILED(DispFind(item, (LPOLESTR)name.c_str(), &dispid)) dispid = DISPID_UNKNOWN;
+	return dispid;
+}
+
+void DispObject::toArray(Isolate *isolate, const FunctionCallbackInfo<Value> &args) {
+	if (!flush(isolate)) return;
+	if (!is_prepared()) prepare();
+
+	// Projected member names and options
+	std::vector<MemberName> names;
+	std::vector<Local<String>> keys;
+	bool columns = false;
+	int argopt = 0;
+	if (args.Length() > 0 && args[0]->IsArray()) {
+		Local<v8::Array> items = Local<v8::Array>::Cast(args[0]);
+		for (uint32_t i = 0; i < items->Length(); i++) {
+			Local<Value> key = items->Get(i);
+			String::Value vname(key);
+			names.push_back(std::wstring((LPOLESTR)*vname, vname.length()));
+			keys.push_back(key->ToString());
+		}
+		argopt = 1;
+	}
+	if (args.Length() > argopt && args[argopt]->IsObject()) {
+		columns = v8val2bool(args[argopt]->ToObject()->Get(String::NewFromUtf8(isolate, "columns")), false);
+	}
+
+	// Collection enumerator
+	CComVariant ret;
+	CComPtr<IEnumVARIANT> enumerator;
+	HRESULT hrcode = (disp->ptr && !is_owned()) ? DispInvoke(disp->ptr, DISPID_NEWENUM, 0, 0, &ret, DISPATCH_METHOD | DISPATCH_PROPERTYGET) : E_POINTER;
+	if SUCCEEDED(hrcode) {
+		IUnknown *unk = (ret.vt == VT_UNKNOWN || ret.vt == VT_DISPATCH) ? ret.punkVal : 0;
+		hrcode = unk ? unk->QueryInterface(IID_IEnumVARIANT, (void**)&enumerator) : E_NOINTERFACE;
+	}
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"DispEnum", name.c_str()));
+		return;
+	}
+
+	// Member dispids are resolved once by first item, items without member get undefined
+	std::vector<DISPID> dispids(names.size(), DISPID_UNKNOWN);
+	std::vector<Local<v8::Array>> values(columns ? names.size() : 0);
+	for (Local<v8::Array> &items : values) items = v8::Array::New(isolate);
+	Local<v8::Array> rows = v8::Array::New(isolate);
+	uint32_t count = 0;
+	auto convert = [&](VARIANT &value, const MemberName &tag) -> Local<Value> {
+		CComPtr<IDispatch> ptr;
+		if (!VariantDispGet(&value, &ptr)) return Variant2Value(isolate, value, true);
+		DispInfoPtr disp_result(DispInfo::Create(ptr, tag, options, &disp));
+		return DispObject::NodeCreate(isolate, args.This(), disp_result, tag);
+	};
+
+	CComVariant batch[64];
+	ULONG fetched;
+	do {
+		fetched = 0;
+		hrcode = enumerator->Next(64, batch, &fetched);
+		for (ULONG n = 0; n < fetched; n++, count++) {
+			CComPtr<IDispatch> item;
+			if (names.empty() || !VariantDispGet(&batch[n], &item) || !item) {
+				Local<Value> value = names.empty() ? convert(batch[n], name) : (Local<Value>)Undefined(isolate);
+				if (!columns) rows->Set(count, value);
+				for (Local<v8::Array> &items : values) items->Set(count, value);
+				VariantClear(&batch[n]);
+				continue;
+			}
+			Local<Object> row;
+			if (!columns) row = Object::New(isolate);
+			for (size_t i = 0; i < names.size(); i++) {
+				if (dispids[i] == DISPID_UNKNOWN) dispids[i] = FindMember(item, names[i]);
+				CComVariant value;
+				HRESULT hr = (dispids[i] != DISPID_UNKNOWN) ? DispGet(item, dispids[i], &value) : DISP_E_UNKNOWNNAME;
+				Local<Value> result = SUCCEEDED(hr) ? convert(value, names[i]) : (Local<Value>)Undefined(isolate);
+				if (columns) values[i]->Set(count, result);
+				else row->Set(keys[i], result);
+			}
+			if (!columns) rows->Set(count, row);
+			VariantClear(&batch[n]);
+		}
+	} while (hrcode == S_OK && fetched > 0);
+
+	// Rows as plain objects or object of columns
+	if (!columns) {
+		args.GetReturnValue().Set(rows);
+		return;
+	}
+	Local<Object> result(Object::New(isolate));
+	for (size_t i = 0; i < names.size(); i++) result->Set(keys[i], values[i]);
+	args.GetReturnValue().Set(result);
+}
+
+// Property gets without arguments of all type descriptions, failed gets are skipped.
+// Objects already serialized are skipped by identity, so shared parents and cycles are written once
+Local<Value> DispObject::Serialize(Isolate *isolate, IDispatch *ptr, const std::vector<TypeDescPtr> &types, int depth, json_t &json) {
+	CComPtr<IUnknown> identity;
+	if (FAILED(ptr->QueryInterface(IID_IUnknown, (void**)&identity)) || !json.visited.insert(identity).second) return Undefined(isolate);
+	json.identities.push_back(identity);
+	Local<Object> result(Object::New(isolate));
+	std::set<DISPID> dispids;
+	for (const TypeDescPtr &type : types) {
+		for (const TypeFunc &func : type->funcs) {
+			if (func.invkind != INVOKE_PROPERTYGET || func.argcnt != 0 || func.dispid < 0 || func.name.empty()) continue;
+			if (!dispids.insert(func.dispid).second || !json.Accept(func.name)) continue;
+			CComVariant value;
+			if FAILED(DispGet(ptr, func.dispid, &value)) continue;
+			Local<Value> item;
+			CComPtr<IDispatch> child;
+			if (!VariantDispGet(&value, &child)) item = Variant2Value(isolate, value, true);
+			else if (!child) item = Null(isolate);
+			else if (depth > 0) {
+				std::vector<TypeDescPtr> child_types;
+				CComPtr<ITypeInfo> info;
+				if (child->GetTypeInfo(0, 0, &info) == S_OK) child_types.push_back(TypeCache::Get(info));
+				item = Serialize(isolate, child, child_types, depth - 1, json);
+			}
+			if (!item.IsEmpty() && !item->IsUndefined()) result->Set(String::NewFromTwoByte(isolate, (uint16_t*)func.name.c_str()), item);
+		}
+	}
+	return result;
+}
+
+bool DispObject::json_t::Accept(const std::wstring &name) const {
+	auto found = [&name](const std::vector<std::wstring> &names) {
+		for (const std::wstring &item : names) if (_wcsicmp(item.c_str(), name.c_str()) == 0) return true;
+		return false;
+	};
+	if (!include.empty() && !found(include)) return false;
+	return exclude.empty() || !found(exclude);
+}
+
+void DispObject::toJSON(Isolate *isolate, const FunctionCallbackInfo<Value> &args) {
+	if (!flush(isolate)) return;
+	if (!is_prepared()) prepare();
+
+	// Value of not dispatch member
+	if (is_owned() || !disp->ptr) {
+		Local<Value> value;
+		HRESULT hrcode = valueOf(isolate, value);
+		if FAILED(hrcode) isolate->ThrowException(DispError(isolate, hrcode, L"DispToJSON", name.c_str()));
+		else args.GetReturnValue().Set(value);
+		return;
+	}
+
+	// Options: depth of child objects, include and exclude member names.
+	// JSON.stringify passes key of the object, it is ignored
+	json_t json;
+	int depth = 1;
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opt = args[0]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "depth"));
+		if (val->IsUint32()) depth = (int)std::min(val->Uint32Value(), (uint32_t)64);
+		const char *lists[] = { "include", "exclude" };
+		for (int i = 0; i < 2; i++) {
+			val = opt->Get(String::NewFromUtf8(isolate, lists[i]));
+			if (!val->IsArray()) continue;
+			Local<v8::Array> items = Local<v8::Array>::Cast(val);
+			std::vector<std::wstring> &names = (i == 0) ? json.include : json.exclude;
+			for (uint32_t n = 0; n < items->Length(); n++) {
+				String::Value vname(items->Get(n));
+				names.push_back(std::wstring((LPOLESTR)*vname, vname.length()));
+			}
+		}
+	}
+
+	// Own type descriptions are cached by the object when type option is used
+	std::vector<TypeDescPtr> types(disp->types);
+	if (types.empty()) {
+		CComPtr<ITypeInfo> info;
+		if (disp->ptr->GetTypeInfo(0, 0, &info) == S_OK) types.push_back(TypeCache::Get(info));
+	}
+	Local<Value> result = Serialize(isolate, disp->ptr, types, depth, json);
+	args.GetReturnValue().Set(result);
+}
+
+DispObject *DispObject::Cast(const Local<Value> &value) {
+	Isolate *isolate = Isolate::GetCurrent();
+	if (clazz.IsEmpty() || !Local<FunctionTemplate>::New(isolate, clazz)->HasInstance(value)) return nullptr;
+	return Unwrap<DispObject>(value->ToObject());
+}
+
+HRESULT DispObject::GetDispatch(const Local<Value> &value, IDispatch **disp) {
+	DispObject *self = Cast(value);
+	if (!self || !self->disp) return E_INVALIDARG;
+	if (!self->is_prepared()) self->prepare();
+	if (self->is_owned() || !self->disp->ptr) return DISP_E_TYPEMISMATCH;
+	*disp = self->disp->ptr;
+	(*disp)->AddRef();
+	return S_OK;
+}
+
 HRESULT DispObject::valueOf(Isolate *isolate, Local<Value> &value) {
 	CComVariant val;
 	HRESULT hrcode = prepare(&val);
-	if SUCCEEDED(hrcode) value = Variant2Value(isolate, val);
+	if SUCCEEDED(hrcode) value = Variant2Value(isolate, val, true);
 	return hrcode;
 }
 
 void DispObject::toString(const FunctionCallbackInfo<Value> &args) {
 	Isolate *isolate = args.GetIsolate();
+	if (!flush(isolate)) return;
 	CComVariant val;
 	HRESULT hrcode = prepare(&val);
 	if FAILED(hrcode) {
@@ -192,13 +567,13 @@ void DispObject::toString(const FunctionCallbackInfo<Value> &args) {
 Local<Value> DispObject::getIdentity(Isolate *isolate) {
     std::wstring id;
     id.reserve(128);
-    id += name;
+    id += name.str();
     DispInfoPtr ptr = disp;
-    if (ptr->name == id)
+    if (ptr->name.str() == id)
         ptr = ptr->parent.lock();
     while (ptr) {
         id.insert(0, L".");
-        id.insert(0, ptr->name);
+        id.insert(0, ptr->name.str());
         ptr = ptr->parent.lock();
     }
     return String::NewFromTwoByte(isolate, (uint16_t*)id.c_str());
@@ -210,14 +585,12 @@ Local<Value> DispObject::getTypeInfo(Isolate *isolate) {
     }
     uint32_t index = 0;
     Local<v8::Array> items(v8::Array::New(isolate));
-    disp->Enumerate([isolate, this, &items, &index](ITypeInfo *info, FUNCDESC *desc) {
-        CComBSTR name;
-        this->disp->GetItemName(info, desc->memid, &name); 
+    disp->Enumerate([isolate, &items, &index](const TypeFunc &func) {
         Local<Object> item(Object::New(isolate));
-        if (name) item->Set(String::NewFromUtf8(isolate, "name"), String::NewFromTwoByte(isolate, (uint16_t*)(BSTR)name));
-        item->Set(String::NewFromUtf8(isolate, "dispid"), Int32::New(isolate, desc->memid));
-        item->Set(String::NewFromUtf8(isolate, "invkind"), Int32::New(isolate, desc->invkind));
-        item->Set(String::NewFromUtf8(isolate, "argcnt"), Int32::New(isolate, desc->cParams));
+        if (!func.name.empty()) item->Set(String::NewFromUtf8(isolate, "name"), String::NewFromTwoByte(isolate, (uint16_t*)func.name.c_str()));
+        item->Set(String::NewFromUtf8(isolate, "dispid"), Int32::New(isolate, func.dispid));
+        item->Set(String::NewFromUtf8(isolate, "invkind"), Int32::New(isolate, func.invkind));
+        item->Set(String::NewFromUtf8(isolate, "argcnt"), Int32::New(isolate, func.argcnt));
         items->Set(index++, item);
     });
     return items;
@@ -237,6 +610,11 @@ void DispObject::NodeInit(Handle<Object> target) {
 
 	NODE_SET_PROTOTYPE_METHOD(clazz, "toString", NodeToString);
 	NODE_SET_PROTOTYPE_METHOD(clazz, "valueOf", NodeValueOf);
+	NODE_SET_PROTOTYPE_METHOD(clazz, "release", NodeRelease);
+	NODE_SET_PROTOTYPE_METHOD(clazz, "on", NodeOn);
+	NODE_SET_PROTOTYPE_METHOD(clazz, "toArray", NodeToArray);
+	NODE_SET_PROTOTYPE_METHOD(clazz, "toJSON", NodeToJSON);
+	NODE_SET_PROTOTYPE_METHOD(clazz, "flush", NodeFlush);
 
     Local<ObjectTemplate> &inst = clazz->InstanceTemplate();
     inst->SetInternalFieldCount(1);
@@ -247,15 +625,26 @@ void DispObject::NodeInit(Handle<Object> target) {
 	inst->SetNativeDataProperty(String::NewFromUtf8(isolate, "__value"), NodeGet);
     inst->SetNativeDataProperty(String::NewFromUtf8(isolate, "__type"), NodeGet);
 
+    DispObject::clazz.Reset(isolate, clazz);
     inst_template.Reset(isolate, inst);
     constructor.Reset(isolate, clazz->GetFunction());
     target->Set(prop_name, clazz->GetFunction());
+    NODE_SET_METHOD(target, "stats", NodeStats);
+    NODE_SET_METHOD(target, "memory", NodeMemory);
+    NODE_SET_METHOD(target, "cache", NodeCache);
+    NODE_SET_METHOD(target, "classCache", NodeClassCache);
 
     //Context::GetCurrent()->Global()->Set(String::NewFromUtf8("ActiveXObject"), t->GetFunction());
 	NODE_DEBUG_MSG("DispObject initialized");
 }
 
-Local<Object> DispObject::NodeCreate(Isolate *isolate, const Local<Object> &parent, const DispInfoPtr &ptr, const std::wstring &name, DISPID id, LONG index) {
+void DispObject::Clear() {
+    clazz.Reset();
+    inst_template.Reset();
+    constructor.Reset();
+}
+
+Local<Object> DispObject::NodeCreate(Isolate *isolate, const Local<Object> &parent, const DispInfoPtr &ptr, const MemberName &name, DISPID id, LONG index) {
     Local<Object> self;
     if (!inst_template.IsEmpty()) {
         self = inst_template.Get(isolate)->NewInstance();
@@ -274,6 +663,7 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
         return;
     }
     int options = (option_async | option_type);
+    bool wait = true, free_threaded = false;
     if (argcnt > 1) {
         Local<Value> argopt = args[1];
         if (!argopt.IsEmpty() && argopt->IsObject()) {
@@ -287,6 +677,14 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 			if (v8val2bool(opt->Get(String::NewFromUtf8(isolate, "activate")), false)) {
 				options |= option_activate;
 			}
+			if (v8val2bool(opt->Get(String::NewFromUtf8(isolate, "cache")), false)) {
+				options |= option_cache;
+			}
+			if (v8val2bool(opt->Get(String::NewFromUtf8(isolate, "writeBehind")), false)) {
+				options |= option_writebehind;
+			}
+			wait = v8val2bool(opt->Get(String::NewFromUtf8(isolate, "wait")), true);
+			free_threaded = v8val2bool(opt->Get(String::NewFromUtf8(isolate, "freeThreaded")), false);
 		}
     }
     
@@ -314,7 +712,7 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 		else {
 			name.assign((LPOLESTR)*vname, vname.length());
 			CLSID clsid;
-			hrcode = CLSIDFromProgID(name.c_str(), &clsid);
+			hrcode = ClassFind(name.c_str(), &clsid);
 			if SUCCEEDED(hrcode) {
 				if ((options & option_activate) == 0) hrcode = E_FAIL; 
 				else {
@@ -323,7 +721,7 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 					if SUCCEEDED(hrcode) hrcode = unk->QueryInterface(&disp);
 				}
 				if FAILED(hrcode) {
-					hrcode = disp.CoCreateInstance(clsid, nullptr, CLSCTX_INPROC_SERVER | CLSCTX_LOCAL_SERVER);
+					hrcode = ClassCreate(clsid, CLSCTX_INPROC_SERVER | CLSCTX_LOCAL_SERVER, &disp);
 				}
 			}
 		}
@@ -332,8 +730,11 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 	// Create dispatch object from javascript object
 	else if (args[0]->IsObject()) {
 		name = L"#";
-		disp = new DispObjectImpl(args[0]->ToObject());
+		disp = new DispObjectImpl(args[0]->ToObject(), wait, free_threaded);
 		hrcode = S_OK;
+
+		// Members are known on this side, type information is synthesized only for other clients
+		options &= ~option_type;
 	}
 
 	// Other
@@ -347,7 +748,7 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 	}
 	else {
 		Local<Object> &self = args.This();
-		DispInfoPtr ptr(new DispInfo(disp, name, options));
+		DispInfoPtr ptr(DispInfo::Create(disp, name, options));
 		(new DispObject(ptr, name))->Wrap(self);
 		args.GetReturnValue().Set(self);
 	}
@@ -356,15 +757,20 @@ void DispObject::NodeCreate(const FunctionCallbackInfo<Value> &args) {
 void DispObject::NodeGet(Local<String> name, const PropertyCallbackInfo<Value>& args) {
     Isolate *isolate = args.GetIsolate();
 	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	String::Value vname(name);
+	LPOLESTR id = (vname.length() > 0) ? (LPOLESTR)*vname : L"";
+	if (self && wcscmp(id, L"release") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeRelease, args.This())->GetFunction());
+		return;
+	}
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
 	
-	String::Value vname(name);
-	LPOLESTR id = (vname.length() > 0) ? (LPOLESTR)*vname : L"";
     NODE_DEBUG_FMT2("DispObject '%S.%S' get", self->name.c_str(), id);
     if (_wcsicmp(id, L"__value") == 0) {
+        if (!flush(isolate)) return;
         Local<Value> result;
         HRESULT hrcode = self->valueOf(isolate, result);
         if FAILED(hrcode) isolate->ThrowException(Win32Error(isolate, hrcode, L"DispValueOf"));
@@ -385,6 +791,18 @@ void DispObject::NodeGet(Local<String> name, const PropertyCallbackInfo<Value>&
 	else if (_wcsicmp(id, L"toString") == 0) {
 		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeToString, args.This())->GetFunction());
 	}
+	else if (wcscmp(id, L"on") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeOn, args.This())->GetFunction());
+	}
+	else if (wcscmp(id, L"toArray") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeToArray, args.This())->GetFunction());
+	}
+	else if (wcscmp(id, L"flush") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeFlush, args.This())->GetFunction());
+	}
+	else if (wcscmp(id, L"toJSON") == 0) {
+		args.GetReturnValue().Set(FunctionTemplate::New(isolate, NodeToJSON, args.This())->GetFunction());
+	}
 	else {
 		self->get(id, -1, args);
 	}
@@ -393,7 +811,7 @@ void DispObject::NodeGet(Local<String> name, const PropertyCallbackInfo<Value>&
 void DispObject::NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Value>& args) {
     Isolate *isolate = args.GetIsolate();
     DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
@@ -404,7 +822,7 @@ void DispObject::NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Value
 void DispObject::NodeSet(Local<String> name, Local<Value> value, const PropertyCallbackInfo<Value>& args) {
     Isolate *isolate = args.GetIsolate();
 	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
@@ -417,7 +835,7 @@ void DispObject::NodeSet(Local<String> name, Local<Value> value, const PropertyC
 void DispObject::NodeSetByIndex(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value>& args) {
     Isolate *isolate = args.GetIsolate();
     DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
@@ -428,7 +846,7 @@ void DispObject::NodeSetByIndex(uint32_t index, Local<Value> value, const Proper
 void DispObject::NodeCall(const FunctionCallbackInfo<Value> &args) {
     Isolate *isolate = args.GetIsolate();
     DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
@@ -439,10 +857,11 @@ void DispObject::NodeCall(const FunctionCallbackInfo<Value> &args) {
 void DispObject::NodeValueOf(const FunctionCallbackInfo<Value>& args) {
 	Isolate *isolate = args.GetIsolate();
 	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
+	if (!flush(isolate)) return;
 	Local<Value> result;
 	HRESULT hrcode = self->valueOf(isolate, result);
 	if FAILED(hrcode) {
@@ -455,11 +874,126 @@ void DispObject::NodeValueOf(const FunctionCallbackInfo<Value>& args) {
 void DispObject::NodeToString(const FunctionCallbackInfo<Value>& args) {
 	Isolate *isolate = args.GetIsolate();
 	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
-	if (!self) {
+	if (!self || !self->disp) {
 		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
 		return;
 	}
 	self->toString(args);
 }
 
+void DispObject::NodeRelease(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
+	if (!self) {
+		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
+		return;
+	}
+	NODE_DEBUG_FMT("DispObject '%S' release", self->name.c_str());
+	args.GetReturnValue().Set(Boolean::New(isolate, self->release()));
+}
+
+void DispObject::NodeOn(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
+	if (!self || !self->disp) {
+		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
+		return;
+	}
+	self->on(isolate, args);
+}
+
+void DispObject::NodeToArray(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
+	if (!self || !self->disp) {
+		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
+		return;
+	}
+	self->toArray(isolate, args);
+}
+
+void DispObject::NodeToJSON(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	DispObject *self = DispObject::Unwrap<DispObject>(args.This());
+	if (!self || !self->disp) {
+		isolate->ThrowException(Error(isolate, "DispIsEmpty"));
+		return;
+	}
+	self->toJSON(isolate, args);
+}
+
+void DispObject::NodeFlush(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	if (WriteBehind::Flush(isolate)) args.GetReturnValue().Set(args.This());
+}
+
+void DispObject::NodeStats(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "objects"), Int32::New(isolate, DispObject::count));
+	result->Set(String::NewFromUtf8(isolate, "dispatches"), Int32::New(isolate, DispInfo::count));
+	result->Set(String::NewFromUtf8(isolate, "callbacks"), Int32::New(isolate, DispObjectImpl::count));
+	result->Set(String::NewFromUtf8(isolate, "direct"), Int32::New(isolate, DispObjectImpl::direct));
+	result->Set(String::NewFromUtf8(isolate, "names"), Number::New(isolate, (double)MemberName::Count()));
+	result->Set(String::NewFromUtf8(isolate, "blocks"), Number::New(isolate, (double)BlockStats::blocks));
+	result->Set(String::NewFromUtf8(isolate, "slabs"), Number::New(isolate, (double)BlockStats::slabs));
+	args.GetReturnValue().Set(result);
+}
+
+void DispObject::NodeMemory(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() < 1 || !args[0]->IsObject()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+
+	// Estimated bytes by type name, "default" is used for types without estimate
+	Local<Object> sizes = args[0]->ToObject();
+	Local<v8::Array> keys = sizes->GetOwnPropertyNames();
+	for (uint32_t i = 0; i < keys->Length(); i++) {
+		Local<Value> key = keys->Get(i);
+		Local<Value> val = sizes->Get(key);
+		if (!val->IsNumber()) continue;
+		String::Value vname(key);
+		std::wstring type((LPOLESTR)*vname, vname.length());
+		if (type == L"default") DispInfo::memory_default = val->IntegerValue();
+		else DispInfo::memory_by_type[type] = val->IntegerValue();
+	}
+}
+
+void DispObject::NodeCache(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+
+	// Enter or leave cache scope, scopes are nested and every change starts new epoch
+	if (args.Length() > 0) {
+		if (!args[0]->IsBoolean()) {
+			isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+			return;
+		}
+		if (args[0]->BooleanValue()) DispInfo::cache_scope++;
+		else if (DispInfo::cache_scope > 0) DispInfo::cache_scope--;
+		DispInfo::cache_epoch_current++;
+	}
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "scope"), Uint32::New(isolate, DispInfo::cache_scope));
+	result->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, (double)DispInfo::cache_hits));
+	result->Set(String::NewFromUtf8(isolate, "misses"), Number::New(isolate, (double)DispInfo::cache_misses));
+	result->Set(String::NewFromUtf8(isolate, "invalidations"), Number::New(isolate, (double)DispInfo::cache_invalidations));
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+void DispObject::NodeClassCache(const FunctionCallbackInfo<Value>& args) {
+	Isolate *isolate = args.GetIsolate();
+
+	// ProgID and class factory caches are enabled by default, previous state is returned
+	if (args.Length() > 0 && !args[0]->IsBoolean()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+	bool enabled = ClassCache((args.Length() > 0) ? (args[0]->BooleanValue() ? 1 : 0) : -1);
+	args.GetReturnValue().Set(Boolean::New(isolate, enabled));
+}
+
 //-------------------------------------------------------------------------------------------------------
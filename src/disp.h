@@ -7,47 +7,111 @@
 #pragma once
 
 #include "utils.h"
+#include "typecache.h"
+#include "pool.h"
+#include "events.h"
+#include "apartment.h"
+#include "range.h"
+#include "async.h"
+#include "writer.h"
+#include "export.h"
+#include "bulk.h"
 
 enum options_t { 
     option_none = 0, 
     option_async = 0x01, 
     option_type = 0x02,
 	option_activate = 0x04,
+	option_cache = 0x08,
 	option_prepared = 0x10,
     option_owned = 0x20,
-    option_mask = 0x0F
+    option_leased = 0x40,
+    option_writebehind = 0x80,
+    option_mask = 0x8F
 };
 
 class DispInfo {
 public:
 	std::weak_ptr<DispInfo> parent;
+	std::vector<std::weak_ptr<DispInfo>> children;
 	CComPtr<IDispatch> ptr;
-    std::wstring name;
+	CComPtr<EventSink> events;
+	WriteTargetPtr writer;
+    MemberName name;
 	int options;
+	int64_t memsize;
 
-    struct func_t { DISPID dispid; int kind; };
+    struct func_t { DISPID dispid; int kind; VARTYPE rettype; };
 	typedef std::shared_ptr<func_t> func_ptr;
-	typedef std::map<DISPID, func_ptr> func_by_dispid_t;
+	typedef pooled_map<DISPID, func_ptr> func_by_dispid_t;
 	func_by_dispid_t funcs_by_dispid;
 
-    inline DispInfo(IDispatch *disp, const std::wstring &nm, int opt, std::shared_ptr<DispInfo> *parnt = nullptr)
-        : ptr(disp), options(opt), name(nm)
+    inline DispInfo(IDispatch *disp, const MemberName &nm, int opt, std::shared_ptr<DispInfo> *parnt = nullptr)
+        : ptr(disp), options(opt), name(nm), memsize(0), cache_epoch(cache_epoch_current)
     { 
+        InterlockedIncrement(&count);
         if (parnt) parent = *parnt;
+        if ((options & option_writebehind) != 0 && !WriteBehind::Accepts(disp)) options &= ~option_writebehind;
         if ((options & option_type) != 0)
             Prepare(disp);
+        Track();
     }
 
+    // Children outlive collected parent wrapper, only explicit release drops them
+    inline ~DispInfo() {
+        Drop();
+        InterlockedDecrement(&count);
+    }
+
+    // Create and register as child, so parent release drops child references too.
+    // Object and its control block are allocated from block pool
+    static std::shared_ptr<DispInfo> Create(IDispatch *disp, const MemberName &nm, int opt, std::shared_ptr<DispInfo> *parnt = nullptr);
+
+    // Drop dispatch pointer and references of children, leased instance is returned to pool
+    void Release();
+
+    // Drop own dispatch pointer, lease and tracked memory
+    void Drop();
+
+    // Estimated size of server side state pinned by this object, reported to V8 as external memory
+    static thread_local std::map<std::wstring, int64_t> memory_by_type;
+    static thread_local int64_t memory_default;
+    void Track();
+
+    static volatile LONG count;
+
+    // Memoized property gets, used inside cache scope or by objects created with cache option.
+    // Put or method call on the object drops its cached values
+    typedef pooled_map<std::pair<DISPID, LONG>, CComVariant> cache_t;
+    cache_t cache;
+    ULONG cache_epoch;
+    static thread_local ULONG cache_scope, cache_epoch_current;
+    static thread_local uint64_t cache_hits, cache_misses, cache_invalidations;
+    inline bool IsCached() { return cache_scope > 0 || (options & option_cache) != 0; }
+    bool CacheGet(DISPID dispid, LONG index, VARIANT *value);
+    void CachePut(DISPID dispid, LONG index, const VARIANT *value);
+    void CacheClear();
+
+    std::vector<TypeDescPtr> types;
+
     void Prepare(IDispatch *disp) {
-        Enumerate([this](ITypeInfo *info, FUNCDESC *desc) {
-			func_ptr &ptr = this->funcs_by_dispid[desc->memid];
+        UINT i, cnt;
+        if (!ptr || FAILED(ptr->GetTypeInfoCount(&cnt))) cnt = 0;
+        else for (i = 0; i < cnt; i++) {
+            CComPtr<ITypeInfo> info;
+            if (ptr->GetTypeInfo(i, 0, &info) != S_OK) continue;
+            types.push_back(TypeCache::Get(info));
+        }
+        Enumerate([this](const TypeFunc &func) {
+			func_ptr &ptr = this->funcs_by_dispid[func.dispid];
 			if (!ptr) {
-				ptr.reset(new func_t);
-				ptr->dispid = desc->memid;
-				ptr->kind = desc->invkind;
+				ptr = std::allocate_shared<func_t>(PoolAllocator<func_t>());
+				ptr->dispid = func.dispid;
+				ptr->kind = func.invkind;
+				ptr->rettype = func.rettype;
 			}
 			else {
-				ptr->kind |= desc->invkind;
+				ptr->kind |= func.invkind;
 			}
         });
         bool prepared = funcs_by_dispid.size() > 3; // QueryInterface, AddRef, Release
@@ -56,40 +120,11 @@ public:
 
     template<typename T>
     bool Enumerate(T process) {
-        UINT i, cnt;
-        if (!ptr || FAILED(ptr->GetTypeInfoCount(&cnt))) cnt = 0;
-        else for (i = 0; i < cnt; i++) {
-            CComPtr<ITypeInfo> info;
-            if (ptr->GetTypeInfo(i, 0, &info) != S_OK) continue;
-            PrepareType<T>(info, process);
+        for (const TypeDescPtr &type : types) {
+            for (const TypeFunc &func : type->funcs)
+                process(func);
         }
-        return cnt > 0;
-    }
-
-    template<typename T>
-    bool PrepareType(ITypeInfo *info, T process) {
-		UINT n = 0;
-		while (PrepareFunc<T>(info, n, process)) n++;
-		/*
-		VARDESC *vdesc;
-		if (info->GetVarDesc(dispid - 1, &vdesc) == S_OK) {
-			info->ReleaseVarDesc(vdesc);
-		}
-		*/
-		return n > 0;
-	}
-
-    template<typename T>
-	bool PrepareFunc(ITypeInfo *info, UINT n, T process) {
-		FUNCDESC *desc;
-		if (info->GetFuncDesc(n, &desc) != S_OK) return false;
-        process(info, desc);
-		info->ReleaseFuncDesc(desc);
-		return true;
-	}
-    inline bool GetItemName(ITypeInfo *info, DISPID dispid, BSTR *name) {
-        UINT cnt_ret;
-        return info->GetNames(dispid, name, 1, &cnt_ret) == S_OK && cnt_ret > 0;
+        return !types.empty();
     }
 
 	inline bool IsProperty(const DISPID dispid) {
@@ -99,26 +134,46 @@ public:
 		return (it->second->kind & (INVOKE_PROPERTYGET | INVOKE_FUNC)) == INVOKE_PROPERTYGET;
 	}
 
+	// Method without result, its call may be deferred
+	inline bool IsVoid(const DISPID dispid) {
+		if ((options & option_prepared) == 0) return false;
+		func_by_dispid_t::const_iterator it = funcs_by_dispid.find(dispid);
+		if (it == funcs_by_dispid.end() || it->second->kind != INVOKE_FUNC) return false;
+		return it->second->rettype == VT_VOID || it->second->rettype == VT_HRESULT;
+	}
+
+	inline bool IsWriteBehind() { return (options & option_writebehind) != 0; }
+
+	// Deferred put or void call, S_FALSE when it should be executed synchronously
+	HRESULT PostWrite(DISPID dispid, WORD flags, std::vector<CComVariant> &args, LPCOLESTR member) {
+		CacheClear();
+		return WriteBehind::Post(writer, ptr, dispid, flags, args, member);
+	}
+
 	HRESULT FindProperty(LPOLESTR name, DISPID *dispid) {
+		if (!ptr) return E_POINTER;
 		return DispFind(ptr, name, dispid);
 	}
 
 	HRESULT GetProperty(DISPID dispid, LONG index, VARIANT *value) {
-		CComVariant arg(index);
-		LONG argcnt = (index >= 0) ? 1 : 0;
-		HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, &arg, value, DISPATCH_PROPERTYGET);
+		bool cached = IsCached();
+		if (cached && CacheGet(dispid, index, value)) return S_OK;
+		HRESULT hrcode = (index >= 0) ? DispGet(ptr, dispid, value, index) : DispGet(ptr, dispid, value);
 		if FAILED(hrcode) value->vt = VT_EMPTY;
+		else if (cached) CachePut(dispid, index, value);
 		return hrcode;
 	}
 
 	HRESULT SetProperty(DISPID dispid, LONG argcnt, VARIANT *args, VARIANT *value) {
-		HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_PROPERTYPUT);
+		CacheClear();
+		HRESULT hrcode = ptr ? DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_PROPERTYPUT) : E_POINTER;
 		if FAILED(hrcode) value->vt = VT_EMPTY;
 		return hrcode;
 	}
 
     HRESULT ExecuteMethod(DISPID dispid, LONG argcnt, VARIANT *args, VARIANT *value) {
-        HRESULT hrcode = DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_METHOD);
+        CacheClear();
+        HRESULT hrcode = ptr ? DispInvoke(ptr, dispid, argcnt, args, value, DISPATCH_METHOD) : E_POINTER;
         return hrcode;
     }
 };
@@ -128,14 +183,27 @@ typedef std::shared_ptr<DispInfo> DispInfoPtr;
 
 class DispObject: public ObjectWrap
 {
+    friend class InstancePool;
+    friend class EventSink;
 public:
-	DispObject(const DispInfoPtr &ptr, const std::wstring &name, DISPID id = DISPID_UNKNOWN, LONG indx = -1);
+	DispObject(const DispInfoPtr &ptr, const MemberName &name, DISPID id = DISPID_UNKNOWN, LONG indx = -1);
 	~DispObject();
 
+	// Wrappers are short lived and allocated from block pool
+	static inline void *operator new(size_t size) { return PoolAllocator<DispObject>().allocate(1); }
+	static inline void operator delete(void *ptr) { PoolAllocator<DispObject>().deallocate((DispObject*)ptr, 1); }
+
 	static void NodeInit(Handle<Object> target);
+	static void Clear();
+
+	// Dispatch interface of wrapped object, property objects are resolved first
+	static HRESULT GetDispatch(const Local<Value> &value, IDispatch **disp);
+
+	// Wrapper of the value, null for values of other classes
+	static DispObject *Cast(const Local<Value> &value);
 
 private:
-	static Local<Object> NodeCreate(Isolate *isolate, const Local<Object> &parent, const DispInfoPtr &ptr, const std::wstring &name, DISPID id = DISPID_UNKNOWN, LONG indx = -1);
+	static Local<Object> NodeCreate(Isolate *isolate, const Local<Object> &parent, const DispInfoPtr &ptr, const MemberName &name, DISPID id = DISPID_UNKNOWN, LONG indx = -1);
 
 	static void NodeCreate(const FunctionCallbackInfo<Value> &args);
 	static void NodeValueOf(const FunctionCallbackInfo<Value> &args);
@@ -145,29 +213,57 @@ private:
 	static void NodeGetByIndex(uint32_t index, const PropertyCallbackInfo<Value> &args);
 	static void NodeSetByIndex(uint32_t index, Local<Value> value, const PropertyCallbackInfo<Value> &args);
 	static void NodeCall(const FunctionCallbackInfo<Value> &args);
+	static void NodeRelease(const FunctionCallbackInfo<Value> &args);
+	static void NodeOn(const FunctionCallbackInfo<Value> &args);
+	static void NodeToArray(const FunctionCallbackInfo<Value> &args);
+	static void NodeToJSON(const FunctionCallbackInfo<Value> &args);
+	static void NodeStats(const FunctionCallbackInfo<Value> &args);
+	static void NodeMemory(const FunctionCallbackInfo<Value> &args);
+	static void NodeCache(const FunctionCallbackInfo<Value> &args);
+	static void NodeClassCache(const FunctionCallbackInfo<Value> &args);
+	static void NodeFlush(const FunctionCallbackInfo<Value> &args);
 
 protected:
 	bool get(LPOLESTR tag, LONG index, const PropertyCallbackInfo<Value> &args);
 	bool set(LPOLESTR tag, LONG index, const Local<Value> &value, const PropertyCallbackInfo<Value> &args);
 	void call(Isolate *isolate, const FunctionCallbackInfo<Value> &args);
 
+	bool release();
+	void on(Isolate *isolate, const FunctionCallbackInfo<Value> &args);
+	void toArray(Isolate *isolate, const FunctionCallbackInfo<Value> &args);
+	void toJSON(Isolate *isolate, const FunctionCallbackInfo<Value> &args);
 	HRESULT valueOf(Isolate *isolate, Local<Value> &value);
 	void toString(const FunctionCallbackInfo<Value> &args);
     Local<Value> getIdentity(Isolate *isolate);
     Local<Value> getTypeInfo(Isolate *isolate);
 
 private:
-    static Persistent<ObjectTemplate> inst_template;
-    static Persistent<Function> constructor;
+    // Per isolate, every isolate loading the addon runs on its own thread
+    static thread_local Persistent<FunctionTemplate> clazz;
+    static thread_local Persistent<ObjectTemplate> inst_template;
+    static thread_local Persistent<Function> constructor;
+    static volatile LONG count;
 
 	int options;
 	inline bool is_prepared() { return (options & option_prepared) != 0; }
 	inline bool is_owned() { return (options & option_owned) != 0; }
 
 	DispInfoPtr disp;
-	std::wstring name;
+	MemberName name;
 	DISPID dispid;
 	LONG index;
 
 	HRESULT prepare(VARIANT *value = 0);
+
+	// Serialization state, identities are kept referenced so addresses are not reused during walk
+	struct json_t {
+		std::vector<std::wstring> include, exclude;
+		std::set<IUnknown*> visited;
+		std::vector<CComPtr<IUnknown>> identities;
+		bool Accept(const std::wstring &name) const;
+	};
+	static Local<Value> Serialize(Isolate *isolate, IDispatch *ptr, const std::vector<TypeDescPtr> &types, int depth, json_t &json);
+
+	// Deferred writes are completed before synchronous calls, their first error is thrown instead
+	static inline bool flush(Isolate *isolate) { return !WriteBehind::IsBusy() || WriteBehind::Flush(isolate); }
 };
@@ -0,0 +1,233 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: Typed IDispatch invocation. Header only and independent of Node JS, so other native addons
+//              may drive the same objects. Arguments are placed in stack array of DISPPARAMS by overloads
+//              of their C++ types, result is converted in place and moved to typed output
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <ole2.h>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+//-------------------------------------------------------------------------------------------------------
+
+// Server exception is stored as error info of the thread, returns its code
+inline HRESULT DispException(EXCEPINFO &except) {
+	if (except.pfnDeferredFillIn) except.pfnDeferredFillIn(&except);
+	ICreateErrorInfo *creator = 0;
+	if SUCCEEDED(CreateErrorInfo(&creator)) {
+		IErrorInfo *errinfo = 0;
+		if (except.bstrDescription) creator->SetDescription(except.bstrDescription);
+		if (except.bstrSource) creator->SetSource(except.bstrSource);
+		if (except.bstrHelpFile) creator->SetHelpFile(except.bstrHelpFile);
+		creator->SetHelpContext(except.dwHelpContext);
+		if SUCCEEDED(creator->QueryInterface(IID_IErrorInfo, (void**)&errinfo)) {
+			SetErrorInfo(0, errinfo);
+			errinfo->Release();
+		}
+		creator->Release();
+	}
+	SysFreeString(except.bstrDescription);
+	SysFreeString(except.bstrSource);
+	SysFreeString(except.bstrHelpFile);
+	if FAILED(except.scode) return except.scode;
+	if (except.wCode != 0) return MAKE_HRESULT(SEVERITY_ERROR, FACILITY_DISPATCH, except.wCode);
+	return DISP_E_EXCEPTION;
+}
+
+inline HRESULT DispFind(IDispatch *disp, LPOLESTR name, DISPID *dispid) {
+	LPOLESTR names[] = { name };
+	return disp->GetIDsOfNames(GUID_NULL, names, 1, 0, dispid);
+}
+
+// Arguments are in reverse order, as in DISPPARAMS
+inline HRESULT DispInvoke(IDispatch *disp, DISPID dispid, UINT argcnt = 0, VARIANT *args = 0, VARIANT *ret = 0, WORD  flags = DISPATCH_METHOD) {
+	DISPPARAMS params = { args, 0, argcnt, 0 };
+	DISPID dispidNamed = DISPID_PROPERTYPUT;
+	if (flags == DISPATCH_PROPERTYPUT) { // It`s is a magic
+		params.cNamedArgs = 1;
+		params.rgdispidNamedArgs = &dispidNamed;
+	}
+	EXCEPINFO except;
+	memset(&except, 0, sizeof(except));
+	HRESULT hrcode = disp->Invoke(dispid, IID_NULL, 0, flags, &params, ret, &except, 0);
+	if (hrcode == DISP_E_EXCEPTION) hrcode = DispException(except);
+	return hrcode;
+}
+
+inline HRESULT DispInvoke(IDispatch *disp, LPOLESTR name, UINT argcnt = 0, VARIANT *args = 0, VARIANT *ret = 0, WORD  flags = DISPATCH_METHOD, DISPID *dispid = 0) {
+	LPOLESTR names[] = { name };
+    DISPID dispids[] = { 0 };
+	HRESULT hrcode = disp->GetIDsOfNames(GUID_NULL, names, 1, 0, dispids);
+	if SUCCEEDED(hrcode) hrcode = DispInvoke(disp, dispids[0], argcnt, args, ret, flags);
+	if (dispid) *dispid = dispids[0];
+	return hrcode;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Arguments, overload by C++ type fills variant and returns true when variant owns allocated value.
+// Strings, interfaces and variants are borrowed for the call, BSTR is expected to be real BSTR
+
+struct DispMissing {}; // Omitted optional argument
+
+inline bool DispArg(VARIANT &v, const DispMissing &) { v.vt = VT_ERROR; v.scode = DISP_E_PARAMNOTFOUND; return false; }
+inline bool DispArg(VARIANT &v, CHAR x) { v.vt = VT_I1; v.cVal = x; return false; }
+inline bool DispArg(VARIANT &v, BYTE x) { v.vt = VT_UI1; v.bVal = x; return false; }
+inline bool DispArg(VARIANT &v, SHORT x) { v.vt = VT_I2; v.iVal = x; return false; }
+inline bool DispArg(VARIANT &v, USHORT x) { v.vt = VT_UI2; v.uiVal = x; return false; }
+inline bool DispArg(VARIANT &v, INT x) { v.vt = VT_I4; v.lVal = x; return false; }
+inline bool DispArg(VARIANT &v, UINT x) { v.vt = VT_UI4; v.ulVal = x; return false; }
+inline bool DispArg(VARIANT &v, LONG x) { v.vt = VT_I4; v.lVal = x; return false; }
+inline bool DispArg(VARIANT &v, ULONG x) { v.vt = VT_UI4; v.ulVal = x; return false; }
+inline bool DispArg(VARIANT &v, LONGLONG x) { v.vt = VT_I8; v.llVal = x; return false; }
+inline bool DispArg(VARIANT &v, ULONGLONG x) { v.vt = VT_UI8; v.ullVal = x; return false; }
+inline bool DispArg(VARIANT &v, FLOAT x) { v.vt = VT_R4; v.fltVal = x; return false; }
+inline bool DispArg(VARIANT &v, DOUBLE x) { v.vt = VT_R8; v.dblVal = x; return false; }
+inline bool DispArg(VARIANT &v, BSTR x) { v.vt = VT_BSTR; v.bstrVal = x; return false; }
+inline bool DispArg(VARIANT &v, LPCOLESTR x) { v.vt = VT_BSTR; v.bstrVal = SysAllocString(x); return true; }
+inline bool DispArg(VARIANT &v, const std::wstring &x) { v.vt = VT_BSTR; v.bstrVal = SysAllocStringLen(x.c_str(), (UINT)x.length()); return true; }
+inline bool DispArg(VARIANT &v, IDispatch *x) { v.vt = VT_DISPATCH; v.pdispVal = x; return false; }
+inline bool DispArg(VARIANT &v, IUnknown *x) { v.vt = VT_UNKNOWN; v.punkVal = x; return false; }
+inline bool DispArg(VARIANT &v, const VARIANT &x) { v = x; return false; }
+inline bool DispArg(VARIANT &v, LONG *x) { v.vt = VT_I4 | VT_BYREF; v.plVal = x; return false; }
+inline bool DispArg(VARIANT &v, DOUBLE *x) { v.vt = VT_R8 | VT_BYREF; v.pdblVal = x; return false; }
+inline bool DispArg(VARIANT &v, BSTR *x) { v.vt = VT_BSTR | VT_BYREF; v.pbstrVal = x; return false; }
+inline bool DispArg(VARIANT &v, VARIANT *x) { v.vt = VT_VARIANT | VT_BYREF; v.pvarVal = x; return false; }
+
+// Only bool itself, pointers of other types are not silently converted
+template<typename T>
+inline typename std::enable_if<std::is_same<T, bool>::value, bool>::type DispArg(VARIANT &v, T x) { v.vt = VT_BOOL; v.boolVal = x ? VARIANT_TRUE : VARIANT_FALSE; return false; }
+
+//-------------------------------------------------------------------------------------------------------
+// Results, returned variant is changed to type of output in place. Strings and interfaces are moved,
+// caller owns returned BSTR and reference
+
+template<typename T, typename = void> struct DispResult;
+template<> struct DispResult<CHAR> { static const VARTYPE vt = VT_I1; static inline void Get(VARIANT &v, CHAR &out) { out = v.cVal; } };
+template<> struct DispResult<BYTE> { static const VARTYPE vt = VT_UI1; static inline void Get(VARIANT &v, BYTE &out) { out = v.bVal; } };
+template<> struct DispResult<SHORT> { static const VARTYPE vt = VT_I2; static inline void Get(VARIANT &v, SHORT &out) { out = v.iVal; } };
+template<> struct DispResult<USHORT> { static const VARTYPE vt = VT_UI2; static inline void Get(VARIANT &v, USHORT &out) { out = v.uiVal; } };
+template<> struct DispResult<INT> { static const VARTYPE vt = VT_I4; static inline void Get(VARIANT &v, INT &out) { out = v.lVal; } };
+template<> struct DispResult<UINT> { static const VARTYPE vt = VT_UI4; static inline void Get(VARIANT &v, UINT &out) { out = v.ulVal; } };
+template<> struct DispResult<LONG> { static const VARTYPE vt = VT_I4; static inline void Get(VARIANT &v, LONG &out) { out = v.lVal; } };
+template<> struct DispResult<ULONG> { static const VARTYPE vt = VT_UI4; static inline void Get(VARIANT &v, ULONG &out) { out = v.ulVal; } };
+template<> struct DispResult<LONGLONG> { static const VARTYPE vt = VT_I8; static inline void Get(VARIANT &v, LONGLONG &out) { out = v.llVal; } };
+template<> struct DispResult<ULONGLONG> { static const VARTYPE vt = VT_UI8; static inline void Get(VARIANT &v, ULONGLONG &out) { out = v.ullVal; } };
+template<> struct DispResult<FLOAT> { static const VARTYPE vt = VT_R4; static inline void Get(VARIANT &v, FLOAT &out) { out = v.fltVal; } };
+template<> struct DispResult<DOUBLE> { static const VARTYPE vt = VT_R8; static inline void Get(VARIANT &v, DOUBLE &out) { out = v.dblVal; } };
+template<> struct DispResult<bool> { static const VARTYPE vt = VT_BOOL; static inline void Get(VARIANT &v, bool &out) { out = (v.boolVal != VARIANT_FALSE); } };
+template<> struct DispResult<BSTR> { static const VARTYPE vt = VT_BSTR; static inline void Get(VARIANT &v, BSTR &out) { out = v.bstrVal; v.vt = VT_EMPTY; } };
+template<> struct DispResult<std::wstring> { static const VARTYPE vt = VT_BSTR; static inline void Get(VARIANT &v, std::wstring &out) { if (v.bstrVal) out.assign(v.bstrVal, SysStringLen(v.bstrVal)); else out.clear(); } };
+template<> struct DispResult<IDispatch*> { static const VARTYPE vt = VT_DISPATCH; static inline void Get(VARIANT &v, IDispatch *&out) { out = v.pdispVal; v.vt = VT_EMPTY; } };
+template<> struct DispResult<IUnknown*> { static const VARTYPE vt = VT_UNKNOWN; static inline void Get(VARIANT &v, IUnknown *&out) { out = v.punkVal; v.vt = VT_EMPTY; } };
+
+// VARIANT and classes derived from it receive result as is, previous value of output is cleared
+template<typename T> struct DispResult<T, typename std::enable_if<std::is_base_of<VARIANT, T>::value>::type> {
+	static const VARTYPE vt = VT_VARIANT;
+	static inline void Get(VARIANT &v, T &out) { VariantClear(&out); static_cast<VARIANT&>(out) = v; v.vt = VT_EMPTY; }
+};
+
+template<typename T>
+inline HRESULT DispResultGet(VARIANT &v, T &out) {
+	typedef DispResult<T> result_t;
+	HRESULT hrcode = S_OK;
+	if (result_t::vt != VT_VARIANT && v.vt != result_t::vt) {
+
+		// Empty interface result is null pointer
+		if ((result_t::vt == VT_DISPATCH || result_t::vt == VT_UNKNOWN) && (v.vt == VT_EMPTY || v.vt == VT_NULL)) {
+			v.vt = result_t::vt;
+			v.punkVal = 0;
+		}
+		else hrcode = VariantChangeType(&v, &v, 0, result_t::vt);
+	}
+	if SUCCEEDED(hrcode) result_t::Get(v, out);
+	VariantClear(&v);
+	return hrcode;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Invocation, arguments are given in natural order and stored reversed. Variants are on the stack,
+// only strings passed as LPCOLESTR or std::wstring are allocated
+
+template<typename... Args>
+inline HRESULT DispInvokeArgs(IDispatch *disp, DISPID dispid, WORD flags, VARIANT *ret, const Args&... args) {
+	const UINT argcnt = sizeof...(Args);
+	VARIANT vars[argcnt + 1]; // Not empty without arguments
+	bool owned[argcnt + 1];
+	UINT i = argcnt;
+	int expand[] = { 0, (--i, owned[i] = DispArg(vars[i], args), 0)... };
+	(void)expand;
+	HRESULT hrcode = disp ? DispInvoke(disp, dispid, argcnt, vars, ret, flags) : E_POINTER;
+	for (i = 0; i < argcnt; i++) {
+		if (owned[i]) VariantClear(&vars[i]);
+	}
+	return hrcode;
+}
+
+template<typename Ret, typename... Args>
+inline HRESULT DispInvokeResult(IDispatch *disp, DISPID dispid, WORD flags, Ret *result, const Args&... args) {
+	VARIANT ret;
+	VariantInit(&ret);
+	HRESULT hrcode = DispInvokeArgs(disp, dispid, flags, &ret, args...);
+	if SUCCEEDED(hrcode) hrcode = DispResultGet(ret, *result);
+	else VariantClear(&ret);
+	return hrcode;
+}
+
+// Method call, result is converted to type of output. DispCall(disp, dispid, nullptr, ...) ignores result
+template<typename Ret, typename... Args>
+inline HRESULT DispCall(IDispatch *disp, DISPID dispid, Ret *result, const Args&... args) {
+	return DispInvokeResult(disp, dispid, DISPATCH_METHOD, result, args...);
+}
+
+template<typename... Args>
+inline HRESULT DispCall(IDispatch *disp, DISPID dispid, std::nullptr_t, const Args&... args) {
+	return DispInvokeArgs(disp, dispid, DISPATCH_METHOD, 0, args...);
+}
+
+// Property get, arguments are indexes of parameterized property
+template<typename T, typename... Args>
+inline HRESULT DispGet(IDispatch *disp, DISPID dispid, T *value, const Args&... args) {
+	return DispInvokeResult(disp, dispid, DISPATCH_PROPERTYGET, value, args...);
+}
+
+// Property put, value is the last argument of DISPPARAMS and the first one of the array
+template<typename T, typename... Args>
+inline HRESULT DispPut(IDispatch *disp, DISPID dispid, const T &value, const Args&... args) {
+	return DispInvokeArgs(disp, dispid, DISPATCH_PROPERTYPUT, 0, args..., value);
+}
+
+// Members by name, resolved on every call. Repeated calls should resolve dispid once by DispFind
+template<typename Ret, typename... Args>
+inline HRESULT DispCall(IDispatch *disp, LPCOLESTR name, Ret *result, const Args&... args) {
+	DISPID dispid;
+	HRESULT hrcode = disp ? DispFind(disp, (LPOLESTR)name, &dispid) : E_POINTER;
+	return SUCCEEDED(hrcode) ? DispCall(disp, dispid, result, args...) : hrcode;
+}
+
+template<typename... Args>
+inline HRESULT DispCall(IDispatch *disp, LPCOLESTR name, std::nullptr_t, const Args&... args) {
+	DISPID dispid;
+	HRESULT hrcode = disp ? DispFind(disp, (LPOLESTR)name, &dispid) : E_POINTER;
+	return SUCCEEDED(hrcode) ? DispCall(disp, dispid, nullptr, args...) : hrcode;
+}
+
+template<typename T, typename... Args>
+inline HRESULT DispGet(IDispatch *disp, LPCOLESTR name, T *value, const Args&... args) {
+	DISPID dispid;
+	HRESULT hrcode = disp ? DispFind(disp, (LPOLESTR)name, &dispid) : E_POINTER;
+	return SUCCEEDED(hrcode) ? DispGet(disp, dispid, value, args...) : hrcode;
+}
+
+template<typename T, typename... Args>
+inline HRESULT DispPut(IDispatch *disp, LPCOLESTR name, const T &value, const Args&... args) {
+	DISPID dispid;
+	HRESULT hrcode = disp ? DispFind(disp, (LPOLESTR)name, &dispid) : E_POINTER;
+	return SUCCEEDED(hrcode) ? DispPut(disp, dispid, value, args...) : hrcode;
+}
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,339 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: EventSink and EventQueue class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+//-------------------------------------------------------------------------------------------------------
+// EventSink implemetation
+
+EventSink::EventSink(const Local<Object> &_target, REFIID _iid, const TypeDescPtr &_desc)
+	: iid(_iid), desc(_desc), cookie(0), queue(EventQueue::Current()), target(Isolate::GetCurrent(), _target)
+{
+	CoCreateFreeThreadedMarshaler((IUnknown*)this, &marshaler);
+}
+
+EventSink::~EventSink() {
+	NODE_DEBUG_MSG("EventSink destructor");
+}
+
+HRESULT EventSink::Connect(IDispatch *disp, const Local<Object> &target, EventSink **sink) {
+	CComPtr<IConnectionPointContainer> container;
+	HRESULT hrcode = disp->QueryInterface(IID_IConnectionPointContainer, (void**)&container);
+	if FAILED(hrcode) return hrcode;
+
+	// Default source interface from class information
+	IID iid = IID_NULL;
+	CComPtr<ITypeInfo> info;
+	CComPtr<ITypeInfo> clsinfo;
+	CComPtr<IProvideClassInfo> provider;
+	if (SUCCEEDED(disp->QueryInterface(IID_IProvideClassInfo, (void**)&provider)) && SUCCEEDED(provider->GetClassInfo(&clsinfo))) {
+		TYPEATTR *attr;
+		if SUCCEEDED(clsinfo->GetTypeAttr(&attr)) {
+			const INT source = IMPLTYPEFLAG_FDEFAULT | IMPLTYPEFLAG_FSOURCE;
+			for (UINT i = 0; i < attr->cImplTypes && !info; i++) {
+				INT flags;
+				HREFTYPE href;
+				if (FAILED(clsinfo->GetImplTypeFlags(i, &flags)) || (flags & source) != source) continue;
+				if SUCCEEDED(clsinfo->GetRefTypeOfImplType(i, &href)) clsinfo->GetRefTypeInfo(href, &info);
+			}
+			clsinfo->ReleaseTypeAttr(attr);
+		}
+	}
+
+	// Otherwise first connection point, its type is searched in library of the object
+	if (!info) {
+		CComPtr<IEnumConnectionPoints> points;
+		CComPtr<IConnectionPoint> point;
+		if (SUCCEEDED(container->EnumConnectionPoints(&points)) && points->Next(1, &point, 0) == S_OK)
+			point->GetConnectionInterface(&iid);
+		if (iid == IID_NULL) return CONNECT_E_NOCONNECTION;
+		CComPtr<ITypeInfo> objinfo;
+		CComPtr<ITypeLib> lib;
+		UINT index;
+		if (SUCCEEDED(disp->GetTypeInfo(0, 0, &objinfo)) && SUCCEEDED(objinfo->GetContainingTypeLib(&lib, &index)))
+			lib->GetTypeInfoOfGuid(iid, &info);
+	}
+	if (!info) return TYPE_E_ELEMENTNOTFOUND;
+
+	// Only dispinterfaces may be implemented by sink
+	TYPEATTR *attr;
+	hrcode = info->GetTypeAttr(&attr);
+	if FAILED(hrcode) return hrcode;
+	iid = attr->guid;
+	bool dispatch = (attr->typekind == TKIND_DISPATCH);
+	info->ReleaseTypeAttr(attr);
+	if (!dispatch) return E_NOINTERFACE;
+
+	CComPtr<EventSink> ptr(new EventSink(target, iid, TypeCache::Get(info)));
+	hrcode = container->FindConnectionPoint(iid, &ptr->point);
+	if SUCCEEDED(hrcode) hrcode = ptr->point->Advise((IUnknown*)(IDispatch*)ptr.p, &ptr->cookie);
+	if FAILED(hrcode) {
+		ptr->point.Release();
+		ptr->Disconnect();
+		return hrcode;
+	}
+	ptr->queue->Ref();
+	*sink = ptr.Detach();
+	return S_OK;
+}
+
+void EventSink::Disconnect() {
+	if (point) {
+		point->Unadvise(cookie);
+		point.Release();
+		queue->Unref();
+	}
+	for (std::map<DISPID, Persistent<v8::Array>>::value_type &it : handlers)
+		it.second.Reset();
+	handlers.clear();
+	target.Reset();
+}
+
+HRESULT EventSink::Subscribe(Isolate *isolate, LPCOLESTR name, const Local<Function> &handler) {
+	if (!point) return CONNECT_E_NOCONNECTION;
+	for (const TypeFunc &func : desc->funcs) {
+		if (_wcsicmp(func.name.c_str(), name) != 0) continue;
+		Persistent<v8::Array> &items = handlers[func.dispid];
+		if (items.IsEmpty()) items.Reset(isolate, v8::Array::New(isolate));
+		Local<v8::Array> funcs = items.Get(isolate);
+		funcs->Set(funcs->Length(), handler);
+		return S_OK;
+	}
+	return DISP_E_UNKNOWNNAME;
+}
+
+void EventSink::Fire(Isolate *isolate, DISPID dispid, std::vector<CComVariant> &args) {
+	std::map<DISPID, Persistent<v8::Array>>::iterator it = handlers.find(dispid);
+	if (it == handlers.end() || target.IsEmpty()) return;
+	Local<Object> self = target.Get(isolate);
+	Context::Scope context_scope(self->CreationContext());
+
+	// Dispatch arguments are wrapped as objects
+	std::vector<Local<Value>> argv(args.size());
+	for (size_t i = 0; i < args.size(); i++) {
+		CComPtr<IDispatch> ptr;
+		if (VariantDispGet(&args[i], &ptr) && ptr) {
+			DispInfoPtr disp_arg(DispInfo::Create(ptr, L"@event", option_async | option_type));
+			argv[i] = DispObject::NodeCreate(isolate, self, disp_arg, L"@event");
+		}
+		else argv[i] = Variant2Value(isolate, args[i]);
+	}
+	Local<Value> *argp = argv.empty() ? nullptr : &argv[0];
+
+	// Handlers list may be changed by handler itself
+	Local<v8::Array> funcs = it->second.Get(isolate);
+	for (uint32_t i = 0; i < funcs->Length(); i++) {
+		Local<Value> func = funcs->Get(i);
+		if (func->IsFunction()) node::MakeCallback(isolate, self, Local<Function>::Cast(func), (int)argv.size(), argp);
+	}
+}
+
+HRESULT __stdcall EventSink::QueryInterface(REFIID qiid, void **ppvObject) {
+	if (qiid == iid) {
+		*ppvObject = (IDispatch*)this;
+		AddRef();
+		return S_OK;
+	}
+	if (qiid == IID_IMarshal && marshaler) {
+		return marshaler->QueryInterface(qiid, ppvObject);
+	}
+	return UnknownImpl<IDispatch>::QueryInterface(qiid, ppvObject);
+}
+
+HRESULT STDMETHODCALLTYPE EventSink::GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId) {
+	if (cNames != 1 || !rgszNames[0]) return DISP_E_UNKNOWNNAME;
+	for (const TypeFunc &func : desc->funcs) {
+		if (_wcsicmp(func.name.c_str(), rgszNames[0]) != 0) continue;
+		*rgDispId = func.dispid;
+		return S_OK;
+	}
+	return DISP_E_UNKNOWNNAME;
+}
+
+HRESULT STDMETHODCALLTYPE EventSink::Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr) {
+	queue->Push(this, dispIdMember, pDispParams);
+	return S_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// EventQueue implemetation
+
+thread_local EventQueuePtr EventQueue::current;
+
+EventQueue::EventQueue(uv_loop_t *loop) : async(new uv_async_t), refcnt(0), loop_thread(GetCurrentThreadId()),
+	limit(10000), policy(policy_merge), queued(0), delivered(0), dropped(0), merged(0), batches(0)
+{
+	uv_async_init(loop, async, Deliver);
+	async->data = this;
+	uv_unref((uv_handle_t*)async);
+}
+
+EventQueue::~EventQueue() {
+	Close();
+}
+
+EventQueuePtr EventQueue::Init(uv_loop_t *loop) {
+	if (!current) current.reset(new EventQueue(loop));
+	return current;
+}
+
+void EventQueue::Close() {
+	items_t batch;
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (!async) return;
+		uv_close((uv_handle_t*)async, [](uv_handle_t *handle) { delete (uv_async_t*)handle; });
+		async = 0;
+		batch.swap(items);
+	}
+	for (item_t &item : batch) Discard(item);
+	if (current.get() == this) current.reset();
+}
+
+void EventQueue::Ref() {
+	if (async && refcnt++ == 0) uv_ref((uv_handle_t*)async);
+}
+
+void EventQueue::Unref() {
+	if (async && refcnt > 0 && --refcnt == 0) uv_unref((uv_handle_t*)async);
+}
+
+void EventQueue::Discard(item_t &item) {
+	for (size_t i : item.marshaled)
+		VariantMarshalRelease(item.args[i]);
+	item.marshaled.clear();
+}
+
+void EventQueue::Push(EventSink *sink, DISPID dispid, DISPPARAMS *params) {
+	item_t item;
+	item.sink = sink;
+	item.dispid = dispid;
+	UINT argcnt = params ? params->cArgs : 0;
+	item.args.resize(argcnt);
+	bool foreign = (GetCurrentThreadId() != loop_thread);
+	for (UINT i = 0; i < argcnt; i++) {
+		CComVariant &arg = item.args[i];
+		VariantCopyInd(&arg, &params->rgvarg[argcnt - i - 1]);
+
+		// Interfaces of other apartment are marshaled to the loop thread
+		if (foreign && VariantMarshal(arg)) item.marshaled.push_back(i);
+	}
+
+	std::unique_lock<std::mutex> lock(locker);
+	if (!async) {
+		lock.unlock();
+		Discard(item);
+		return;
+	}
+	queued++;
+	if (items.size() >= limit) {
+
+		// Coalesce with pending event of the same sink and member
+		if (policy == policy_merge) {
+			for (items_t::reverse_iterator it = items.rbegin(); it != items.rend(); ++it) {
+				if (it->sink != sink || it->dispid != dispid) continue;
+				it->args.swap(item.args);
+				it->marshaled.swap(item.marshaled);
+				merged++;
+				lock.unlock();
+				Discard(item);
+				return;
+			}
+		}
+		dropped++;
+		if (policy == policy_drop_newest) {
+			lock.unlock();
+			Discard(item);
+			return;
+		}
+		item_t oldest = items.front();
+		items.pop_front();
+		items.push_back(item);
+		uv_async_send(async);
+		lock.unlock();
+		Discard(oldest);
+		return;
+	}
+
+	// Handle is closed under the same lock
+	items.push_back(item);
+	uv_async_send(async);
+}
+
+void EventQueue::Deliver(uv_async_t *handle) {
+	EventQueue *self = (EventQueue*)handle->data;
+	items_t batch;
+	{
+		std::lock_guard<std::mutex> lock(self->locker);
+		batch.swap(self->items);
+	}
+	if (batch.empty()) return;
+	self->batches++;
+
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	for (item_t &item : batch) {
+		for (size_t i : item.marshaled)
+			VariantUnmarshal(item.args[i]);
+		item.marshaled.clear();
+		item.sink->Fire(isolate, item.dispid, item.args);
+		self->delivered++;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void EventQueue::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "events", NodeEvents);
+	NODE_DEBUG_MSG("EventQueue initialized");
+}
+
+void EventQueue::NodeEvents(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	EventQueuePtr self(current);
+	if (!self) return;
+	std::mutex &locker = self->locker;
+	size_t &limit = self->limit;
+	policy_t &policy = self->policy;
+
+	// Configure queue when options specified
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opt = args[0]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "limit"));
+		std::lock_guard<std::mutex> lock(locker);
+		if (val->IsUint32() && val->Uint32Value() > 0) limit = val->Uint32Value();
+		val = opt->Get(String::NewFromUtf8(isolate, "policy"));
+		if (val->IsString()) {
+			String::Value vname(val);
+			LPOLESTR name = (vname.length() > 0) ? (LPOLESTR)*vname : L"";
+			if (_wcsicmp(name, L"merge") == 0) policy = policy_merge;
+			else if (_wcsicmp(name, L"drop-newest") == 0) policy = policy_drop_newest;
+			else if (_wcsicmp(name, L"drop-oldest") == 0) policy = policy_drop_oldest;
+			else {
+				isolate->ThrowException(TypeError(isolate, "innvalid policy"));
+				return;
+			}
+		}
+	}
+
+	// Return queue state
+	std::lock_guard<std::mutex> lock(locker);
+	const char *policy_name = (policy == policy_merge) ? "merge" : (policy == policy_drop_newest) ? "drop-newest" : "drop-oldest";
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "limit"), Number::New(isolate, (double)limit));
+	result->Set(String::NewFromUtf8(isolate, "policy"), String::NewFromUtf8(isolate, policy_name));
+	result->Set(String::NewFromUtf8(isolate, "pending"), Number::New(isolate, (double)self->items.size()));
+	result->Set(String::NewFromUtf8(isolate, "queued"), Number::New(isolate, (double)self->queued));
+	result->Set(String::NewFromUtf8(isolate, "delivered"), Number::New(isolate, (double)self->delivered));
+	result->Set(String::NewFromUtf8(isolate, "dropped"), Number::New(isolate, (double)self->dropped));
+	result->Set(String::NewFromUtf8(isolate, "merged"), Number::New(isolate, (double)self->merged));
+	result->Set(String::NewFromUtf8(isolate, "batches"), Number::New(isolate, (double)self->batches));
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,96 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: EventSink class declarations. Connection point sink built from source interface type
+//              information, events fired on any thread are queued and delivered to the loop in batches
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+class EventQueue;
+
+class EventSink : public UnknownImpl<IDispatch> {
+public:
+	EventSink(const Local<Object> &target, REFIID iid, const TypeDescPtr &desc);
+	virtual ~EventSink();
+
+	// Find default source interface of the object and advise new sink
+	static HRESULT Connect(IDispatch *disp, const Local<Object> &target, EventSink **sink);
+	void Disconnect();
+
+	HRESULT Subscribe(Isolate *isolate, LPCOLESTR name, const Local<Function> &handler);
+	void Fire(Isolate *isolate, DISPID dispid, std::vector<CComVariant> &args);
+
+	// IUnknown interface, free threaded marshaler is aggregated so servers call sink directly on their threads
+	virtual HRESULT __stdcall QueryInterface(REFIID qiid, void **ppvObject);
+
+	// IDispatch interface
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT *pctinfo) { *pctinfo = 0; return S_OK; }
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo) { return E_NOTIMPL; }
+	virtual HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId);
+	virtual HRESULT STDMETHODCALLTYPE Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr);
+
+private:
+	IID iid;
+	TypeDescPtr desc;
+	CComPtr<IUnknown> marshaler;
+	CComPtr<IConnectionPoint> point;
+	DWORD cookie;
+	std::shared_ptr<EventQueue> queue;
+	Persistent<Object> target;
+	std::map<DISPID, Persistent<v8::Array>> handlers;
+};
+
+//-------------------------------------------------------------------------------------------------------
+
+class EventQueue {
+public:
+	enum policy_t { policy_merge, policy_drop_newest, policy_drop_oldest };
+
+	EventQueue(uv_loop_t *loop);
+	~EventQueue();
+
+	// Queue of the calling loop thread, sinks keep reference to queue of the isolate they were created in
+	static std::shared_ptr<EventQueue> Init(uv_loop_t *loop);
+	static inline std::shared_ptr<EventQueue> Current() { return current; }
+	void Close();
+
+	void Push(EventSink *sink, DISPID dispid, DISPPARAMS *params);
+
+	// Advised sinks keep the loop alive
+	void Ref();
+	void Unref();
+
+	static void NodeInit(Handle<Object> target);
+
+private:
+	struct item_t {
+		CComPtr<EventSink> sink;
+		DISPID dispid;
+		std::vector<CComVariant> args;
+		std::vector<size_t> marshaled; // Interfaces of foreign apartment, stored as marshal streams
+	};
+	typedef std::deque<item_t> items_t;
+
+	items_t items;
+	std::mutex locker;
+	uv_async_t *async;
+	LONG refcnt;
+	DWORD loop_thread;
+
+	size_t limit;
+	policy_t policy;
+	uint64_t queued, delivered, dropped, merged, batches;
+
+	static thread_local std::shared_ptr<EventQueue> current;
+	static void Deliver(uv_async_t *handle);
+	static void Discard(item_t &item);
+
+	static void NodeEvents(const FunctionCallbackInfo<Value> &args);
+};
+
+typedef std::shared_ptr<EventQueue> EventQueuePtr;
+
+//-------------------------------------------------------------------------------------------------------
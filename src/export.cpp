@@ -0,0 +1,311 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: ArrowExport class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+#include "export.h"
+
+//-------------------------------------------------------------------------------------------------------
+// Value conversion
+
+static void Utf8(LPCOLESTR str, int len, std::string &result) {
+	result.clear();
+	if (len <= 0) return;
+	int size = WideCharToMultiByte(CP_UTF8, 0, str, len, 0, 0, 0, 0);
+	if (size <= 0) return;
+	result.resize(size);
+	WideCharToMultiByte(CP_UTF8, 0, str, len, &result[0], size, 0, 0);
+}
+
+// Writer failure is failure of sink, file error is kept as last error
+static HRESULT WriteError() {
+	DWORD error = GetLastError();
+	return error ? HRESULT_FROM_WIN32(error) : E_FAIL;
+}
+
+ArrowWriter::type_t ArrowExport::FieldType(LONG type) {
+	switch (type) {
+	case 11: return ArrowWriter::type_bool; // adBoolean
+	case 2: case 3: case 16: case 17: case 18: return ArrowWriter::type_int32; // adSmallInt, adInteger, adTinyInt, adUnsignedTinyInt, adUnsignedSmallInt
+	case 19: case 20: case 21: return ArrowWriter::type_int64; // adUnsignedInt, adBigInt, adUnsignedBigInt
+	case 4: case 5: case 6: case 14: case 131: case 139: return ArrowWriter::type_float64; // adSingle, adDouble, adCurrency, adDecimal, adNumeric, adVarNumeric
+	case 7: case 64: case 133: case 134: case 135: return ArrowWriter::type_timestamp; // adDate, adFileTime, adDBDate, adDBTime, adDBTimeStamp
+	case 128: case 204: case 205: return ArrowWriter::type_binary; // adBinary, adVarBinary, adLongVarBinary
+	default: return ArrowWriter::type_utf8;
+	}
+}
+
+ArrowWriter::type_t ArrowExport::ValueType(const VARIANT *values, LONG count) {
+	enum { kind_bool = 1, kind_int = 2, kind_int64 = 4, kind_double = 8, kind_date = 16, kind_binary = 32, kind_text = 64 };
+	int kinds = 0;
+	for (LONG i = 0; i < count; i++) {
+		switch (values[i].vt) {
+		case VT_EMPTY: case VT_NULL: case VT_ERROR: break;
+		case VT_BOOL: kinds |= kind_bool; break;
+		case VT_I1: case VT_UI1: case VT_I2: case VT_UI2: case VT_I4: case VT_INT: kinds |= kind_int; break;
+		case VT_UI4: case VT_UINT: case VT_I8: case VT_UI8: kinds |= kind_int64; break;
+		case VT_R4: case VT_R8: case VT_CY: case VT_DECIMAL: kinds |= kind_double; break;
+		case VT_DATE: kinds |= kind_date; break;
+		case VT_ARRAY | VT_UI1: kinds |= kind_binary; break;
+		default: kinds |= kind_text; break;
+		}
+	}
+
+	// Mixed numbers are widened, other mixed columns are text
+	if (kinds == kind_bool) return ArrowWriter::type_bool;
+	if (kinds == kind_int) return ArrowWriter::type_int32;
+	if (kinds == kind_int64 || kinds == (kind_int | kind_int64)) return ArrowWriter::type_int64;
+	if (kinds != 0 && (kinds & ~(kind_int | kind_int64 | kind_double)) == 0) return ArrowWriter::type_float64;
+	if (kinds == kind_date) return ArrowWriter::type_timestamp;
+	if (kinds == kind_binary) return ArrowWriter::type_binary;
+	return ArrowWriter::type_utf8;
+}
+
+void ArrowExport::Append(ArrowWriter &writer, size_t col, const VARIANT &value, std::string &text) {
+	if (value.vt == VT_EMPTY || value.vt == VT_NULL || value.vt == VT_ERROR) {
+		writer.AppendNull(col);
+		return;
+	}
+
+	// Values of column type are appended directly, others are converted
+	VARTYPE vt;
+	ArrowWriter::type_t type = writer.Type(col);
+	switch (type) {
+	case ArrowWriter::type_bool: vt = VT_BOOL; break;
+	case ArrowWriter::type_int32: vt = (value.vt == VT_I4) ? VT_I4 : VT_I8; break;
+	case ArrowWriter::type_int64: vt = VT_I8; break;
+	case ArrowWriter::type_float64: vt = VT_R8; break;
+	case ArrowWriter::type_timestamp: vt = VT_DATE; break;
+	case ArrowWriter::type_binary: vt = VT_ARRAY | VT_UI1; break;
+	default: vt = VT_BSTR; break;
+	}
+	CComVariant converted;
+	const VARIANT *v = &value;
+	if (value.vt != vt) {
+		if (vt == (VT_ARRAY | VT_UI1) || FAILED(VariantChangeType(&converted, &value, 0, vt))) {
+			writer.AppendNull(col);
+			return;
+		}
+		v = &converted;
+	}
+	switch (vt) {
+	case VT_BOOL: writer.AppendBool(col, v->boolVal != VARIANT_FALSE); break;
+	case VT_I4: writer.AppendInt(col, v->lVal); break;
+	case VT_I8: writer.AppendInt(col, v->llVal); break;
+	case VT_R8: writer.AppendDouble(col, v->dblVal); break;
+	case VT_DATE: writer.AppendInt(col, (int64_t)DateToWallClock(v->date)); break; // Timestamp without zone
+	case VT_BSTR:
+		Utf8(v->bstrVal, v->bstrVal ? (int)SysStringLen(v->bstrVal) : 0, text);
+		writer.AppendBytes(col, text.data(), text.size());
+		break;
+	default: {
+		void *data;
+		SAFEARRAY *psa = v->parray;
+		if (!psa || FAILED(SafeArrayAccessData(psa, &data))) writer.AppendNull(col);
+		else {
+			writer.AppendBytes(col, data, psa->rgsabound[0].cElements);
+			SafeArrayUnaccessData(psa);
+		}
+	}}
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Sources
+
+HRESULT ArrowExport::Recordset(IDispatch *rs, ArrowWriter &writer, LONG batch) {
+	CComPtr<IDispatch> fields;
+	LONG cnt = 0;
+	HRESULT hrcode = DispGet(rs, L"Fields", &fields);
+	if (SUCCEEDED(hrcode) && !fields) hrcode = DISP_E_TYPEMISMATCH;
+	if SUCCEEDED(hrcode) hrcode = DispGet(fields, L"Count", &cnt);
+	if FAILED(hrcode) return hrcode;
+
+	// Columns by field names and types
+	std::string text;
+	for (LONG i = 0; i < cnt; i++) {
+		CComPtr<IDispatch> field;
+		std::wstring name;
+		LONG type = 0;
+		hrcode = DispGet(fields, L"Item", &field, i);
+		if (SUCCEEDED(hrcode) && !field) hrcode = DISP_E_TYPEMISMATCH;
+		if SUCCEEDED(hrcode) hrcode = DispGet(field, L"Name", &name);
+		if SUCCEEDED(hrcode) hrcode = DispGet(field, L"Type", &type);
+		if FAILED(hrcode) return hrcode;
+		Utf8(name.c_str(), (int)name.length(), text);
+		writer.AddColumn(text, FieldType(type));
+	}
+
+	// Every page of rows is one batch, array is field major: data[field + row * fields]
+	for (;;) {
+		CComVariant page;
+		bool eof = true;
+		hrcode = DispGet(rs, L"EOF", &eof);
+		if (FAILED(hrcode) || eof) break;
+		hrcode = DispCall(rs, L"GetRows", &page, batch);
+		if FAILED(hrcode) break;
+		SAFEARRAY *psa = (page.vt == (VT_ARRAY | VT_VARIANT)) ? page.parray : 0;
+		VARIANT *data;
+		if (!psa || SafeArrayGetDim(psa) != 2 || FAILED(SafeArrayAccessData(psa, (void**)&data))) {
+			hrcode = DISP_E_TYPEMISMATCH;
+			break;
+		}
+		LONG cols = psa->rgsabound[1].cElements, cnt_rows = psa->rgsabound[0].cElements; // Bounds are stored in reverse order
+		bool written = true;
+		for (LONG r = 0; written && r < cnt_rows; r++) {
+			for (LONG c = 0; c < cols && c < (LONG)writer.Columns(); c++)
+				Append(writer, c, data[c + r * cols], text);
+			written = writer.EndRow();
+		}
+		SafeArrayUnaccessData(psa);
+		if (!written) return WriteError();
+		if (cnt_rows < batch) break;
+	}
+	return hrcode;
+}
+
+HRESULT ArrowExport::Array(SAFEARRAY *psa, const std::vector<std::string> &names, bool header, ArrowWriter &writer) {
+	VARIANT *data;
+	VARTYPE vt;
+	if (SafeArrayGetDim(psa) != 2 || FAILED(SafeArrayGetVartype(psa, &vt)) || vt != VT_VARIANT) return DISP_E_TYPEMISMATCH;
+	HRESULT hrcode = SafeArrayAccessData(psa, (void**)&data);
+	if FAILED(hrcode) return hrcode;
+
+	// First dimension is row, data is column major: data[row + col * rows]
+	LONG rows = psa->rgsabound[1].cElements, cols = psa->rgsabound[0].cElements;
+	LONG first = (header && rows > 0) ? 1 : 0;
+	std::string text;
+	for (LONG c = 0; c < cols; c++) {
+		VARIANT *column = data + c * rows;
+		if (c < (LONG)names.size()) text = names[c];
+		else if (first > 0 && column[0].vt == VT_BSTR && column[0].bstrVal) Utf8(column[0].bstrVal, (int)SysStringLen(column[0].bstrVal), text);
+		else text = "f" + std::to_string(c);
+		writer.AddColumn(text, ValueType(column + first, rows - first));
+	}
+	bool written = true;
+	for (LONG r = first; written && r < rows; r++) {
+		for (LONG c = 0; c < cols; c++)
+			Append(writer, c, data[r + c * rows], text);
+		written = writer.EndRow();
+	}
+	SafeArrayUnaccessData(psa);
+	return written ? S_OK : WriteError();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void ArrowExport::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "exportArrow", NodeExport);
+	NODE_DEBUG_MSG("ArrowExport initialized");
+}
+
+static void StreamFree(char *data, void *hint) {
+	delete (std::vector<uint8_t>*)hint;
+}
+
+// Stream storage is moved to the heap and owned by Buffer, so it is not copied
+static Local<Value> StreamBuffer(Isolate *isolate, std::vector<uint8_t> &output) {
+	if (output.empty()) return Buffer::New(isolate, 0).ToLocalChecked();
+	std::vector<uint8_t> *stream = new std::vector<uint8_t>(std::move(output));
+	MaybeLocal<Object> buf = Buffer::New(isolate, (char*)stream->data(), stream->size(), StreamFree, stream);
+	if (buf.IsEmpty()) {
+		delete stream;
+		return Undefined(isolate);
+	}
+	return buf.ToLocalChecked();
+}
+
+void ArrowExport::NodeExport(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	CComPtr<IDispatch> disp;
+	if (args.Length() < 1 || FAILED(DispObject::GetDispatch(args[0], &disp))) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+
+	// Options: batch rows, member returning array (recordset otherwise), column names, header row, output file
+	LONG batch = 65536;
+	bool header = false;
+	std::wstring member, filename;
+	std::vector<std::string> names;
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		Local<Object> opt = args[1]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "batch"));
+		if (val->IsUint32() && val->Uint32Value() > 0) batch = (LONG)std::min(val->Uint32Value(), (uint32_t)LONG_MAX);
+		val = opt->Get(String::NewFromUtf8(isolate, "member"));
+		if (val->IsString()) {
+			String::Value vname(val);
+			member.assign((LPOLESTR)*vname, vname.length());
+		}
+		val = opt->Get(String::NewFromUtf8(isolate, "file"));
+		if (val->IsString()) {
+			String::Value vname(val);
+			filename.assign((LPOLESTR)*vname, vname.length());
+		}
+		val = opt->Get(String::NewFromUtf8(isolate, "names"));
+		if (val->IsArray()) {
+			Local<v8::Array> items = Local<v8::Array>::Cast(val);
+			std::string text;
+			for (uint32_t i = 0; i < items->Length(); i++) {
+				String::Value vname(items->Get(i));
+				Utf8((LPOLESTR)*vname, vname.length(), text);
+				names.push_back(text);
+			}
+		}
+		header = v8val2bool(opt->Get(String::NewFromUtf8(isolate, "header")), false);
+	}
+
+	// File output is written by batches, so only one batch is kept in memory
+	std::vector<uint8_t> output;
+	HANDLE hfile = INVALID_HANDLE_VALUE;
+	if (!filename.empty()) {
+		hfile = CreateFileW(filename.c_str(), GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+		if (hfile == INVALID_HANDLE_VALUE) {
+			isolate->ThrowException(Win32Error(isolate, HRESULT_FROM_WIN32(GetLastError()), L"ArrowExport", filename.c_str()));
+			return;
+		}
+	}
+	ArrowWriter writer([hfile, &output](const void *data, size_t size) -> bool {
+		if (hfile == INVALID_HANDLE_VALUE) {
+			output.insert(output.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+			return true;
+		}
+		DWORD written = 0;
+		SetLastError(0);
+		return WriteFile(hfile, data, (DWORD)size, &written, 0) && written == size;
+	}, batch);
+
+	HRESULT hrcode;
+	if (member.empty()) hrcode = Recordset(disp, writer, batch);
+	else {
+		CComVariant value;
+		hrcode = DispInvoke(disp, (LPOLESTR)member.c_str(), 0, 0, &value, DISPATCH_PROPERTYGET);
+		if (SUCCEEDED(hrcode) && value.vt != (VT_ARRAY | VT_VARIANT)) hrcode = DISP_E_TYPEMISMATCH;
+		if SUCCEEDED(hrcode) hrcode = Array(value.parray, names, header, writer);
+	}
+	if (SUCCEEDED(hrcode) && !writer.End()) hrcode = WriteError();
+	if (hfile != INVALID_HANDLE_VALUE) {
+		CloseHandle(hfile);
+		if FAILED(hrcode) DeleteFileW(filename.c_str());
+	}
+	if FAILED(hrcode) {
+		isolate->ThrowException(DispError(isolate, hrcode, L"ArrowExport", member.empty() ? L"GetRows" : member.c_str()));
+		return;
+	}
+
+	// Buffer with stream or counters of written file
+	if (filename.empty()) {
+		args.GetReturnValue().Set(StreamBuffer(isolate, output));
+		return;
+	}
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "rows"), Number::New(isolate, (double)writer.Rows()));
+	result->Set(String::NewFromUtf8(isolate, "batches"), Number::New(isolate, (double)writer.Batches()));
+	result->Set(String::NewFromUtf8(isolate, "bytes"), Number::New(isolate, (double)writer.Bytes()));
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
@@ -0,0 +1,31 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: ArrowExport class declarations. Recordset pages (GetRows) and two dimensional arrays are
+//              written as Arrow IPC record batches to Buffer or file, values never become JS values
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "arrow.h"
+
+//-------------------------------------------------------------------------------------------------------
+
+class ArrowExport {
+public:
+	static void NodeInit(Handle<Object> target);
+
+private:
+
+	// Column type by ADO field type or by types of column values
+	static ArrowWriter::type_t FieldType(LONG type);
+	static ArrowWriter::type_t ValueType(const VARIANT *values, LONG count);
+	static void Append(ArrowWriter &writer, size_t col, const VARIANT &value, std::string &text);
+
+	static HRESULT Recordset(IDispatch *rs, ArrowWriter &writer, LONG batch);
+	static HRESULT Array(SAFEARRAY *psa, const std::vector<std::string> &names, bool header, ArrowWriter &writer);
+
+	static void NodeExport(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
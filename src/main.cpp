@@ -11,29 +11,54 @@
 
 namespace node_activex {
 
-    void Init(Local<Object> exports) {
-        DispObject::NodeInit(exports);
-    }
-
-    NODE_MODULE(node_activex, Init)
-}
+    // Isolates using the addon, worker apartments are shared and stopped with the last one
+    static volatile LONG isolates = 0;
+    static thread_local bool com_initialized = false;
 
-//----------------------------------------------------------------------------------
+    static void Cleanup(void *arg) {
+        WriteBehind::Clear();
+        AsyncObject::Clear();
+        InstancePool::Clear();
+        DispObject::Clear();
+        if (EventQueuePtr events = EventQueue::Current()) events->Close();
+        if (LoopQueuePtr queue = LoopQueue::Current()) queue->Close();
+        ClassClear();
+        if (InterlockedDecrement(&isolates) == 0) Apartment::Clear();
+        if (com_initialized) {
+            com_initialized = false;
+            CoUninitialize();
+        }
+    }
 
-BOOL APIENTRY DllMain(HMODULE hModule, DWORD  ulReason, LPVOID lpReserved) {
-    switch (ulReason) {
-    case DLL_PROCESS_ATTACH:
-        CoInitialize(0);
-        break;
-    case DLL_PROCESS_DETACH:
-        CoUninitialize();
-        break;
-    case DLL_THREAD_ATTACH:
-        break;
-    case DLL_THREAD_DETACH:
-        break;
+    // Context aware, so the addon may be loaded by worker threads. Every isolate has its own loop thread,
+    // the thread is initialized as single threaded apartment and owns objects created by its isolate
+    void Init(Local<Object> exports, Local<Value> module, Local<Context> context, void *priv) {
+        Isolate *isolate = context->GetIsolate();
+        if (!com_initialized) com_initialized = SUCCEEDED(CoInitializeEx(0, COINIT_APARTMENTTHREADED));
+        InterlockedIncrement(&isolates);
+        // Environment cleanup hooks exist from Node 10.2, module version 64 covers 10.0 and 10.1 too
+#if NODE_MAJOR_VERSION > 10 || (NODE_MAJOR_VERSION == 10 && NODE_MINOR_VERSION >= 2)
+        uv_loop_t *loop = node::GetCurrentEventLoop(isolate);
+        node::AddEnvironmentCleanupHook(isolate, Cleanup, 0);
+#else
+        uv_loop_t *loop = uv_default_loop();
+        node::AtExit(Cleanup);
+#endif
+        LoopQueue::Init(loop);
+        EventQueue::Init(loop);
+        DispObject::NodeInit(exports);
+        TypeCache::NodeInit(exports);
+        InstancePool::NodeInit(exports);
+        EventQueue::NodeInit(exports);
+        Apartment::NodeInit(exports);
+        RangeIO::NodeInit(exports);
+        AsyncObject::NodeInit(exports);
+        WriteBehind::NodeInit(exports);
+        ArrowExport::NodeInit(exports);
+        BulkCommand::NodeInit(exports);
     }
-    return TRUE;
+
+    NODE_MODULE_CONTEXT_AWARE(node_activex, Init)
 }
 
 //----------------------------------------------------------------------------------
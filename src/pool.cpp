@@ -0,0 +1,184 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: InstancePool class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+thread_local InstancePool::pools_t InstancePool::pools;
+
+//-------------------------------------------------------------------------------------------------------
+
+HRESULT InstancePool::Create(LPCOLESTR progid, IDispatch **disp) {
+    CLSID clsid;
+    HRESULT hrcode = ClassFind(progid, &clsid);
+    if SUCCEEDED(hrcode) hrcode = ClassCreate(clsid, CLSCTX_INPROC_SERVER | CLSCTX_LOCAL_SERVER, disp);
+    return hrcode;
+}
+
+bool InstancePool::Check(IDispatch *disp) {
+    UINT cnt;
+    return disp && SUCCEEDED(disp->GetTypeInfoCount(&cnt));
+}
+
+void InstancePool::Evict(pool_t &pool) {
+    if (pool.opt.idle == 0) return;
+    DWORD now = GetTickCount();
+
+    // Items are ordered by release time, oldest first
+    size_t cnt = 0;
+    size_t total = pool.items.size() + pool.leased;
+    while (cnt < pool.items.size() && total - cnt > pool.opt.min && now - pool.items[cnt].released > pool.opt.idle) cnt++;
+    if (cnt == 0) return;
+    pool.items.erase(pool.items.begin(), pool.items.begin() + cnt);
+    pool.evicted += cnt;
+}
+
+void InstancePool::Clear() {
+    pools.clear();
+}
+
+HRESULT InstancePool::Configure(LPCOLESTR progid, const options_t &opt) {
+    pool_t &pool = pools[progid];
+    pool.opt = opt;
+    Evict(pool);
+
+    // Pre-warm instances up to min
+    while (pool.items.size() + pool.leased < opt.min) {
+        item_t item;
+        HRESULT hrcode = Create(progid, &item.disp);
+        if FAILED(hrcode) {
+            pool.failed++;
+            return hrcode;
+        }
+        item.released = GetTickCount();
+        pool.items.push_back(item);
+        pool.created++;
+    }
+    return S_OK;
+}
+
+HRESULT InstancePool::Lease(LPCOLESTR progid, IDispatch **disp) {
+    pool_t &pool = pools[progid];
+    Evict(pool);
+
+    // Most recently released instance first, broken instances are dropped
+    while (!pool.items.empty()) {
+        CComPtr<IDispatch> ptr(pool.items.back().disp);
+        pool.items.pop_back();
+        if (!Check(ptr)) {
+            pool.failed++;
+            continue;
+        }
+        pool.leased++;
+        *disp = ptr.Detach();
+        return S_OK;
+    }
+
+    if (pool.opt.max > 0 && pool.leased >= pool.opt.max) return HRESULT_FROM_WIN32(ERROR_BUSY);
+    HRESULT hrcode = Create(progid, disp);
+    if FAILED(hrcode) {
+        pool.failed++;
+        return hrcode;
+    }
+    pool.created++;
+    pool.leased++;
+    return hrcode;
+}
+
+void InstancePool::Release(LPCOLESTR progid, IDispatch *disp) {
+    pools_t::iterator it = pools.find(progid);
+    if (it == pools.end()) return;
+    pool_t &pool = it->second;
+    if (pool.leased > 0) pool.leased--;
+    if (pool.opt.max > 0 && pool.items.size() + pool.leased >= pool.opt.max) return;
+    item_t item;
+    item.disp = disp;
+    item.released = GetTickCount();
+    pool.items.push_back(item);
+    Evict(pool);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void InstancePool::NodeInit(Handle<Object> target) {
+    NODE_SET_METHOD(target, "pool", NodePool);
+    NODE_SET_METHOD(target, "lease", NodeLease);
+    NODE_SET_METHOD(target, "release", NodeRelease);
+    NODE_DEBUG_MSG("InstancePool initialized");
+}
+
+void InstancePool::NodePool(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+        return;
+    }
+    String::Value vname(args[0]);
+    std::wstring progid((LPOLESTR)*vname, vname.length());
+    pool_t &pool = pools[progid];
+
+    // Configure pool when options specified
+    if (args.Length() > 1 && args[1]->IsObject()) {
+        Local<Object> opt = args[1]->ToObject();
+        options_t popt = pool.opt;
+        Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "min"));
+        if (val->IsUint32()) popt.min = val->Uint32Value();
+        val = opt->Get(String::NewFromUtf8(isolate, "max"));
+        if (val->IsUint32()) popt.max = val->Uint32Value();
+        val = opt->Get(String::NewFromUtf8(isolate, "idle"));
+        if (val->IsUint32()) popt.idle = val->Uint32Value();
+        if (popt.max > 0 && popt.min > popt.max) popt.min = popt.max;
+        HRESULT hrcode = Configure(progid.c_str(), popt);
+        if FAILED(hrcode) {
+            isolate->ThrowException(DispError(isolate, hrcode, L"PoolCreate", progid.c_str()));
+            return;
+        }
+    }
+
+    // Return pool state
+    Local<Object> result(Object::New(isolate));
+    result->Set(String::NewFromUtf8(isolate, "min"), Uint32::New(isolate, (uint32_t)pool.opt.min));
+    result->Set(String::NewFromUtf8(isolate, "max"), Uint32::New(isolate, (uint32_t)pool.opt.max));
+    result->Set(String::NewFromUtf8(isolate, "idle"), Uint32::New(isolate, pool.opt.idle));
+    result->Set(String::NewFromUtf8(isolate, "free"), Uint32::New(isolate, (uint32_t)pool.items.size()));
+    result->Set(String::NewFromUtf8(isolate, "leased"), Uint32::New(isolate, (uint32_t)pool.leased));
+    result->Set(String::NewFromUtf8(isolate, "created"), Uint32::New(isolate, (uint32_t)pool.created));
+    result->Set(String::NewFromUtf8(isolate, "evicted"), Uint32::New(isolate, (uint32_t)pool.evicted));
+    result->Set(String::NewFromUtf8(isolate, "failed"), Uint32::New(isolate, (uint32_t)pool.failed));
+    args.GetReturnValue().Set(result);
+}
+
+void InstancePool::NodeLease(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+        return;
+    }
+    String::Value vname(args[0]);
+    std::wstring progid((LPOLESTR)*vname, vname.length());
+    CComPtr<IDispatch> disp;
+    HRESULT hrcode = progid.empty() ? E_INVALIDARG : Lease(progid.c_str(), &disp);
+    if FAILED(hrcode) {
+        isolate->ThrowException(DispError(isolate, hrcode, L"PoolLease", progid.c_str()));
+        return;
+    }
+    DispInfoPtr ptr(DispInfo::Create(disp, progid, option_async | option_type | option_leased));
+    args.GetReturnValue().Set(DispObject::NodeCreate(isolate, Local<Object>(), ptr, progid));
+}
+
+void InstancePool::NodeRelease(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    DispObject *self = (args.Length() > 0) ? DispObject::Cast(args[0]) : nullptr;
+    if (!self) {
+        isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+        return;
+    }
+    bool released = self->release();
+    args.GetReturnValue().Set(Boolean::New(isolate, released));
+}
+
+//-------------------------------------------------------------------------------------------------------
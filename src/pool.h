@@ -0,0 +1,50 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: InstancePool class declarations. Pool of pre-warmed automation server instances per ProgID,
+//              instances are leased to script and returned on release or garbage collection
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+class InstancePool {
+public:
+    struct options_t {
+        size_t min, max;    // max = 0 is unlimited
+        DWORD idle;         // idle time (ms) before eviction of instances above min, 0 is never
+    };
+
+    static HRESULT Configure(LPCOLESTR progid, const options_t &opt);
+    static HRESULT Lease(LPCOLESTR progid, IDispatch **disp);
+    static void Release(LPCOLESTR progid, IDispatch *disp);
+    static void Clear();
+
+    static void NodeInit(Handle<Object> target);
+
+private:
+    struct item_t {
+        CComPtr<IDispatch> disp;
+        DWORD released;
+    };
+    struct pool_t {
+        options_t opt;
+        std::vector<item_t> items;
+        size_t leased;
+        size_t created, evicted, failed;
+        inline pool_t() : leased(0), created(0), evicted(0), failed(0) { opt.min = opt.max = 0; opt.idle = 0; }
+    };
+    typedef std::map<std::wstring, pool_t> pools_t;
+    static thread_local pools_t pools; // Instances belong to apartment of the isolate thread
+
+    static HRESULT Create(LPCOLESTR progid, IDispatch **disp);
+    static bool Check(IDispatch *disp);
+    static void Evict(pool_t &pool);
+
+    static void NodePool(const FunctionCallbackInfo<Value> &args);
+    static void NodeLease(const FunctionCallbackInfo<Value> &args);
+    static void NodeRelease(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
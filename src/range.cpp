@@ -0,0 +1,330 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: RangeIO class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+//-------------------------------------------------------------------------------------------------------
+// Range helpers, executed on worker apartment
+
+HRESULT RangeIO::Count(IDispatch *range, LPOLESTR name, LONG *count) {
+	CComPtr<IDispatch> items;
+	HRESULT hrcode = DispGet(range, name, &items);
+	if (SUCCEEDED(hrcode) && !items) hrcode = DISP_E_TYPEMISMATCH;
+	if SUCCEEDED(hrcode) hrcode = DispGet(items, L"Count", count);
+	return hrcode;
+}
+
+HRESULT RangeIO::Tile(IDispatch *range, LONG row, LONG rows, LONG cols, IDispatch **tile) {
+
+	// range.Offset(row, 0).Resize(rows, cols)
+	CComPtr<IDispatch> offset;
+	HRESULT hrcode = DispGet(range, L"Offset", &offset, row, 0L);
+	if (SUCCEEDED(hrcode) && !offset) hrcode = DISP_E_TYPEMISMATCH;
+	if SUCCEEDED(hrcode) hrcode = DispGet(offset, L"Resize", tile, rows, cols);
+	if (SUCCEEDED(hrcode) && !*tile) hrcode = DISP_E_TYPEMISMATCH;
+	return hrcode;
+}
+
+void RangeIO::Read(const job_ptr &job) {
+	CComPtr<IDispatch> range;
+	HRESULT hrcode = job->range->Get(&range);
+	if (SUCCEEDED(hrcode) && !job->counted) {
+		hrcode = Count(range, L"Rows", &job->rows);
+		if SUCCEEDED(hrcode) hrcode = Count(range, L"Columns", &job->cols);
+		job->counted = true;
+	}
+	if (SUCCEEDED(hrcode) && !job->cancelled && job->next < job->rows) {
+
+		// Bounded read ahead, without free slot the read is parked until delivery of previous tile
+		InterlockedExchange(&job->parked, 1);
+		if (WaitForSingleObject(job->slots, 0) != WAIT_OBJECT_0) return;
+		if (InterlockedExchange(&job->parked, 0) != 1) {
+
+			// Delivery has posted the read again meanwhile, slot is left for it
+			ReleaseSemaphore(job->slots, 1, 0);
+			return;
+		}
+		tile_ptr tile(new tile_t);
+		tile->row = job->next;
+		tile->rows = std::min(job->tile, job->rows - job->next);
+		tile->hrcode = S_OK;
+		CComPtr<IDispatch> part;
+		hrcode = Tile(range, tile->row, tile->rows, job->cols, &part);
+		if SUCCEEDED(hrcode) hrcode = DispGet(part, L"Value2", &tile->values);
+
+		// Loop of the isolate is gone, nobody frees slots
+		if (SUCCEEDED(hrcode) && !job->queue->Post([job, tile]() { Deliver(job, tile); })) hrcode = RPC_E_DISCONNECTED;
+		job->next += tile->rows;
+		if (SUCCEEDED(hrcode) && job->next < job->rows) {
+			if (job->apartment->Post([job]() { Read(job); }, job->lane)) return;
+			hrcode = RPC_E_DISCONNECTED;
+		}
+	}
+	job->queue->Post([job, hrcode]() { Complete(job, hrcode); });
+}
+
+void RangeIO::Write(const job_ptr &job, const tile_ptr &tile) {
+	if (!job->cancelled) {
+		CComPtr<IDispatch> range, part;
+		HRESULT hrcode = job->range->Get(&range);
+		if SUCCEEDED(hrcode) hrcode = Tile(range, tile->row, tile->rows, job->cols, &part);
+		if SUCCEEDED(hrcode) hrcode = DispPut(part, L"Value2", tile->values);
+		tile->hrcode = hrcode;
+	}
+	job->queue->Post([job, tile]() { Deliver(job, tile); });
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Conversion, executed on the loop thread
+
+Local<Value> RangeIO::Rows(Isolate *isolate, SAFEARRAY *psa, LONG rows, LONG cols) {
+	VARIANT *data;
+	Local<v8::Array> result = v8::Array::New(isolate, rows);
+	if FAILED(SafeArrayAccessData(psa, (void**)&data)) return result;
+
+	// Array data is column major, first dimension is row
+	for (LONG r = 0; r < rows; r++) {
+		Local<v8::Array> row = v8::Array::New(isolate, cols);
+		for (LONG c = 0; c < cols; c++)
+			row->Set(c, Variant2Value(isolate, data[r + c * rows]));
+		result->Set(r, row);
+	}
+	SafeArrayUnaccessData(psa);
+	return result;
+}
+
+Local<Value> RangeIO::Columns(Isolate *isolate, SAFEARRAY *psa, LONG rows, LONG cols) {
+	VARIANT *data;
+	Local<v8::Array> result = v8::Array::New(isolate, cols);
+	if FAILED(SafeArrayAccessData(psa, (void**)&data)) return result;
+	for (LONG c = 0; c < cols; c++) {
+		VARIANT *column = data + c * rows;
+
+		// Numeric column with blanks is returned as Float64Array, blank is NaN
+		bool numeric = false;
+		LONG r;
+		for (r = 0; r < rows; r++) {
+			if (column[r].vt == VT_R8) numeric = true;
+			else if (column[r].vt != VT_EMPTY) break;
+		}
+		if (numeric && r == rows) {
+			Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, rows * sizeof(double));
+			double *values = (double*)buffer->GetContents().Data();
+			for (r = 0; r < rows; r++)
+				values[r] = (column[r].vt == VT_R8) ? column[r].dblVal : std::numeric_limits<double>::quiet_NaN();
+			result->Set(c, Float64Array::New(buffer, 0, rows));
+		}
+		else {
+			Local<v8::Array> items = v8::Array::New(isolate, rows);
+			for (r = 0; r < rows; r++)
+				items->Set(r, Variant2Value(isolate, column[r]));
+			result->Set(c, items);
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	return result;
+}
+
+void RangeIO::Convert(Isolate *isolate, const job_ptr &job, const tile_ptr &tile) {
+	SAFEARRAYBOUND bounds[2] = { { (ULONG)tile->rows, 1 }, { (ULONG)job->cols, 1 } };
+	SAFEARRAY *psa = SafeArrayCreate(VT_VARIANT, 2, bounds);
+	VARIANT *data;
+	if (!psa || FAILED(SafeArrayAccessData(psa, (void**)&data))) {
+		if (psa) SafeArrayDestroy(psa);
+		tile->hrcode = E_OUTOFMEMORY;
+		return;
+	}
+	Local<Object> values = Local<Object>::New(isolate, job->values);
+	for (LONG i = 0; i < (job->columns ? job->cols : tile->rows); i++) {
+		Local<Value> line = values->Get(job->columns ? i : tile->row + i);
+		if (!line->IsObject()) continue;
+		Local<Object> items = line->ToObject();
+		for (LONG j = 0; j < (job->columns ? tile->rows : job->cols); j++) {
+			Local<Value> val = items->Get(job->columns ? tile->row + j : j);
+
+			// NaN is written as blank cell, as it is read
+			if (val->IsNumber() && val->NumberValue() != val->NumberValue()) continue;
+			LONG r = job->columns ? j : i, c = job->columns ? i : j;
+			Value2Variant(val, data[r + c * tile->rows]);
+		}
+	}
+	SafeArrayUnaccessData(psa);
+	tile->values.vt = VT_ARRAY | VT_VARIANT;
+	tile->values.parray = psa;
+	tile->hrcode = S_OK;
+}
+
+void RangeIO::Schedule(const job_ptr &job) {
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	while (!job->cancelled && job->next < job->rows && job->pending < job->ahead) {
+		tile_ptr tile(new tile_t);
+		tile->row = job->next;
+		tile->rows = std::min(job->tile, job->rows - job->next);
+		Convert(isolate, job, tile);
+		if FAILED(tile->hrcode) {
+			Complete(job, tile->hrcode);
+			return;
+		}
+		job->next += tile->rows;
+		if (!job->apartment->Post([job, tile]() { Write(job, tile); }, job->lane)) {
+			Complete(job, RPC_E_DISCONNECTED);
+			return;
+		}
+		job->pending++;
+	}
+	if (!job->cancelled && job->pending == 0 && job->next >= job->rows) Complete(job, S_OK);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Completion, executed on the loop thread
+
+void RangeIO::Deliver(const job_ptr &job, const tile_ptr &tile) {
+
+	// Written tile, next tiles are converted while worker writes others
+	if (job->writing) {
+		job->pending--;
+		if (job->cancelled) return;
+		if FAILED(tile->hrcode) Complete(job, tile->hrcode);
+		else Schedule(job);
+		return;
+	}
+
+	// Read tile, slot is freed for worker read ahead and parked read continues
+	ReleaseSemaphore(job->slots, 1, 0);
+	if (InterlockedExchange(&job->parked, 0) == 1 && !job->apartment->Post([job]() { Read(job); }, job->lane)) {
+		Complete(job, RPC_E_DISCONNECTED);
+		return;
+	}
+	if (job->cancelled) return;
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	Local<Value> values;
+	if (tile->values.vt == (VT_ARRAY | VT_VARIANT) && SafeArrayGetDim(tile->values.parray) == 2) {
+		SAFEARRAY *psa = tile->values.parray;
+		LONG rows = psa->rgsabound[1].cElements, cols = psa->rgsabound[0].cElements; // Bounds are stored in reverse order
+		values = job->columns ? Columns(isolate, psa, rows, cols) : Rows(isolate, psa, rows, cols);
+	}
+	else {
+
+		// Single cell range returns value instead of array
+		Local<v8::Array> items = v8::Array::New(isolate, 1);
+		Local<v8::Array> item = v8::Array::New(isolate, 1);
+		item->Set(0, Variant2Value(isolate, tile->values, true));
+		items->Set(0, item);
+		values = items;
+	}
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "row"), Int32::New(isolate, tile->row));
+	result->Set(String::NewFromUtf8(isolate, "rows"), Int32::New(isolate, tile->rows));
+	result->Set(String::NewFromUtf8(isolate, "values"), values);
+	Local<Value> argv[] = { Null(isolate), result };
+	Local<Function> callback = Local<Function>::New(isolate, job->callback);
+	Local<Value> ret = node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(), callback, 2, argv);
+
+	// Callback returns false to stop reading
+	if (!ret.IsEmpty() && ret->IsFalse()) InterlockedExchange(&job->cancelled, 1);
+}
+
+void RangeIO::Complete(const job_ptr &job, HRESULT hrcode) {
+	bool cancelled = InterlockedExchange(&job->cancelled, 1) != 0;
+	LoopQueue::Unref();
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	Local<Function> callback = Local<Function>::New(isolate, job->callback);
+	job->callback.Reset();
+	job->values.Reset();
+	if (cancelled) return;
+	Local<Value> argv[] = { Null(isolate), Null(isolate) };
+	if FAILED(hrcode) argv[0] = Win32Error(isolate, hrcode, job->writing ? L"RangeWrite" : L"RangeRead");
+	node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(), callback, 2, argv);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void RangeIO::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "readRange", NodeRead);
+	NODE_SET_METHOD(target, "writeRange", NodeWrite);
+	NODE_DEBUG_MSG("RangeIO initialized");
+}
+
+RangeIO::job_ptr RangeIO::Prepare(const FunctionCallbackInfo<Value> &args, int callback_index) {
+	Isolate *isolate = args.GetIsolate();
+	CComPtr<IDispatch> disp;
+	if (args.Length() <= callback_index || !args[callback_index]->IsFunction() || FAILED(DispObject::GetDispatch(args[0], &disp))) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return job_ptr();
+	}
+
+	job_ptr job(new job_t);
+	job->callback.Reset(isolate, Local<Function>::Cast(args[callback_index]));
+	job->tile = 10000;
+	LONG ahead = 2;
+	int apartment = -1;
+	if (args[callback_index - 1]->IsObject()) {
+		Local<Object> opt = args[callback_index - 1]->ToObject();
+		Local<Value> val = opt->Get(String::NewFromUtf8(isolate, "tile"));
+		if (val->IsUint32() && val->Uint32Value() > 0) job->tile = (LONG)val->Uint32Value();
+		val = opt->Get(String::NewFromUtf8(isolate, "ahead"));
+		if (val->IsUint32() && val->Uint32Value() > 0) ahead = (LONG)val->Uint32Value();
+		val = opt->Get(String::NewFromUtf8(isolate, "apartment"));
+		if (val->IsUint32()) apartment = (int)val->Uint32Value();
+		job->columns = v8val2bool(opt->Get(String::NewFromUtf8(isolate, "columns")), false);
+		job->lane = Apartment::Lane(isolate, opt, lane_bulk);
+	}
+	job->slots = CreateSemaphore(0, ahead, ahead, 0);
+	job->ahead = ahead;
+	job->range.reset(new GlobalPtr(disp));
+	job->apartment = Apartment::Get(apartment);
+	job->queue = LoopQueue::Current();
+	HRESULT hrcode = job->slots ? job->range->Status() : HRESULT_FROM_WIN32(GetLastError());
+	if (SUCCEEDED(hrcode) && !job->apartment) hrcode = E_FAIL;
+	if FAILED(hrcode) {
+		isolate->ThrowException(Win32Error(isolate, hrcode, L"RangePrepare"));
+		return job_ptr();
+	}
+	return job;
+}
+
+void RangeIO::NodeRead(const FunctionCallbackInfo<Value> &args) {
+	job_ptr job = Prepare(args, 2);
+	if (!job) return;
+	LoopQueue::Ref();
+	auto rejected = [job](HRESULT hrcode) { job->queue->Post([job, hrcode]() { Complete(job, hrcode); }); };
+	HRESULT hrcode = job->apartment->Submit([job]() { Read(job); }, job->lane, rejected);
+	if FAILED(hrcode) rejected(hrcode);
+}
+
+void RangeIO::NodeWrite(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	if (args.Length() < 2 || !args[1]->IsObject()) {
+		isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+		return;
+	}
+	job_ptr job = Prepare(args, 3);
+	if (!job) return;
+
+	// Extent is defined by values, as array of rows or array of columns
+	Local<Object> values = args[1]->ToObject();
+	Local<String> length = String::NewFromUtf8(isolate, "length");
+	LONG count = (LONG)values->Get(length)->Int32Value();
+	LONG size = 0;
+	if (count > 0) {
+		Local<Value> first = values->Get(0);
+		if (first->IsObject()) size = (LONG)first->ToObject()->Get(length)->Int32Value();
+	}
+	job->rows = job->columns ? size : count;
+	job->cols = job->columns ? count : size;
+	job->values.Reset(isolate, values);
+	job->writing = true;
+	LoopQueue::Ref();
+	if (job->rows <= 0 || job->cols <= 0) job->queue->Post([job]() { Complete(job, S_OK); });
+	else Schedule(job);
+}
+
+//-------------------------------------------------------------------------------------------------------
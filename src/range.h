@@ -0,0 +1,64 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: RangeIO class declarations. Bulk read and write of large Excel ranges by row tiles,
+//              every tile is transferred with one Value2 call on worker apartment
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+class RangeIO {
+public:
+	static void NodeInit(Handle<Object> target);
+
+private:
+	struct job_t {
+		GlobalPtrPtr range;
+		ApartmentPtr apartment;
+		LoopQueuePtr queue;
+		int lane;
+		LONG tile;
+		LONG rows, cols;
+		bool columns, writing, counted;
+		HANDLE slots; // Tiles read ahead and not delivered yet
+		volatile LONG cancelled;
+		volatile LONG parked; // Read waits for free slot, delivery posts it again
+		Persistent<Function> callback;
+		Persistent<Object> values;
+		LONG next, pending, ahead; // Next tile of read or write, written tiles
+		job_t() : lane(lane_bulk), tile(0), rows(0), cols(0), columns(false), writing(false), counted(false), slots(0), cancelled(0), parked(0), next(0), pending(0), ahead(0) {}
+		~job_t() { if (slots) CloseHandle(slots); } // Last reference may be released by worker, handles are reset on completion
+
+	};
+	typedef std::shared_ptr<job_t> job_ptr;
+
+	struct tile_t {
+		LONG row, rows;
+		CComVariant values;
+		HRESULT hrcode;
+	};
+	typedef std::shared_ptr<tile_t> tile_ptr;
+
+	static HRESULT Count(IDispatch *range, LPOLESTR name, LONG *count);
+	static HRESULT Tile(IDispatch *range, LONG row, LONG rows, LONG cols, IDispatch **tile);
+
+	// Worker side, every tile is one task of the lane so other calls of the apartment run in between
+	static void Read(const job_ptr &job);
+	static void Write(const job_ptr &job, const tile_ptr &tile);
+
+	// Loop side
+	static void Deliver(const job_ptr &job, const tile_ptr &tile);
+	static void Complete(const job_ptr &job, HRESULT hrcode);
+	static void Convert(Isolate *isolate, const job_ptr &job, const tile_ptr &tile);
+	static void Schedule(const job_ptr &job);
+	static Local<Value> Rows(Isolate *isolate, SAFEARRAY *psa, LONG rows, LONG cols);
+	static Local<Value> Columns(Isolate *isolate, SAFEARRAY *psa, LONG rows, LONG cols);
+
+	static job_ptr Prepare(const FunctionCallbackInfo<Value> &args, int callback_index);
+	static void NodeRead(const FunctionCallbackInfo<Value> &args);
+	static void NodeWrite(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
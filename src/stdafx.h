@@ -19,10 +19,21 @@
 // STD headers
 #include <iostream>
 #include <stdio.h>
+#include <math.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#endif
 
 // Node JS headers
 #include <v8.h>
@@ -30,5 +41,6 @@
 #include <node_version.h>
 #include <node_object_wrap.h>
 #include <node_buffer.h>
+#include <uv.h>
 using namespace v8;
 using namespace node;
\ No newline at end of file
@@ -0,0 +1,356 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: TypeCache class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+TypeCache::entries_t TypeCache::entries;
+std::mutex TypeCache::locker;
+HANDLE TypeCache::hfile = INVALID_HANDLE_VALUE;
+HANDLE TypeCache::hmap = 0;
+const BYTE *TypeCache::view = 0;
+volatile LONG TypeCache::hits = 0;
+volatile LONG TypeCache::decoded = 0;
+volatile LONG TypeCache::described = 0;
+
+// Cache file layout: header { magic, version, count }, then count of entries { key, size, data }
+// Increment cache_version when layout of the entry data changed, files with other version are ignored
+const DWORD cache_magic = 0x5458414E; // NAXT
+const DWORD cache_version = 2;
+
+//-------------------------------------------------------------------------------------------------------
+
+template<typename T>
+inline void CacheWrite(std::vector<BYTE> &data, const T &value) {
+    const BYTE *ptr = (const BYTE*)&value;
+    data.insert(data.end(), ptr, ptr + sizeof(T));
+}
+
+inline void CacheWrite(std::vector<BYTE> &data, const void *value, size_t size) {
+    const BYTE *ptr = (const BYTE*)value;
+    if (size > 0) data.insert(data.end(), ptr, ptr + size);
+}
+
+struct CacheReader {
+    const BYTE *ptr, *end;
+    inline CacheReader(const BYTE *data, size_t size) : ptr(data), end(data + size) {}
+    inline bool read(void *value, size_t size) {
+        if ((size_t)(end - ptr) < size) return false;
+        if (size > 0) memcpy(value, ptr, size);
+        ptr += size;
+        return true;
+    }
+    template<typename T>
+    inline bool read(T &value) { return read(&value, sizeof(T)); }
+};
+
+//-------------------------------------------------------------------------------------------------------
+
+bool TypeCache::key_t::operator<(const key_t &k) const {
+    int rc = memcmp(&libid, &k.libid, sizeof(GUID));
+    if (rc != 0) return rc < 0;
+    if (index != k.index) return index < k.index;
+    if (lcid != k.lcid) return lcid < k.lcid;
+    if (major != k.major) return major < k.major;
+    return minor < k.minor;
+}
+
+HRESULT TypeCache::Describe(ITypeInfo *info, TypeDesc &desc) {
+    TYPEATTR *attr;
+    HRESULT hrcode = info->GetTypeAttr(&attr);
+    if FAILED(hrcode) return hrcode;
+    UINT cnt = attr->cFuncs;
+    info->ReleaseTypeAttr(attr);
+    CComBSTR name;
+    if (info->GetDocumentation(MEMBERID_NIL, &name, 0, 0, 0) == S_OK && name)
+        desc.name.assign(name, SysStringLen(name));
+
+    desc.funcs.resize(cnt);
+    for (UINT n = 0; n < cnt; n++) {
+        FUNCDESC *fdesc;
+        TypeFunc &func = desc.funcs[n];
+        if (info->GetFuncDesc(n, &fdesc) != S_OK) {
+            desc.funcs.resize(n);
+            break;
+        }
+        func.dispid = fdesc->memid;
+        func.invkind = fdesc->invkind;
+        func.argcnt = fdesc->cParams;
+        func.rettype = fdesc->elemdescFunc.tdesc.vt;
+        func.params.resize(fdesc->cParams);
+        for (SHORT i = 0; i < fdesc->cParams; i++)
+            func.params[i] = fdesc->lprgelemdescParam[i].tdesc.vt;
+        CComBSTR name;
+        UINT cnt_ret;
+        if (info->GetNames(fdesc->memid, &name, 1, &cnt_ret) == S_OK && cnt_ret > 0 && name)
+            func.name.assign(name, SysStringLen(name));
+        info->ReleaseFuncDesc(fdesc);
+    }
+    return S_OK;
+}
+
+TypeDescPtr TypeCache::Get(ITypeInfo *info) {
+    key_t key;
+    CComPtr<ITypeLib> lib;
+    TLIBATTR *libattr;
+    bool has_key = SUCCEEDED(info->GetContainingTypeLib(&lib, &key.index)) && SUCCEEDED(lib->GetLibAttr(&libattr));
+    if (has_key) {
+        key.libid = libattr->guid;
+        key.major = libattr->wMajorVerNum;
+        key.minor = libattr->wMinorVerNum;
+        key.lcid = libattr->lcid;
+        lib->ReleaseTLibAttr(libattr);
+
+        // Search in memory or in mapped file
+        std::lock_guard<std::mutex> lock(locker);
+        entries_t::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            entry_t &entry = it->second;
+            if (!entry.desc && entry.data) {
+                TypeDescPtr desc(new TypeDesc);
+                if (Decode(entry.data, entry.size, *desc)) {
+                    entry.desc = desc;
+                    InterlockedIncrement(&decoded);
+                }
+                entry.data = 0;
+            }
+            if (entry.desc) {
+                InterlockedIncrement(&hits);
+                return entry.desc;
+            }
+        }
+    }
+
+    TypeDescPtr desc(new TypeDesc);
+    if (FAILED(Describe(info, *desc)) || !has_key) return desc;
+    InterlockedIncrement(&described);
+
+    // Store and drop other versions of the same type
+    std::lock_guard<std::mutex> lock(locker);
+    for (entries_t::iterator it = entries.begin(); it != entries.end();) {
+        if (it->first.same_type(key)) it = entries.erase(it);
+        else ++it;
+    }
+    entry_t &entry = entries[key];
+    entry.desc = desc;
+    entry.data = 0;
+    entry.size = 0;
+    return desc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+bool TypeCache::Decode(const BYTE *data, size_t size, TypeDesc &desc) {
+    CacheReader reader(data, size);
+    DWORD cnt;
+    WORD typelen;
+    if (!reader.read(typelen)) return false;
+    desc.name.resize(typelen);
+    if (typelen > 0 && !reader.read(&desc.name[0], typelen * sizeof(wchar_t))) return false;
+    if (!reader.read(cnt)) return false;
+    desc.funcs.resize(cnt);
+    for (DWORD n = 0; n < cnt; n++) {
+        TypeFunc &func = desc.funcs[n];
+        LONG dispid;
+        WORD invkind, argcnt, rettype, namelen;
+        if (!reader.read(dispid) || !reader.read(invkind) || !reader.read(argcnt) || !reader.read(rettype) || !reader.read(namelen)) return false;
+        func.dispid = dispid;
+        func.invkind = invkind;
+        func.argcnt = argcnt;
+        func.rettype = rettype;
+        func.params.resize(argcnt);
+        func.name.resize(namelen);
+        if (argcnt > 0 && !reader.read(&func.params[0], argcnt * sizeof(VARTYPE))) return false;
+        if (namelen > 0 && !reader.read(&func.name[0], namelen * sizeof(wchar_t))) return false;
+    }
+    return true;
+}
+
+void TypeCache::Encode(const key_t &key, const TypeDesc &desc, std::vector<BYTE> &data) {
+    CacheWrite(data, key.libid);
+    CacheWrite(data, key.major);
+    CacheWrite(data, key.minor);
+    CacheWrite(data, (DWORD)key.lcid);
+    CacheWrite(data, (DWORD)key.index);
+    size_t offset = data.size();
+    CacheWrite(data, (DWORD)0);
+    CacheWrite(data, (WORD)desc.name.size());
+    CacheWrite(data, desc.name.c_str(), desc.name.size() * sizeof(wchar_t));
+    CacheWrite(data, (DWORD)desc.funcs.size());
+    for (const TypeFunc &func : desc.funcs) {
+        CacheWrite(data, (LONG)func.dispid);
+        CacheWrite(data, (WORD)func.invkind);
+        CacheWrite(data, (WORD)func.params.size());
+        CacheWrite(data, (WORD)func.rettype);
+        CacheWrite(data, (WORD)func.name.size());
+        CacheWrite(data, func.params.empty() ? 0 : &func.params[0], func.params.size() * sizeof(VARTYPE));
+        CacheWrite(data, func.name.c_str(), func.name.size() * sizeof(wchar_t));
+    }
+    DWORD size = (DWORD)(data.size() - offset - sizeof(DWORD));
+    memcpy(&data[offset], &size, sizeof(DWORD));
+}
+
+void TypeCache::Unmap() {
+    for (entries_t::iterator it = entries.begin(); it != entries.end();) {
+        if (!it->second.desc) it = entries.erase(it);
+        else (it++)->second.data = 0;
+    }
+    if (view) { UnmapViewOfFile(view); view = 0; }
+    if (hmap) { CloseHandle(hmap); hmap = 0; }
+    if (hfile != INVALID_HANDLE_VALUE) { CloseHandle(hfile); hfile = INVALID_HANDLE_VALUE; }
+}
+
+HRESULT TypeCache::Load(LPCOLESTR filename) {
+    std::lock_guard<std::mutex> lock(locker);
+    Unmap();
+
+    // Map file to memory, entries are decoded on first use
+    LARGE_INTEGER fsize;
+    hfile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (hfile == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    if (!GetFileSizeEx(hfile, &fsize) || fsize.QuadPart < (LONGLONG)(3 * sizeof(DWORD))) {
+        Unmap();
+        return S_FALSE;
+    }
+    hmap = CreateFileMappingW(hfile, 0, PAGE_READONLY, 0, 0, 0);
+    if (hmap) view = (const BYTE*)MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        HRESULT hrcode = HRESULT_FROM_WIN32(GetLastError());
+        Unmap();
+        return hrcode;
+    }
+
+    // Validate header, stale or foreign files are ignored
+    CacheReader reader(view, (size_t)fsize.QuadPart);
+    DWORD magic, version, cnt;
+    reader.read(magic);
+    reader.read(version);
+    reader.read(cnt);
+    if (magic != cache_magic || version != cache_version) {
+        Unmap();
+        return S_FALSE;
+    }
+
+    // Index entries, already described types are preferred
+    for (DWORD n = 0; n < cnt; n++) {
+        key_t key;
+        DWORD lcid, index, size;
+        if (!reader.read(key.libid) || !reader.read(key.major) || !reader.read(key.minor) ||
+            !reader.read(lcid) || !reader.read(index) || !reader.read(size)) break;
+        if ((size_t)(reader.end - reader.ptr) < size) break;
+        key.lcid = lcid;
+        key.index = index;
+        entry_t entry = { TypeDescPtr(), reader.ptr, size };
+        entries.insert(entries_t::value_type(key, entry));
+        reader.ptr += size;
+    }
+    return S_OK;
+}
+
+HRESULT TypeCache::Save(LPCOLESTR filename) {
+    std::lock_guard<std::mutex> lock(locker);
+    std::vector<BYTE> data;
+    DWORD cnt = 0;
+    CacheWrite(data, cache_magic);
+    CacheWrite(data, cache_version);
+    CacheWrite(data, cnt);
+    for (entries_t::value_type &it : entries) {
+        entry_t &entry = it.second;
+        if (!entry.desc && entry.data) {
+            TypeDescPtr desc(new TypeDesc);
+            if (Decode(entry.data, entry.size, *desc)) entry.desc = desc;
+            entry.data = 0;
+        }
+        if (!entry.desc) continue;
+        Encode(it.first, *entry.desc, data);
+        cnt++;
+    }
+    memcpy(&data[2 * sizeof(DWORD)], &cnt, sizeof(DWORD));
+
+    // Target file may be mapped by this process, release it and replace file atomically
+    Unmap();
+    std::wstring tmpname(filename);
+    tmpname += L".tmp";
+    HANDLE htmp = CreateFileW(tmpname.c_str(), GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (htmp == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+    DWORD written = 0;
+    BOOL ok = WriteFile(htmp, &data[0], (DWORD)data.size(), &written, 0) && written == data.size();
+    HRESULT hrcode = ok ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(htmp);
+    if (SUCCEEDED(hrcode) && !MoveFileExW(tmpname.c_str(), filename, MOVEFILE_REPLACE_EXISTING))
+        hrcode = HRESULT_FROM_WIN32(GetLastError());
+    if FAILED(hrcode) DeleteFileW(tmpname.c_str());
+    return hrcode;
+}
+
+void TypeCache::Clear() {
+    std::lock_guard<std::mutex> lock(locker);
+    for (entries_t::value_type &it : entries) it.second.desc.reset();
+    Unmap();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void TypeCache::NodeInit(Handle<Object> target) {
+    NODE_SET_METHOD(target, "loadTypeCache", NodeLoad);
+    NODE_SET_METHOD(target, "saveTypeCache", NodeSave);
+    NODE_SET_METHOD(target, "clearTypeCache", NodeClear);
+    NODE_SET_METHOD(target, "typeCacheStats", NodeStats);
+    NODE_DEBUG_MSG("TypeCache initialized");
+}
+
+void TypeCache::NodeLoad(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+        return;
+    }
+    String::Value filename(args[0]);
+    HRESULT hrcode = Load((LPCOLESTR)*filename);
+
+    // Missing file is not an error, cache will be filled by this process
+    if (hrcode == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)) hrcode = S_FALSE;
+    if FAILED(hrcode) {
+        isolate->ThrowException(Win32Error(isolate, hrcode, L"TypeCacheLoad", (LPCOLESTR)*filename));
+        return;
+    }
+    args.GetReturnValue().Set(Boolean::New(isolate, hrcode == S_OK));
+}
+
+void TypeCache::NodeSave(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+        return;
+    }
+    String::Value filename(args[0]);
+    HRESULT hrcode = Save((LPCOLESTR)*filename);
+    if FAILED(hrcode) {
+        isolate->ThrowException(Win32Error(isolate, hrcode, L"TypeCacheSave", (LPCOLESTR)*filename));
+    }
+}
+
+void TypeCache::NodeClear(const FunctionCallbackInfo<Value> &args) {
+    Clear();
+}
+
+void TypeCache::NodeStats(const FunctionCallbackInfo<Value> &args) {
+    Isolate *isolate = args.GetIsolate();
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(locker);
+        for (entries_t::value_type &it : entries) if (it.second.desc || it.second.data) count++;
+    }
+    Local<Object> result(Object::New(isolate));
+    result->Set(String::NewFromUtf8(isolate, "entries"), Number::New(isolate, (double)count));
+    result->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, (double)hits));
+    result->Set(String::NewFromUtf8(isolate, "decoded"), Number::New(isolate, (double)decoded));
+    result->Set(String::NewFromUtf8(isolate, "described"), Number::New(isolate, (double)described));
+    args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
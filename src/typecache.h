@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: TypeCache class declarations. Process wide cache of interface metadata (names, dispids,
+//              invoke kinds and parameter types) keyed by type library identity, optionally persisted
+//              to memory mapped file for fast cold start
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+struct TypeFunc {
+    DISPID dispid;
+    int invkind;
+    int argcnt;
+    VARTYPE rettype;
+    std::vector<VARTYPE> params;
+    std::wstring name;
+};
+
+class TypeDesc {
+public:
+    std::wstring name;
+    std::vector<TypeFunc> funcs;
+};
+
+typedef std::shared_ptr<TypeDesc> TypeDescPtr;
+
+//-------------------------------------------------------------------------------------------------------
+
+class TypeCache {
+public:
+
+    // Type identity: containing library guid, version, locale and type index inside library
+    struct key_t {
+        GUID libid;
+        WORD major, minor;
+        LCID lcid;
+        UINT index;
+        bool operator<(const key_t &k) const;
+        inline bool same_type(const key_t &k) const { return libid == k.libid && lcid == k.lcid && index == k.index; }
+    };
+
+    // Return cached description, type without library is described directly and not cached
+    static TypeDescPtr Get(ITypeInfo *info);
+
+    // Persistent storage
+    static HRESULT Load(LPCOLESTR filename);
+    static HRESULT Save(LPCOLESTR filename);
+    static void Clear();
+
+    // Counters: descriptions found in memory or file, decoded from file and described from type information
+    static volatile LONG hits, decoded, described;
+
+    static void NodeInit(Handle<Object> target);
+
+private:
+    static HRESULT Describe(ITypeInfo *info, TypeDesc &desc);
+
+    struct entry_t {
+        TypeDescPtr desc;
+        const BYTE *data;   // Not decoded entry inside mapped file
+        size_t size;
+    };
+    typedef std::map<key_t, entry_t> entries_t;
+    static entries_t entries;
+    static std::mutex locker;
+
+    // Mapped file view
+    static HANDLE hfile, hmap;
+    static const BYTE *view;
+    static void Unmap();
+    static bool Decode(const BYTE *data, size_t size, TypeDesc &desc);
+    static void Encode(const key_t &key, const TypeDesc &desc, std::vector<BYTE> &data);
+
+    static void NodeLoad(const FunctionCallbackInfo<Value> &args);
+    static void NodeSave(const FunctionCallbackInfo<Value> &args);
+    static void NodeClear(const FunctionCallbackInfo<Value> &args);
+    static void NodeStats(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
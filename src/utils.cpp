@@ -9,91 +9,496 @@
 
 //-------------------------------------------------------------------------------------------------------
 
+// System message text by error code, formatted once per process
+static std::map<HRESULT, std::wstring> error_messages;
+static std::mutex error_locker;
+
+static std::wstring GetSystemMessage(HRESULT hrcode) {
+	std::lock_guard<std::mutex> lock(error_locker);
+	std::map<HRESULT, std::wstring>::iterator it = error_messages.find(hrcode);
+	if (it != error_messages.end()) return it->second;
+	OLECHAR buf[1024];
+	DWORD len = FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, 0, hrcode, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), buf, sizeof(buf) / sizeof(OLECHAR), 0);
+	if (len == 0) len = swprintf_s(buf, sizeof(buf) / sizeof(OLECHAR), L"Error 0x%08X", hrcode);
+	std::wstring &text = error_messages[hrcode];
+	text.assign(buf, len);
+	return text;
+}
+
 Local<String> GetWin32ErroroMessage(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2, LPCOLESTR desc) {
-	uint16_t buf[1024], *bufptr = buf;
-	size_t len, buflen = (sizeof(buf) / sizeof(uint16_t)) - 1;
+	std::wstring text;
+	text.reserve(128);
 	if (msg) {
-		len = wcslen(msg);
-		if (len > buflen) len = buflen;
-		if (len > 0) memcpy(bufptr, msg, len * sizeof(uint16_t));
-		buflen -= len;
-		bufptr += len;
-		if (buflen > 1) {
-			bufptr[0] = ':';
-			bufptr[1] = ' ';
-			buflen -= 2;
-			bufptr += 2;
-		}
+		text += msg;
+		text += L": ";
 	}
 	if (msg2) {
-		len = wcslen(msg2);
-		if (len > buflen) len = buflen;
-		if (len > 0) memcpy(bufptr, msg2, len * sizeof(uint16_t));
-		buflen -= len;
-		bufptr += len;
-		if (buflen > 0) {
-			bufptr[0] = ' ';
-			buflen -= 1;
-			bufptr += 1;
-		}
-	}
-	if (buflen > 0) {
-		len = desc ? wcslen(desc) : 0;
-		if (len > 0) {
-			if (len >= buflen) len = buflen - 1;
-			memcpy(bufptr, desc, len * sizeof(OLECHAR));
-		}
-		else {
-			len = FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM, 0, hrcode, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPOLESTR)bufptr, buflen, 0);
-			if (len == 0) len = swprintf_s((LPOLESTR)bufptr, buflen, L"Error 0x%08X", hrcode);
+		text += msg2;
+		text += L" ";
+	}
+	if (desc && desc[0] != 0) text += desc;
+	else text += GetSystemMessage(hrcode);
+	return String::NewFromTwoByte(isolate, (uint16_t*)text.c_str(), String::kNormalString, (int)text.length());
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Error objects carry code and parts of message, text is formatted only when message is read
+
+static void ErrorMessageGet(Local<String> name, const PropertyCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	Local<Object> self = args.This();
+	HRESULT hrcode = (HRESULT)self->Get(String::NewFromUtf8(isolate, "hresult"))->Uint32Value();
+	Local<Value> parts[] = {
+		self->Get(String::NewFromUtf8(isolate, "operation")),
+		self->Get(String::NewFromUtf8(isolate, "member")),
+		self->Get(String::NewFromUtf8(isolate, "description"))
+	};
+	String::Value msg(parts[0]), msg2(parts[1]), desc(parts[2]);
+	args.GetReturnValue().Set(GetWin32ErroroMessage(isolate, hrcode,
+		parts[0]->IsString() ? (LPCOLESTR)*msg : 0,
+		parts[1]->IsString() ? (LPCOLESTR)*msg2 : 0,
+		parts[2]->IsString() ? (LPCOLESTR)*desc : 0));
+}
+
+static Local<Value> CreateError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2, LPCOLESTR desc, LPCOLESTR source) {
+	Local<Object> err = Exception::Error(String::Empty(isolate))->ToObject();
+	Local<String> message = String::NewFromUtf8(isolate, "message");
+	err->Delete(message);
+	err->SetAccessor(message, ErrorMessageGet);
+	err->Set(String::NewFromUtf8(isolate, "hresult"), Uint32::New(isolate, (uint32_t)hrcode));
+	if (msg) err->Set(String::NewFromUtf8(isolate, "operation"), String::NewFromTwoByte(isolate, (uint16_t*)msg));
+	if (msg2) err->Set(String::NewFromUtf8(isolate, "member"), String::NewFromTwoByte(isolate, (uint16_t*)msg2));
+	if (desc && desc[0] != 0) err->Set(String::NewFromUtf8(isolate, "description"), String::NewFromTwoByte(isolate, (uint16_t*)desc));
+	if (source && source[0] != 0) err->Set(String::NewFromUtf8(isolate, "source"), String::NewFromTwoByte(isolate, (uint16_t*)source));
+	return err;
+}
+
+Local<Value> Win32Error(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2) {
+	return CreateError(isolate, hrcode, msg, msg2, 0, 0);
+}
+
+Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2) {
+	std::wstring desc, source;
+	DispErrorInfo(desc, source);
+	return CreateError(isolate, hrcode, msg, msg2, desc.c_str(), source.c_str());
+}
+
+Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2, const std::wstring &desc, const std::wstring &source) {
+	return CreateError(isolate, hrcode, msg, msg2, desc.c_str(), source.c_str());
+}
+
+void DispErrorInfo(std::wstring &desc, std::wstring &source) {
+	CComPtr<IErrorInfo> errinfo;
+	if (GetErrorInfo(0, &errinfo) != S_OK || !errinfo) return;
+	CComBSTR bdesc, bsource;
+	if (SUCCEEDED(errinfo->GetDescription(&bdesc)) && bdesc) desc = (BSTR)bdesc;
+	if (SUCCEEDED(errinfo->GetSource(&bsource)) && bsource) source = (BSTR)bsource;
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+struct ClassKey {
+	CLSID clsid;
+	inline bool operator<(const ClassKey &k) const {
+		return memcmp(&clsid, &k.clsid, sizeof(CLSID)) < 0;
+	}
+};
+
+// Class object of the apartment, or error of in-process activation for classes registered only as local servers
+struct ClassFactory {
+	CComPtr<IClassFactory> ptr;
+	HRESULT hrcode;
+};
+
+static std::map<std::wstring, CLSID> class_ids;
+static std::mutex class_locker;
+static volatile LONG class_cache = 1;
+
+// Class objects belong to apartment of the thread, so factories are kept by the thread itself
+// and released by ClassClear before it uninitializes COM
+static thread_local std::map<ClassKey, ClassFactory> class_factories;
+
+bool ClassCache(int enable) {
+	if (enable < 0) return class_cache != 0;
+	return InterlockedExchange(&class_cache, enable ? 1 : 0) != 0;
+}
+
+HRESULT ClassFind(LPCOLESTR progid, CLSID *clsid) {
+	if (!class_cache) return CLSIDFromProgID(progid, clsid);
+	std::wstring key(progid);
+	{
+		std::lock_guard<std::mutex> lock(class_locker);
+		std::map<std::wstring, CLSID>::const_iterator it = class_ids.find(key);
+		if (it != class_ids.end()) {
+			*clsid = it->second;
+			return S_OK;
 		}
-		buflen -= len;
-		bufptr += len;
 	}
-	bufptr[0] = 0;
-	return String::NewFromTwoByte(isolate, buf);
+	HRESULT hrcode = CLSIDFromProgID(progid, clsid);
+	if SUCCEEDED(hrcode) {
+		std::lock_guard<std::mutex> lock(class_locker);
+		class_ids[key] = *clsid;
+	}
+	return hrcode;
+}
+
+HRESULT ClassCreate(REFCLSID clsid, DWORD context, IDispatch **disp) {
+	if (!class_cache || (context & CLSCTX_INPROC_SERVER) == 0) 
+		return CoCreateInstance(clsid, 0, context, __uuidof(IDispatch), (void**)disp);
+
+	// Only in-process factories are cached, holding factory of local server keeps server process alive 
+	// and may be registered as single use. Class without in-process server is remembered, so it is not asked again
+	ClassKey key = { clsid };
+	std::map<ClassKey, ClassFactory>::iterator it = class_factories.find(key);
+	if (it == class_factories.end()) {
+		ClassFactory factory;
+		factory.hrcode = CoGetClassObject(clsid, CLSCTX_INPROC_SERVER, 0, IID_IClassFactory, (void**)&factory.ptr);
+		if (FAILED(factory.hrcode) && factory.hrcode != CLASS_E_CLASSNOTAVAILABLE && factory.hrcode != REGDB_E_CLASSNOTREG)
+			return CoCreateInstance(clsid, 0, context, __uuidof(IDispatch), (void**)disp);
+		it = class_factories.insert(std::make_pair(key, factory)).first;
+	}
+	if FAILED(it->second.hrcode) {
+		context &= ~CLSCTX_INPROC_SERVER;
+		return (context != 0) ? CoCreateInstance(clsid, 0, context, __uuidof(IDispatch), (void**)disp) : it->second.hrcode;
+	}
+	HRESULT hrcode = it->second.ptr->CreateInstance(0, __uuidof(IDispatch), (void**)disp);
+	if SUCCEEDED(hrcode) return hrcode;
+	class_factories.erase(it);
+	return CoCreateInstance(clsid, 0, context, __uuidof(IDispatch), (void**)disp);
+}
+
+void ClassClear() {
+	class_factories.clear();
 }
 
 //-------------------------------------------------------------------------------------------------------
 
+static const double filetime_epoch = 11644473600000.0; // Milliseconds from 1601-01-01 to 1970-01-01
+
+static bool EpochToSystemTime(double ms, SYSTEMTIME &st) {
+	double ticks = (ms + filetime_epoch) * 10000.0;
+	if (!(ticks >= 0 && ticks < 9.2e18)) return false;
+	ULARGE_INTEGER li;
+	li.QuadPart = (ULONGLONG)ticks;
+	FILETIME ft = { li.LowPart, li.HighPart };
+	return FileTimeToSystemTime(&ft, &st) != FALSE;
+}
+
+static double SystemTimeToEpoch(const SYSTEMTIME &st) {
+	FILETIME ft;
+	if (!SystemTimeToFileTime(&st, &ft)) return 0;
+	ULARGE_INTEGER li;
+	li.LowPart = ft.dwLowDateTime;
+	li.HighPart = ft.dwHighDateTime;
+	return (double)li.QuadPart / 10000.0 - filetime_epoch;
+}
+
+// Offset from UTC to local time (or back from wall clock) by time zone rules of the year.
+// SYSTEMTIME starts at 1601, earlier times take offset of 1601
+static double LocalOffset(double ms, bool from_local) {
+	double t = floor(std::max(ms, 2 * 86400000.0 - filetime_epoch));
+	SYSTEMTIME st, converted;
+	if (!EpochToSystemTime(t, st)) return 0;
+	BOOL ok = from_local ? TzSpecificLocalTimeToSystemTime(0, &st, &converted) : SystemTimeToTzSpecificLocalTime(0, &st, &converted);
+	return ok ? SystemTimeToEpoch(converted) - t : 0;
+}
+
+double DateToEpoch(DATE date) {
+	double wall = DateToWallClock(date);
+	return wall + LocalOffset(wall, true);
+}
+
+DATE EpochToDate(double ms) {
+	return WallClockToDate(ms + LocalOffset(ms, false));
+}
+
+//-------------------------------------------------------------------------------------------------------
+
+static void SafeArrayFree(char *data, void *hint) {
+	SAFEARRAY *psa = (SAFEARRAY*)hint;
+	SafeArrayUnaccessData(psa);
+	SafeArrayDestroy(psa);
+}
+
+Local<Value> SafeArray2Buffer(Isolate *isolate, SAFEARRAY *psa) {
+	size_t size = psa->cbElements;
+	for (USHORT i = 0; i < psa->cDims; i++) size *= psa->rgsabound[i].cElements;
+	void *data = 0;
+	if (size == 0 || FAILED(SafeArrayAccessData(psa, &data))) {
+		SafeArrayDestroy(psa);
+		return Buffer::New(isolate, 0).ToLocalChecked();
+	}
+	MaybeLocal<Object> buf = Buffer::New(isolate, (char*)data, size, SafeArrayFree, psa);
+	if (buf.IsEmpty()) {
+		SafeArrayFree((char*)data, psa);
+		return Undefined(isolate);
+	}
+	return buf.ToLocalChecked();
+}
+
+// Only one dimensional byte arrays are returned as Buffer, multidimensional ones are nested arrays
+Local<Value> Variant2Value(Isolate *isolate, VARIANT &v, bool detach) {
+	if (detach && v.vt == (VT_ARRAY | VT_UI1) && v.parray && SafeArrayGetDim(v.parray) == 1) {
+		SAFEARRAY *psa = v.parray;
+		v.vt = VT_EMPTY;
+		v.parray = 0;
+		return SafeArray2Buffer(isolate, psa);
+	}
+	return Variant2Value(isolate, (const VARIANT&)v);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Variant conversion table. Converters are specialized by VARTYPE and take pointer to value, 
+// so scalar, byref and array element paths share them
+
+typedef Local<Value> (*ValueConverter)(Isolate *isolate, const void *data);
+
+template<VARTYPE vt> struct VarType {};
+template<> struct VarType<VT_I1> { typedef CHAR type; static inline Local<Value> Get(Isolate *isolate, type v) { return Int32::New(isolate, v); } };
+template<> struct VarType<VT_I2> { typedef SHORT type; static inline Local<Value> Get(Isolate *isolate, type v) { return Int32::New(isolate, v); } };
+template<> struct VarType<VT_I4> { typedef LONG type; static inline Local<Value> Get(Isolate *isolate, type v) { return Int32::New(isolate, v); } };
+template<> struct VarType<VT_INT> { typedef INT type; static inline Local<Value> Get(Isolate *isolate, type v) { return Int32::New(isolate, v); } };
+template<> struct VarType<VT_UI1> { typedef BYTE type; static inline Local<Value> Get(Isolate *isolate, type v) { return Uint32::New(isolate, v); } };
+template<> struct VarType<VT_UI2> { typedef USHORT type; static inline Local<Value> Get(Isolate *isolate, type v) { return Uint32::New(isolate, v); } };
+template<> struct VarType<VT_UI4> { typedef ULONG type; static inline Local<Value> Get(Isolate *isolate, type v) { return Uint32::New(isolate, v); } };
+template<> struct VarType<VT_UINT> { typedef UINT type; static inline Local<Value> Get(Isolate *isolate, type v) { return Uint32::New(isolate, v); } };
+template<> struct VarType<VT_I8> { typedef LONGLONG type; static inline Local<Value> Get(Isolate *isolate, type v) { return Number::New(isolate, (double)v); } };
+template<> struct VarType<VT_UI8> { typedef ULONGLONG type; static inline Local<Value> Get(Isolate *isolate, type v) { return Number::New(isolate, (double)v); } };
+template<> struct VarType<VT_R4> { typedef FLOAT type; static inline Local<Value> Get(Isolate *isolate, type v) { return Number::New(isolate, v); } };
+template<> struct VarType<VT_R8> { typedef DOUBLE type; static inline Local<Value> Get(Isolate *isolate, type v) { return Number::New(isolate, v); } };
+template<> struct VarType<VT_CY> { typedef CY type; static inline Local<Value> Get(Isolate *isolate, type v) { return Number::New(isolate, (double)v.int64 / 10000.0); } };
+template<> struct VarType<VT_DATE> { typedef DATE type; static inline Local<Value> Get(Isolate *isolate, type v) { return Date::New(isolate, DateToEpoch(v)); } };
+template<> struct VarType<VT_BOOL> { typedef VARIANT_BOOL type; static inline Local<Value> Get(Isolate *isolate, type v) { return Boolean::New(isolate, v != VARIANT_FALSE); } };
+template<> struct VarType<VT_BSTR> { typedef BSTR type; static inline Local<Value> Get(Isolate *isolate, type v) { return v ? Bstr2String(isolate, v, SysStringLen(v)) : String::Empty(isolate); } };
+template<> struct VarType<VT_ERROR> { typedef SCODE type; static inline Local<Value> Get(Isolate *isolate, type v) { return (v == DISP_E_PARAMNOTFOUND) ? (Local<Value>)Undefined(isolate) : Win32Error(isolate, v); } };
+template<> struct VarType<VT_DISPATCH> { typedef IDispatch *type; static inline Local<Value> Get(Isolate *isolate, type v) { return String::NewFromUtf8(isolate, "[Dispatch]"); } };
+template<> struct VarType<VT_VARIANT> { typedef VARIANT type; static inline Local<Value> Get(Isolate *isolate, const type &v) { return Variant2Value(isolate, v); } };
+template<> struct VarType<VT_DECIMAL> {
+	typedef DECIMAL type;
+	static inline Local<Value> Get(Isolate *isolate, const type &v) {
+		DOUBLE val;
+		return SUCCEEDED(VarR8FromDec(&v, &val)) ? (Local<Value>)Number::New(isolate, val) : (Local<Value>)Undefined(isolate);
+	}
+};
+
+template<VARTYPE vt>
+static Local<Value> ConvertValue(Isolate *isolate, const void *data) {
+	return VarType<vt>::Get(isolate, *(const typename VarType<vt>::type*)data);
+}
+
+static Local<Value> ConvertNull(Isolate *isolate, const void *data) { return Null(isolate); }
+static Local<Value> ConvertEmpty(Isolate *isolate, const void *data) { return Undefined(isolate); }
+
+static struct ValueConverters {
+	ValueConverter items[VT_UINT + 1];
+	ValueConverters() {
+		for (ValueConverter &item : items) item = ConvertEmpty;
+		items[VT_NULL] = ConvertNull;
+		items[VT_I1] = ConvertValue<VT_I1>;
+		items[VT_I2] = ConvertValue<VT_I2>;
+		items[VT_I4] = ConvertValue<VT_I4>;
+		items[VT_INT] = ConvertValue<VT_INT>;
+		items[VT_UI1] = ConvertValue<VT_UI1>;
+		items[VT_UI2] = ConvertValue<VT_UI2>;
+		items[VT_UI4] = ConvertValue<VT_UI4>;
+		items[VT_UINT] = ConvertValue<VT_UINT>;
+		items[VT_I8] = ConvertValue<VT_I8>;
+		items[VT_UI8] = ConvertValue<VT_UI8>;
+		items[VT_R4] = ConvertValue<VT_R4>;
+		items[VT_R8] = ConvertValue<VT_R8>;
+		items[VT_CY] = ConvertValue<VT_CY>;
+		items[VT_DATE] = ConvertValue<VT_DATE>;
+		items[VT_BOOL] = ConvertValue<VT_BOOL>;
+		items[VT_BSTR] = ConvertValue<VT_BSTR>;
+		items[VT_ERROR] = ConvertValue<VT_ERROR>;
+		items[VT_DISPATCH] = ConvertValue<VT_DISPATCH>;
+		items[VT_VARIANT] = ConvertValue<VT_VARIANT>;
+		items[VT_DECIMAL] = ConvertValue<VT_DECIMAL>;
+	}
+	inline ValueConverter operator[](VARTYPE vt) const { return (vt <= VT_UINT) ? items[vt] : ConvertEmpty; }
+} value_converters;
+
+//-------------------------------------------------------------------------------------------------------
+// String transcoding, most of strings are ASCII, so they are narrowed by 16 characters at once
+// and stop at the first character above Latin-1
+
+static size_t NarrowLatin1(const OLECHAR *src, size_t len, uint8_t *dst) {
+	size_t i = 0;
+#if defined(_M_X64) || defined(_M_IX86)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + i + 8));
+		__m128i high_bytes = _mm_srli_epi16(_mm_or_si128(lo, hi), 8);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bytes, zero)) != 0xFFFF) break;
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < len; i++) {
+		if (src[i] > 0xFF) break;
+		dst[i] = (uint8_t)src[i];
+	}
+	return i;
+}
+
+Local<String> Bstr2String(Isolate *isolate, const OLECHAR *str, UINT len) {
+	if (len == 0) return String::Empty(isolate);
+	uint8_t local[256];
+	std::unique_ptr<uint8_t[]> heap;
+	uint8_t *buf = local;
+	if (len > sizeof(local)) {
+		heap.reset(new uint8_t[len]);
+		buf = heap.get();
+	}
+	if (NarrowLatin1(str, len, buf) == len)
+		return String::NewFromOneByte(isolate, buf, String::kNormalString, (int)len);
+	return String::NewFromTwoByte(isolate, (const uint16_t*)str, String::kNormalString, (int)len);
+}
+
+BSTR String2Bstr(const Local<Value> &val) {
+	Local<String> str = val->ToString();
+	int len = str->Length();
+	if (len <= 0) return 0;
+
+	// One-byte strings are widened by V8 directly into BSTR buffer
+	BSTR result = SysAllocStringLen(0, (UINT)len);
+	if (result) str->Write((uint16_t*)result, 0, len, String::NO_NULL_TERMINATION);
+	return result;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Array kernels, one dimensional arrays of numbers are copied to typed arrays at once, dates and booleans
+// are converted into values and the array is created from them at once where V8 allows it
+
+template<class ARRAY>
+static Local<Value> CopyTypedArray(Isolate *isolate, const void *data, size_t count, size_t elsize) {
+	Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, count * elsize);
+	if (count > 0) memcpy(buffer->GetContents().Data(), data, count * elsize);
+	return ARRAY::New(buffer, 0, count);
+}
+
+static Local<Value> NewArray(Isolate *isolate, std::vector<Local<Value>> &values) {
+#if NODE_MAJOR_VERSION >= 10
+	return v8::Array::New(isolate, values.empty() ? nullptr : &values[0], values.size());
+#else
+	Local<v8::Array> result = v8::Array::New(isolate, (int)values.size());
+	for (size_t i = 0; i < values.size(); i++) result->Set((uint32_t)i, values[i]);
+	return result;
+#endif
+}
+
+// Time zone offset is looked up once per quarter of hour of wall clock, zone transitions are at whole quarters
+static Local<Value> ConvertDates(Isolate *isolate, const DATE *data, size_t count) {
+	static const double quarter = 15 * 60000.0;
+	std::unordered_map<double, double> offsets;
+	double last = NAN, offset = 0;
+	std::vector<Local<Value>> values(count);
+	for (size_t i = 0; i < count; i++) {
+		double wall = DateToWallClock(data[i]), key = floor(wall / quarter);
+		if (key != last) {
+			auto it = offsets.find(key);
+			if (it != offsets.end()) offset = it->second;
+			else offsets.emplace(key, offset = LocalOffset(wall, true));
+			last = key;
+		}
+		values[i] = Date::New(isolate, wall + offset);
+	}
+	return NewArray(isolate, values);
+}
+
+static Local<Value> ConvertBools(Isolate *isolate, const VARIANT_BOOL *data, size_t count) {
+	Local<Value> constants[] = { Boolean::New(isolate, false), Boolean::New(isolate, true) };
+	std::vector<Local<Value>> values(count);
+	for (size_t i = 0; i < count; i++) values[i] = constants[data[i] != VARIANT_FALSE];
+	return NewArray(isolate, values);
+}
+
+// Nested arrays, first index is outer, first dimension varies fastest in array data
+static Local<Value> ConvertDimension(Isolate *isolate, ValueConverter convert, const BYTE *data, size_t elsize, const std::vector<size_t> &counts, const std::vector<size_t> &strides, size_t dim) {
+	size_t count = counts[dim];
+	Local<v8::Array> result = v8::Array::New(isolate, (int)count);
+	for (size_t i = 0; i < count; i++) {
+		const BYTE *item = data + i * strides[dim] * elsize;
+		result->Set((uint32_t)i, (dim + 1 < counts.size()) ? ConvertDimension(isolate, convert, item, elsize, counts, strides, dim + 1) : convert(isolate, item));
+	}
+	return result;
+}
+
+Local<Value> SafeArray2Value(Isolate *isolate, SAFEARRAY *psa, VARTYPE vt) {
+	void *data;
+	if (!psa || psa->cDims == 0 || FAILED(SafeArrayAccessData(psa, &data))) return Undefined(isolate);
+
+	// Bounds are stored in reverse order
+	std::vector<size_t> counts(psa->cDims), strides(psa->cDims);
+	size_t total = 1;
+	for (USHORT d = 0; d < psa->cDims; d++) {
+		counts[d] = psa->rgsabound[psa->cDims - d - 1].cElements;
+		strides[d] = total;
+		total *= counts[d];
+	}
+
+	Local<Value> result;
+	if (psa->cDims == 1) switch (vt) {
+	case VT_I1: result = CopyTypedArray<Int8Array>(isolate, data, total, sizeof(CHAR)); break;
+	case VT_I2: result = CopyTypedArray<Int16Array>(isolate, data, total, sizeof(SHORT)); break;
+	case VT_I4: case VT_INT: result = CopyTypedArray<Int32Array>(isolate, data, total, sizeof(LONG)); break;
+	case VT_UI2: result = CopyTypedArray<Uint16Array>(isolate, data, total, sizeof(USHORT)); break;
+	case VT_UI4: case VT_UINT: result = CopyTypedArray<Uint32Array>(isolate, data, total, sizeof(ULONG)); break;
+	case VT_R4: result = CopyTypedArray<Float32Array>(isolate, data, total, sizeof(FLOAT)); break;
+	case VT_R8: result = CopyTypedArray<Float64Array>(isolate, data, total, sizeof(DOUBLE)); break;
+	case VT_DATE: result = ConvertDates(isolate, (const DATE*)data, total); break;
+	case VT_BOOL: result = ConvertBools(isolate, (const VARIANT_BOOL*)data, total); break;
+	}
+	if (result.IsEmpty()) result = ConvertDimension(isolate, value_converters[vt], (const BYTE*)data, psa->cbElements, counts, strides, 0);
+	SafeArrayUnaccessData(psa);
+	return result;
+}
+
 Local<Value> Variant2Value(Isolate *isolate, const VARIANT &v) {
 	VARTYPE vt = (v.vt & VT_TYPEMASK);
 	bool by_ref = (v.vt & VT_BYREF) != 0;
-	switch (vt) {
-	case VT_NULL:
-		return Null(isolate);
-	case VT_I1:
-	case VT_I2:
-	case VT_I4:
-	case VT_INT:
-		return Int32::New(isolate, by_ref ? *v.plVal : v.lVal);
-	case VT_UI1:
-	case VT_UI2:
-	case VT_UI4:
-	case VT_UINT:
-		return Uint32::New(isolate, by_ref ? *v.pulVal : v.ulVal);
-	case VT_R4:
-		return Number::New(isolate, by_ref ? *v.pfltVal : v.fltVal);
-	case VT_R8:
-		return Number::New(isolate, by_ref ? *v.pdblVal : v.dblVal);
-	case VT_DATE:
-		return Date::New(isolate, by_ref ? *v.pdate : v.date);
-	case VT_BOOL:
-		return Boolean::New(isolate, (by_ref ? *v.pboolVal : v.boolVal) == VARIANT_TRUE);
-	case VT_DISPATCH:
-		return String::NewFromUtf8(isolate, "[Dispatch]");
-	case VT_BSTR:
-		return String::NewFromTwoByte(isolate, (uint16_t*)(by_ref ? *v.pbstrVal : v.bstrVal));
-	case VT_VARIANT: 
-		if (v.pvarVal) return Variant2Value(isolate, *v.pvarVal);
-	}
-	return Undefined(isolate);
-}
-
-void Value2Variant(Handle<Value> &val, VARIANT &var) {
+	if ((v.vt & VT_ARRAY) != 0) {
+		SAFEARRAY *psa = by_ref ? (v.pparray ? *v.pparray : 0) : v.parray, *copy = 0;
+		if (vt == VT_UI1 && psa && SafeArrayGetDim(psa) == 1 && SUCCEEDED(SafeArrayCopy(psa, &copy))) return SafeArray2Buffer(isolate, copy);
+		return SafeArray2Value(isolate, psa, vt);
+	}
+
+	// Decimal occupies whole variant, other values are stored in union or referenced
+	const void *data = by_ref ? v.byref : ((vt == VT_DECIMAL) ? (const void*)&v.decVal : (const void*)&v.lVal);
+	if (!data) return Undefined(isolate);
+	return value_converters[vt](isolate, data);
+}
+
+void Value2Variant(Handle<Value> &val, VARIANT &var, bool shared) {
 	if (val.IsEmpty() || val->IsUndefined()) {
 		var.vt = VT_EMPTY;
 	}
+	else if (Buffer::HasInstance(val)) {
+		char *data = Buffer::Data(val);
+		size_t size = Buffer::Length(val);
+		SAFEARRAY *psa = 0;
+
+		// Call arguments reference Buffer memory, array is static so data is never freed by callee
+		if (shared) {
+			if SUCCEEDED(SafeArrayAllocDescriptorEx(VT_UI1, 1, &psa)) {
+				psa->cbElements = 1;
+				psa->rgsabound[0].lLbound = 0;
+				psa->rgsabound[0].cElements = (ULONG)size;
+				psa->pvData = data;
+				psa->fFeatures |= FADF_STATIC | FADF_FIXEDSIZE;
+			}
+		}
+		else {
+			void *ptr;
+			psa = SafeArrayCreateVector(VT_UI1, 0, (ULONG)size);
+			if (psa && size > 0 && SUCCEEDED(SafeArrayAccessData(psa, &ptr))) {
+				memcpy(ptr, data, size);
+				SafeArrayUnaccessData(psa);
+			}
+		}
+		var.vt = psa ? (VT_ARRAY | VT_UI1) : VT_EMPTY;
+		var.parray = psa;
+	}
 	else if (val->IsNull()) {
 		var.vt = VT_NULL;
 	}
@@ -111,7 +516,7 @@ void Value2Variant(Handle<Value> &val, VARIANT &var) {
 	}
 	else if (val->IsDate()) {
 		var.vt = VT_DATE;
-		var.date = val->NumberValue();
+		var.date = EpochToDate(val->NumberValue());
 	}
 	else if (val->IsBoolean()) {
 		var.vt = VT_BOOL;
@@ -123,38 +528,491 @@ void Value2Variant(Handle<Value> &val, VARIANT &var) {
 		var.pdispVal->AddRef();
 	}
 	else {
-		String::Value str(val);
 		var.vt = VT_BSTR;
-		var.bstrVal = (str.length() > 0) ? SysAllocString((LPOLESTR)*str) : 0;
+		var.bstrVal = String2Bstr(val);
+	}
+}
+
+bool VariantMarshal(VARIANT &arg) {
+	if ((arg.vt != VT_DISPATCH && arg.vt != VT_UNKNOWN) || !arg.punkVal) return false;
+	IStream *stream = 0;
+	HRESULT hrcode = CoMarshalInterThreadInterfaceInStream((arg.vt == VT_DISPATCH) ? IID_IDispatch : IID_IUnknown, arg.punkVal, &stream);
+	VariantClear(&arg);
+	if FAILED(hrcode) return false;
+	arg.vt = VT_UNKNOWN;
+	arg.punkVal = stream;
+	return true;
+}
+
+void VariantUnmarshal(VARIANT &arg) {
+	IStream *stream = (arg.vt == VT_UNKNOWN) ? (IStream*)arg.punkVal : 0;
+	IDispatch *disp = 0;
+	arg.vt = VT_EMPTY;
+	arg.punkVal = 0;
+	if (stream && SUCCEEDED(CoGetInterfaceAndReleaseStream(stream, IID_IDispatch, (void**)&disp))) {
+		arg.vt = VT_DISPATCH;
+		arg.pdispVal = disp;
+	}
+}
+
+void VariantMarshalRelease(VARIANT &arg) {
+	if (arg.vt != VT_UNKNOWN || !arg.punkVal) return;
+	LARGE_INTEGER zero = { 0 };
+	IStream *stream = (IStream*)arg.punkVal;
+	stream->Seek(zero, STREAM_SEEK_SET, 0);
+	CoReleaseMarshalData(stream);
+	VariantClear(&arg);
+}
+
+bool IsAgile(IUnknown *unk) {
+	CComPtr<IMarshal> marshal;
+	if (!unk || FAILED(unk->QueryInterface(&marshal))) return false;
+	CLSID clsid;
+	HRESULT hrcode = marshal->GetUnmarshalClass(IID_IUnknown, unk, MSHCTX_INPROC, NULL, MSHLFLAGS_NORMAL, &clsid);
+	return SUCCEEDED(hrcode) && clsid == CLSID_InProcFreeMarshaler;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Pooled allocation and interned names
+
+volatile LONG64 BlockStats::slabs = 0;
+thread_local uint64_t BlockStats::blocks = 0;
+MemberName::table_t MemberName::table;
+std::mutex MemberName::locker;
+const std::wstring MemberName::empty;
+
+MemberName::table_t::value_type *MemberName::Intern(const std::wstring &str) {
+	std::lock_guard<std::mutex> lock(locker);
+	table_t::iterator it = table.find(str);
+	if (it == table.end()) it = table.insert(table_t::value_type(str, 0)).first;
+	InterlockedIncrement(&it->second);
+	return &*it;
+}
+
+void MemberName::Release() {
+	if (!entry) return;
+	table_t::value_type *released = entry;
+	entry = 0;
+
+	// Other references remain, no lock needed. Last one is dropped under lock, so Intern can not revive it meanwhile
+	LONG cnt = released->second;
+	while (cnt > 1) {
+		LONG prev = InterlockedCompareExchange(&released->second, cnt - 1, cnt);
+		if (prev == cnt) return;
+		cnt = prev;
+	}
+	std::lock_guard<std::mutex> lock(locker);
+	if (InterlockedDecrement(&released->second) != 0) return;
+	table_t::iterator it = table.find(released->first);
+	if (it != table.end()) table.erase(it);
+}
+
+size_t MemberName::Count() {
+	std::lock_guard<std::mutex> lock(locker);
+	return table.size();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// LoopQueue implemetation
+
+thread_local LoopQueuePtr LoopQueue::current;
+
+LoopQueue::LoopQueue(uv_loop_t *_loop) : loop(_loop), async(new uv_async_t), thread(GetCurrentThreadId()), refcnt(0) {
+	InitializeSListHead(&head);
+	uv_async_init(loop, async, Execute);
+	async->data = this;
+	uv_unref((uv_handle_t*)async);
+}
+
+LoopQueue::~LoopQueue() {
+	Close();
+}
+
+LoopQueuePtr LoopQueue::Init(uv_loop_t *loop) {
+	if (!current) current.reset(new LoopQueue(loop));
+	return current;
+}
+
+void LoopQueue::Close() {
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (!async) return;
+		uv_close((uv_handle_t*)async, [](uv_handle_t *handle) { delete (uv_async_t*)handle; });
+		async = 0;
+	}
+
+	// Tasks left are dropped, waiting senders are released
+	PSLIST_ENTRY list = Flush();
+	while (list) {
+		task_t *task = CONTAINING_RECORD(list, task_t, entry);
+		list = list->Next;
+		if (task->done) SetEvent(task->done);
+		else {
+			task->~task_t();
+			_aligned_free(task);
+		}
+	}
+	if (current.get() == this) current.reset();
+}
+
+bool LoopQueue::Post(const std::function<void()> &func) {
+	void *mem = _aligned_malloc(sizeof(task_t), MEMORY_ALLOCATION_ALIGNMENT);
+	if (!mem) return false;
+	task_t *task = new (mem) task_t;
+	task->func = func;
+	task->done = 0;
+
+	// Producers are serialized only with closing of the queue
+	std::lock_guard<std::mutex> lock(locker);
+	if (!async) {
+		task->~task_t();
+		_aligned_free(mem);
+		return false;
+	}
+	InterlockedPushEntrySList(&head, &task->entry);
+	uv_async_send(async);
+	return true;
+}
+
+bool LoopQueue::Send(const std::function<void()> &func) {
+	task_t task;
+	task.func = func;
+	task.done = CreateEvent(0, TRUE, FALSE, 0);
+	if (!task.done) return false;
+	{
+		std::lock_guard<std::mutex> lock(locker);
+		if (!async) {
+			CloseHandle(task.done);
+			return false;
+		}
+		InterlockedPushEntrySList(&head, &task.entry);
+		uv_async_send(async);
+	}
+
+	// Pump on STA thread, so server may call back while we wait
+	DWORD index;
+	if FAILED(CoWaitForMultipleHandles(0, INFINITE, 1, &task.done, &index))
+		WaitForSingleObject(task.done, INFINITE);
+	CloseHandle(task.done);
+	return true;
+}
+
+void LoopQueue::Ref() {
+	if (current && current->async && current->refcnt++ == 0) uv_ref((uv_handle_t*)current->async);
+}
+
+void LoopQueue::Unref() {
+	if (current && current->async && current->refcnt > 0 && --current->refcnt == 0) uv_unref((uv_handle_t*)current->async);
+}
+
+PSLIST_ENTRY LoopQueue::Flush() {
+
+	// List is LIFO, restore posting order
+	PSLIST_ENTRY entry = InterlockedFlushSList(&head), list = 0;
+	while (entry) {
+		PSLIST_ENTRY next = entry->Next;
+		entry->Next = list;
+		list = entry;
+		entry = next;
+	}
+	return list;
+}
+
+void LoopQueue::Execute(uv_async_t *handle) {
+	PSLIST_ENTRY list = ((LoopQueue*)handle->data)->Flush();
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+#if NODE_MAJOR_VERSION >= 10
+	// Microtasks queued by tasks run when the scope ends, as after other callbacks of the loop
+	node::CallbackScope callback_scope(isolate, Object::New(isolate), node::async_context{ 0, 0 });
+#endif
+	while (list) {
+		task_t *task = CONTAINING_RECORD(list, task_t, entry);
+		list = list->Next;
+		{
+			// Exception of the task is reported as uncaught, it is not left pending in the loop callback
+			TryCatch try_catch(isolate);
+			try_catch.SetVerbose(true);
+			task->func();
+		}
+		if (task->done) SetEvent(task->done);
+		else {
+			task->~task_t();
+			_aligned_free(task);
+		}
 	}
 }
 
 //-------------------------------------------------------------------------------------------------------
 // DispObjectImpl implemetation
 
-HRESULT STDMETHODCALLTYPE DispObjectImpl::GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId) {
-	if (cNames != 1 || !rgszNames[0]) return DISP_E_UNKNOWNNAME;
-	std::wstring name(rgszNames[0]);
+volatile LONG DispObjectImpl::count = 0;
+volatile LONG DispObjectImpl::direct = 0;
+
+HRESULT __stdcall DispObjectImpl::QueryInterface(REFIID qiid, void **ppvObject) {
+	if (qiid != IID_IMarshal) return UnknownImpl<IDispatch>::QueryInterface(qiid, ppvObject);
+	if (!free_threaded) return E_NOINTERFACE;
+
+	// Marshaler is inner object, it delegates other interfaces back to us and holds no reference
+	std::lock_guard<std::mutex> lock(locker);
+	if (!marshaler) {
+		HRESULT hrcode = CoCreateFreeThreadedMarshaler((IUnknown*)(IDispatch*)this, &marshaler);
+		if FAILED(hrcode) return hrcode;
+	}
+	return marshaler->QueryInterface(qiid, ppvObject);
+}
+
+ULONG __stdcall DispObjectImpl::Release() {
+	LONG cnt = InterlockedDecrement(&refcnt);
+	if (cnt != 0) return cnt;
+	if (GetCurrentThreadId() == thread) delete this;
+
+	// Handle may be reset only on the thread of its isolate, object is leaked when the isolate is gone
+	else if (queue) queue->Post([this]() { delete this; });
+	return 0;
+}
+
+DispObjectImpl::name_t &DispObjectImpl::Register(const std::wstring &name) {
 	name_ptr &ptr = names[name];
 	if (!ptr) {
 		ptr.reset(new name_t(dispid_next++, name));
 		index.insert(index_t::value_type(ptr->dispid, ptr));
 	}
-	*rgDispId = ptr->dispid;
+	return *ptr;
+}
+
+HRESULT STDMETHODCALLTYPE DispObjectImpl::GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId) {
+	if (cNames != 1 || !rgszNames[0]) return DISP_E_UNKNOWNNAME;
+	std::wstring name(rgszNames[0]);
+	std::lock_guard<std::mutex> lock(locker);
+	*rgDispId = Register(name).dispid;
 	return S_OK;
 }
 
+HRESULT STDMETHODCALLTYPE DispObjectImpl::GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo) {
+	if (!ppTInfo) return E_POINTER;
+	if (iTInfo != 0) return DISP_E_BADINDEX;
+
+	// Keys are read on the loop thread
+	HRESULT hrcode = S_OK;
+	if (!typeinfo) {
+		if (GetCurrentThreadId() == thread) hrcode = Describe();
+		else {
+			hrcode = RPC_E_DISCONNECTED;
+			queue->Send([&]() { hrcode = this->typeinfo ? S_OK : this->Describe(); });
+		}
+	}
+	if SUCCEEDED(hrcode) {
+		*ppTInfo = typeinfo;
+		(*ppTInfo)->AddRef();
+	}
+	return hrcode;
+}
+
+// Member of synthesized dispinterface, arguments and result are variants
+static HRESULT DescribeMember(ICreateTypeInfo *creator, UINT index, DISPID dispid, const std::wstring &name, INVOKEKIND kind, SHORT argcnt) {
+	std::vector<ELEMDESC> params(argcnt);
+	for (ELEMDESC &param : params) {
+		memset(&param, 0, sizeof(ELEMDESC));
+		param.tdesc.vt = VT_VARIANT;
+		param.paramdesc.wParamFlags = PARAMFLAG_FIN;
+	}
+	FUNCDESC desc;
+	memset(&desc, 0, sizeof(FUNCDESC));
+	desc.memid = dispid;
+	desc.funckind = FUNC_DISPATCH;
+	desc.invkind = kind;
+	desc.callconv = CC_STDCALL;
+	desc.cParams = argcnt;
+	desc.lprgelemdescParam = params.empty() ? 0 : &params.front();
+	desc.elemdescFunc.tdesc.vt = (kind == INVOKE_PROPERTYPUT) ? VT_VOID : VT_VARIANT;
+	HRESULT hrcode = creator->AddFuncDesc(index, &desc);
+
+	// Value parameter of property put has no name
+	std::vector<std::wstring> names(1, name);
+	if (kind == INVOKE_FUNC) for (SHORT i = 0; i < argcnt; i++) names.push_back(L"arg" + std::to_wstring(i));
+	std::vector<LPOLESTR> ptrs;
+	for (std::wstring &item : names) ptrs.push_back((LPOLESTR)item.c_str());
+	if SUCCEEDED(hrcode) hrcode = creator->SetFuncAndParamNames(index, &ptrs.front(), (UINT)ptrs.size());
+	return hrcode;
+}
+
+// Identity of synthesized type is hashed from its shape (member names, kinds, dispids and arguments),
+// so objects of the same shape share one type cache entry and the cache does not grow with objects
+struct ShapeHash {
+	uint64_t h[2];
+	inline ShapeHash() { h[0] = 14695981039346656037ULL; h[1] = 0x6c62272e07bb0142ULL; }
+	inline void Add(const void *data, size_t size) {
+		for (size_t i = 0; i < size; i++) for (uint64_t &v : h) { v ^= ((const BYTE*)data)[i]; v *= 1099511628211ULL; }
+	}
+	inline GUID Guid(BYTE salt) const {
+		GUID guid;
+		memcpy(&guid, h, sizeof(GUID));
+		guid.Data4[7] ^= salt;
+		guid.Data3 = (guid.Data3 & 0x0FFF) | 0x8000; // Version 8, custom
+		guid.Data4[0] = (guid.Data4[0] & 0x3F) | 0x80;
+		return guid;
+	}
+};
+
+HRESULT DispObjectImpl::Describe() {
+	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
+	Local<Object> self = obj.Get(isolate);
+	Context::Scope context_scope(self->CreationContext());
+
+	// Functions are methods, other keys are properties with get and put
+	struct member_t { DISPID dispid; std::wstring name; INVOKEKIND kind; SHORT argcnt; };
+	std::vector<member_t> members;
+	ShapeHash shape;
+	Local<v8::Array> keys = self->GetOwnPropertyNames();
+	Local<String> length = String::NewFromUtf8(isolate, "length");
+	std::lock_guard<std::mutex> lock(locker);
+	for (uint32_t i = 0; i < keys->Length(); i++) {
+		Local<Value> key = keys->Get(i);
+		if (!key->IsString()) continue;
+		String::Value vname(key);
+		name_t &info = Register(std::wstring((LPOLESTR)*vname, vname.length()));
+		Local<Value> val = self->Get(key);
+		member_t member = { info.dispid, info.name, INVOKE_PROPERTYGET, 0 };
+		if (val->IsFunction()) {
+			int argcnt = Local<Function>::Cast(val)->Get(length)->Int32Value();
+			info.kind = DISPATCH_METHOD;
+			member.kind = INVOKE_FUNC;
+			member.argcnt = (SHORT)std::min(std::max(argcnt, 0), 32);
+		}
+		else info.kind = DISPATCH_PROPERTYGET | DISPATCH_PROPERTYPUT;
+		shape.Add(&member.dispid, sizeof(DISPID));
+		shape.Add(member.name.c_str(), (member.name.size() + 1) * sizeof(wchar_t));
+		shape.Add(&member.kind, sizeof(INVOKEKIND));
+		shape.Add(&member.argcnt, sizeof(SHORT));
+		members.push_back(member);
+	}
+
+	// Library exists only in memory. Dispinterface derives from IDispatch of stdole
+	GUID libid = shape.Guid(0), iid = shape.Guid(1);
+	CComPtr<ICreateTypeLib2> lib;
+	CComPtr<ICreateTypeInfo> creator;
+	CComPtr<ITypeLib> stdole;
+	CComPtr<ITypeInfo> dispatch;
+	HREFTYPE href;
+	HRESULT hrcode = CreateTypeLib2(sizeof(void*) == 8 ? SYS_WIN64 : SYS_WIN32, L"node_activex.tlb", &lib);
+	if SUCCEEDED(hrcode) hrcode = lib->SetGuid(libid);
+	if SUCCEEDED(hrcode) hrcode = lib->CreateTypeInfo(L"JSObject", TKIND_DISPATCH, &creator);
+	if SUCCEEDED(hrcode) hrcode = creator->SetGuid(iid);
+	if SUCCEEDED(hrcode) hrcode = LoadRegTypeLib(IID_StdOle, STDOLE2_MAJORVERNUM, STDOLE2_MINORVERNUM, STDOLE2_LCID, &stdole);
+	if SUCCEEDED(hrcode) hrcode = stdole->GetTypeInfoOfGuid(IID_IDispatch, &dispatch);
+	if SUCCEEDED(hrcode) hrcode = creator->AddRefTypeInfo(dispatch, &href);
+	if SUCCEEDED(hrcode) hrcode = creator->AddImplType(0, href);
+	UINT count = 0;
+	for (size_t i = 0; SUCCEEDED(hrcode) && i < members.size(); i++) {
+		const member_t &member = members[i];
+		if (member.kind == INVOKE_FUNC) hrcode = DescribeMember(creator, count++, member.dispid, member.name, INVOKE_FUNC, member.argcnt);
+		else {
+			hrcode = DescribeMember(creator, count++, member.dispid, member.name, INVOKE_PROPERTYGET, 0);
+			if SUCCEEDED(hrcode) hrcode = DescribeMember(creator, count++, member.dispid, member.name, INVOKE_PROPERTYPUT, 1);
+		}
+	}
+	if SUCCEEDED(hrcode) hrcode = creator->LayOut();
+	if SUCCEEDED(hrcode) hrcode = creator->QueryInterface(IID_ITypeInfo, (void**)&typeinfo);
+	return hrcode;
+}
+
 HRESULT STDMETHODCALLTYPE DispObjectImpl::Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr) {
+
+	// Called from foreign thread, V8 is available only on the loop thread
+	if (GetCurrentThreadId() != thread) {
+		UINT argcnt = pDispParams ? pDispParams->cArgs : 0;
+		InterlockedIncrement(&direct);
+
+		// Void call is posted, arguments are copied and interfaces marshaled
+		if (!wait && !pVarResult) {
+			CComPtr<DispObjectImpl> self(this);
+			std::shared_ptr<std::vector<CComVariant>> args(new std::vector<CComVariant>(argcnt));
+			for (UINT i = 0; i < argcnt; i++) {
+				VariantCopyInd(&(*args)[i], &pDispParams->rgvarg[i]);
+				VariantMarshal((*args)[i]);
+			}
+			bool posted = queue->Post([self, args, dispIdMember, wFlags]() {
+				for (CComVariant &arg : *args) {
+					if (arg.vt == VT_UNKNOWN) VariantUnmarshal(arg);
+				}
+				DISPPARAMS params = { args->empty() ? 0 : &args->front(), 0, (UINT)args->size(), 0 };
+				self->Execute(dispIdMember, wFlags, &params, 0, 0);
+			});
+			return posted ? S_OK : RPC_E_DISCONNECTED;
+		}
+
+		// Caller is blocked, so its arguments are valid until completion.
+		// Interfaces belong to apartment of the caller, they are passed by marshal streams both ways
+		std::vector<CComVariant> marshaled;
+		for (UINT i = 0; i < argcnt; i++) {
+			VARIANT &arg = pDispParams->rgvarg[i];
+			if ((arg.vt == VT_DISPATCH || arg.vt == VT_UNKNOWN) && arg.punkVal) {
+				if (marshaled.empty()) marshaled.resize(argcnt);
+				VariantCopy(&marshaled[i], &arg);
+				VariantMarshal(marshaled[i]); // Cleared when failed
+			}
+		}
+		HRESULT hrcode = RPC_E_DISCONNECTED;
+		queue->Send([&]() {
+			DISPPARAMS params = pDispParams ? *pDispParams : DISPPARAMS{ 0, 0, 0, 0 };
+			std::vector<VARIANT> args;
+			if (!marshaled.empty()) {
+				args.assign(pDispParams->rgvarg, pDispParams->rgvarg + argcnt);
+				for (UINT i = 0; i < argcnt; i++) {
+					if (args[i].vt != VT_DISPATCH && args[i].vt != VT_UNKNOWN) continue;
+					VariantUnmarshal(marshaled[i]);
+					args[i] = marshaled[i];
+				}
+				params.rgvarg = &args.front();
+			}
+			hrcode = this->Execute(dispIdMember, wFlags, &params, pVarResult, pExcepInfo);
+			if (SUCCEEDED(hrcode) && pVarResult) VariantMarshal(*pVarResult);
+		});
+		for (CComVariant &arg : marshaled) VariantMarshalRelease(arg); // Not received when queue is closed
+		if (SUCCEEDED(hrcode) && pVarResult && pVarResult->vt == VT_UNKNOWN) VariantUnmarshal(*pVarResult);
+		return hrcode;
+	}
+	return Execute(dispIdMember, wFlags, pDispParams, pVarResult, pExcepInfo);
+}
+
+HRESULT DispObjectImpl::Execute(DISPID dispIdMember, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo) {
 	Isolate *isolate = Isolate::GetCurrent();
+	HandleScope scope(isolate);
 	Local<Object> self = obj.Get(isolate);
+	Context::Scope context_scope(self->CreationContext());
+#if NODE_MAJOR_VERSION >= 10
+	// Nested scope does not run microtasks, outermost one runs them when the handler returns
+	node::CallbackScope callback_scope(isolate, self, node::async_context{ 0, 0 });
+#endif
+	TryCatch try_catch(isolate);
+	try_catch.SetVerbose(pExcepInfo == nullptr);
+	HRESULT hrcode = Execute(isolate, self, dispIdMember, wFlags, pDispParams, pVarResult);
+	if (!try_catch.HasCaught()) return hrcode;
+	if (pVarResult) VariantClear(pVarResult);
+	if (pExcepInfo) {
+		String::Value message(try_catch.Exception());
+		memset(pExcepInfo, 0, sizeof(EXCEPINFO));
+		pExcepInfo->bstrSource = SysAllocString(L"JavaScript");
+		if (*message) pExcepInfo->bstrDescription = SysAllocStringLen((LPOLESTR)*message, message.length());
+		pExcepInfo->scode = DISP_E_EXCEPTION;
+	}
+	return DISP_E_EXCEPTION;
+}
+
+HRESULT DispObjectImpl::Execute(Isolate *isolate, const Local<Object> &self, DISPID dispIdMember, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult) {
 	Local<Value> name, val, ret;
+	WORD kind = 0;
 
 	// Prepare name by member id
 	if (dispIdMember != DISPID_VALUE) {
+		std::lock_guard<std::mutex> lock(locker);
 		index_t::const_iterator p = index.find(dispIdMember);
 		if (p == index.end()) return DISP_E_MEMBERNOTFOUND;
 		name_t &info = *p->second;
 		name = String::NewFromTwoByte(isolate, (uint16_t*)info.name.c_str());
+		kind = info.kind;
 	}
 
 	// Set property value
@@ -197,6 +1055,7 @@ HRESULT STDMETHODCALLTYPE DispObjectImpl::Invoke(DISPID dispIdMember, REFIID rii
 	// Prepare property item
 	if (name.IsEmpty()) val = self;
 	else val = self->Get(name);
+	if (val.IsEmpty()) return DISP_E_EXCEPTION;
 
 	// Call property as method
 	if ((wFlags & DISPATCH_METHOD) != 0) {
@@ -204,7 +1063,9 @@ HRESULT STDMETHODCALLTYPE DispObjectImpl::Invoke(DISPID dispIdMember, REFIID rii
 		NodeArguments args(isolate, pDispParams);
 		int argcnt = (int)args.items.size();
 		Local<Value> *argptr = (argcnt > 0) ? &args.items[0] : nullptr;
-		if (val->IsFunction()) {
+
+		// Described property is not called even when its value became function, late bound member is called when it is function
+		if (val->IsFunction() && kind != (DISPATCH_PROPERTYGET | DISPATCH_PROPERTYPUT)) {
 			Local<Function> func = Local<Function>::Cast(val);
 			if (func.IsEmpty()) return DISP_E_BADCALLEE;
 			ret = func->Call(self, argcnt, argptr);
@@ -235,8 +1096,8 @@ HRESULT STDMETHODCALLTYPE DispObjectImpl::Invoke(DISPID dispIdMember, REFIID rii
 		}
 	}
 
-	// Store result
-	if (pVarResult) {
+	// Store result, empty when getter or handler has thrown
+	if (pVarResult && !ret.IsEmpty()) {
 		Value2Variant(ret, *pVarResult);
 	}
 	return S_OK;
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include "dispcall.h"
+
 //-------------------------------------------------------------------------------------------------------
 
 #ifdef _DEBUG
@@ -77,7 +79,7 @@ public:
     T *p;
     inline CComPtr() : p(0) {}
     inline CComPtr(T *_p) : p(0) { Attach(_p); }
-    inline CComPtr(const CComPtr<T> &ppt) : p(0) { if (ptr.p) Attach(ptr.p); }
+    inline CComPtr(const CComPtr<T> &ptr) : p(0) { if (ptr.p) Attach(ptr.p); }
     inline ~CComPtr() { Release(); }
 
     inline void Attach(T *_p) { Release(); p = _p; if (p) p->AddRef(); }
@@ -95,6 +97,10 @@ public:
         if (p != _p) Attach(_p);
         return p;
     }
+    inline T* operator = (const CComPtr<T> &ptr) {
+        if (p != ptr.p) Attach(ptr.p);
+        return p;
+    }
 
     inline HRESULT CoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter = NULL, DWORD dwClsContext = CLSCTX_ALL) {
         Release();
@@ -115,17 +121,13 @@ public:
 
 Local<String> GetWin32ErroroMessage(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2 = 0, LPCOLESTR desc = 0);
 
-inline Local<Value> Win32Error(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg = 0, LPCOLESTR msg2 = 0) {
-    return Exception::Error(GetWin32ErroroMessage(isolate, hrcode, msg, msg2));
-}
+// Error carries hresult, operation, member and server description and source, message is formatted when read
+Local<Value> Win32Error(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg = 0, LPCOLESTR msg2 = 0);
+Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg = 0, LPCOLESTR msg2 = 0);
+Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg, LPCOLESTR msg2, const std::wstring &desc, const std::wstring &source);
 
-inline Local<Value> DispError(Isolate *isolate, HRESULT hrcode, LPCOLESTR msg = 0, LPCOLESTR msg2 = 0) {
-    CComBSTR desc;
-    CComPtr<IErrorInfo> errinfo;
-    HRESULT hr = GetErrorInfo(0, &errinfo);
-    if (hr == S_OK) errinfo->GetDescription(&desc);
-	return Exception::Error(GetWin32ErroroMessage(isolate, hrcode, msg, msg2, desc));
-}
+// Description and source of the last error of the thread, taken on other thread and reported on the loop
+void DispErrorInfo(std::wstring &desc, std::wstring &source);
 
 inline Local<Value> TypeError(Isolate *isolate, const char *msg) {
     return Exception::TypeError(String::NewFromUtf8(isolate, msg));
@@ -136,32 +138,34 @@ inline Local<Value> Error(Isolate *isolate, const char *msg) {
 }
 
 //-------------------------------------------------------------------------------------------------------
+// ProgID resolution and in-process class factories are cached, creation of short-lived objects 
+// skips registry lookup and class object activation
 
-inline HRESULT DispFind(IDispatch *disp, LPOLESTR name, DISPID *dispid) {
-	LPOLESTR names[] = { name };
-	return disp->GetIDsOfNames(GUID_NULL, names, 1, 0, dispid);
-}
+HRESULT ClassFind(LPCOLESTR progid, CLSID *clsid);
+HRESULT ClassCreate(REFCLSID clsid, DWORD context, IDispatch **disp);
+void ClassClear(); // Cached factories of the calling thread apartment, released before COM is uninitialized
+bool ClassCache(int enable = -1); // Enables or disables caches process wide, returns previous state
 
-inline HRESULT DispInvoke(IDispatch *disp, DISPID dispid, UINT argcnt = 0, VARIANT *args = 0, VARIANT *ret = 0, WORD  flags = DISPATCH_METHOD) {
-	DISPPARAMS params = { args, 0, argcnt, 0 };
-	DISPID dispidNamed = DISPID_PROPERTYPUT;
-	if (flags == DISPATCH_PROPERTYPUT) { // It`s is a magic
-		params.cNamedArgs = 1;
-		params.rgdispidNamedArgs = &dispidNamed;
-	}
-	return disp->Invoke(dispid, IID_NULL, 0, flags, &params, ret, 0, 0);
+//-------------------------------------------------------------------------------------------------------
+
+// OLE date counts days from 1899-12-30, fraction is time of day also for negative dates.
+// Date has no zone, wall clock functions count its milliseconds as if it were UTC
+inline double DateToWallClock(DATE date) {
+	double days = (date < 0) ? ceil(date) : floor(date);
+	double linear = days + fabs(date - days);
+	return floor((linear - 25569.0) * 86400000.0 + 0.5);
 }
 
-inline HRESULT DispInvoke(IDispatch *disp, LPOLESTR name, UINT argcnt = 0, VARIANT *args = 0, VARIANT *ret = 0, WORD  flags = DISPATCH_METHOD, DISPID *dispid = 0) {
-	LPOLESTR names[] = { name };
-    DISPID dispids[] = { 0 };
-	HRESULT hrcode = disp->GetIDsOfNames(GUID_NULL, names, 1, 0, dispids);
-	if SUCCEEDED(hrcode) hrcode = DispInvoke(disp, dispids[0], argcnt, args, ret, flags);
-	if (dispid) *dispid = dispids[0];
-	return hrcode;
+inline DATE WallClockToDate(double ms) {
+	double linear = ms / 86400000.0 + 25569.0;
+	if (linear >= 0) return linear;
+	double days = floor(linear);
+	return days - (linear - days);
 }
 
-//-------------------------------------------------------------------------------------------------------
+// OLE date is local time, epoch of JS Date is UTC
+double DateToEpoch(DATE date);
+DATE EpochToDate(double ms);
 
 template<typename INTTYPE>
 inline INTTYPE Variant2nt(const VARIANT &v, const INTTYPE def) {
@@ -172,32 +176,63 @@ inline INTTYPE Variant2nt(const VARIANT &v, const INTTYPE def) {
     case VT_NULL:
         return def;
     case VT_I1:
+        return (INTTYPE)(by_ref ? *v.pcVal : v.cVal);
     case VT_I2:
+        return (INTTYPE)(by_ref ? *v.piVal : v.iVal);
     case VT_I4:
     case VT_INT:
         return (INTTYPE)(by_ref ? *v.plVal : v.lVal);
     case VT_UI1:
+        return (INTTYPE)(by_ref ? *v.pbVal : v.bVal);
     case VT_UI2:
+        return (INTTYPE)(by_ref ? *v.puiVal : v.uiVal);
     case VT_UI4:
     case VT_UINT:
         return (INTTYPE)(by_ref ? *v.pulVal : v.ulVal);
+    case VT_I8:
+        return (INTTYPE)(by_ref ? *v.pllVal : v.llVal);
+    case VT_UI8:
+        return (INTTYPE)(by_ref ? *v.pullVal : v.ullVal);
     case VT_R4:
         return (INTTYPE)(by_ref ? *v.pfltVal : v.fltVal);
     case VT_R8:
         return (INTTYPE)(by_ref ? *v.pdblVal : v.dblVal);
+    case VT_CY:
+        return (INTTYPE)((by_ref ? v.pcyVal->int64 : v.cyVal.int64) / 10000);
     case VT_DATE:
         return (INTTYPE)(by_ref ? *v.pdate : v.date);
     case VT_BOOL:
-        return (v.boolVal == VARIANT_TRUE) ? 1 : 0;
+        return ((by_ref ? *v.pboolVal : v.boolVal) != VARIANT_FALSE) ? 1 : 0;
 	case VT_VARIANT:
 		if (v.pvarVal) return Variant2nt<INTTYPE>(*v.pvarVal, def);
+		return def;
 	}
     VARIANT dst;
+    VariantInit(&dst);
     return SUCCEEDED(VariantChangeType(&dst, &v, 0, VT_INT)) ? (INTTYPE)dst.intVal : def;
 }
 
+// Strings of Latin-1 characters are created as one-byte V8 strings, others as two-byte strings
+Local<String> Bstr2String(Isolate *isolate, const OLECHAR *str, UINT len);
+
+// BSTR is allocated by length and filled by V8 with one write, empty string is null BSTR
+BSTR String2Bstr(const Local<Value> &val);
+
 Local<Value> Variant2Value(Isolate *isolate, const VARIANT &v);
-void Value2Variant(Handle<Value> &val, VARIANT &var);
+Local<Value> SafeArray2Value(Isolate *isolate, SAFEARRAY *psa, VARTYPE vt);
+void Value2Variant(Handle<Value> &val, VARIANT &var, bool shared = false);
+
+// Byte arrays are detached from variant and exposed as Buffer over locked array memory without copy
+Local<Value> Variant2Value(Isolate *isolate, VARIANT &v, bool detach);
+Local<Value> SafeArray2Buffer(Isolate *isolate, SAFEARRAY *psa);
+
+// Interfaces passed from other apartment are stored as marshal streams and restored on the loop thread
+bool VariantMarshal(VARIANT &arg);
+void VariantUnmarshal(VARIANT &arg);
+void VariantMarshalRelease(VARIANT &arg);
+
+// Objects aggregating free-threaded marshaler may be called from any apartment of the process without proxy
+bool IsAgile(IUnknown *unk);
 
 inline bool VariantDispGet(VARIANT *v, IDispatch **disp) {
 	if ((v->vt & VT_TYPEMASK) == VT_DISPATCH) {
@@ -236,7 +271,7 @@ public:
 		int argcnt = args.Length();
 		items.resize(argcnt);
 		for (int i = 0; i < argcnt; i ++)
-			Value2Variant(args[argcnt - i - 1], items[i]);
+			Value2Variant(args[argcnt - i - 1], items[i], true);
 	}
 };
 
@@ -254,6 +289,172 @@ public:
 
 //-------------------------------------------------------------------------------------------------------
 
+// Tasks posted from any thread to the loop thread through lock-free list and single async handle.
+// Every isolate loading the addon has its own queue, work of other threads keeps reference to queue of its loop
+
+class LoopQueue {
+public:
+	LoopQueue(uv_loop_t *loop);
+	~LoopQueue();
+
+	// Queue of the calling loop thread, created by Init and closed on environment cleanup
+	static std::shared_ptr<LoopQueue> Init(uv_loop_t *loop);
+	static inline std::shared_ptr<LoopQueue> Current() { return current; }
+	static inline bool IsLoopThread() { return (bool)current; }
+	inline uv_loop_t *Loop() { return loop; }
+	inline DWORD Thread() { return thread; }
+	void Close();
+
+	// Execute without waiting, false when queue is closed
+	bool Post(const std::function<void()> &func);
+
+	// Execute and wait completion, COM calls are dispatched while waiting on STA thread
+	bool Send(const std::function<void()> &func);
+
+	// Pending work of other threads keeps the loop alive, called on the loop thread
+	static void Ref();
+	static void Unref();
+
+private:
+	struct task_t {
+		SLIST_ENTRY entry;
+		std::function<void()> func;
+		HANDLE done;
+	};
+	SLIST_HEADER head;
+	uv_loop_t *loop;
+	uv_async_t *async;
+	DWORD thread;
+	LONG refcnt;
+	std::mutex locker;
+	static thread_local std::shared_ptr<LoopQueue> current;
+	static void Execute(uv_async_t *handle);
+	PSLIST_ENTRY Flush();
+};
+
+typedef std::shared_ptr<LoopQueue> LoopQueuePtr;
+
+//-------------------------------------------------------------------------------------------------------
+
+// Fixed size blocks carved from slabs and recycled through free list of the thread. Block released on other
+// thread only moves to the free list of that thread. Slabs are not returned to the heap, as their blocks may
+// live on other threads, free list of exited thread goes to the depot of the process and is taken by the next
+// thread which runs out of blocks, so slabs do not grow with threads started and stopped
+
+struct BlockStats {
+	static volatile LONG64 slabs; // Process wide
+	static thread_local uint64_t blocks;
+};
+
+template<size_t SIZE>
+class BlockPool {
+public:
+	static void *Alloc() {
+		block_t *block = local.head;
+		if (!block) block = Grow();
+		local.head = block->next;
+		BlockStats::blocks++;
+		return block;
+	}
+	static void Free(void *ptr) {
+		block_t *block = (block_t*)ptr;
+		block->next = local.head;
+		local.head = block;
+	}
+
+private:
+	union block_t {
+		block_t *next;
+		char data[(SIZE + 15) & ~(size_t)15];
+	};
+	struct list_t {
+		block_t *head;
+		~list_t() { // Thread exit
+			if (!head) return;
+			block_t *tail = head;
+			while (tail->next) tail = tail->next;
+			std::lock_guard<std::mutex> lock(locker);
+			tail->next = depot;
+			depot = head;
+			head = 0;
+		}
+	};
+	static const size_t slab_size = 256;
+	static thread_local list_t local;
+	static std::mutex locker;
+	static block_t *depot;
+	static block_t *Grow() {
+		{
+			std::lock_guard<std::mutex> lock(locker);
+			block_t *list = depot;
+			depot = 0;
+			if (list) return list;
+		}
+		block_t *slab = (block_t*)malloc(slab_size * sizeof(block_t));
+		if (!slab) throw std::bad_alloc();
+		for (size_t i = 0; i < slab_size - 1; i++) slab[i].next = &slab[i + 1];
+		slab[slab_size - 1].next = 0;
+		InterlockedIncrement64(&BlockStats::slabs);
+		return slab;
+	}
+};
+
+template<size_t SIZE>
+thread_local typename BlockPool<SIZE>::list_t BlockPool<SIZE>::local = {};
+
+template<size_t SIZE>
+std::mutex BlockPool<SIZE>::locker;
+
+template<size_t SIZE>
+typename BlockPool<SIZE>::block_t *BlockPool<SIZE>::depot = 0;
+
+// Allocator of single objects from block pool, used for shared_ptr control blocks and map nodes
+template<typename T>
+struct PoolAllocator {
+	typedef T value_type;
+	inline PoolAllocator() {}
+	template<typename U> inline PoolAllocator(const PoolAllocator<U> &) {}
+	inline T *allocate(size_t n) { return (n == 1) ? (T*)BlockPool<sizeof(T)>::Alloc() : (T*)::operator new(n * sizeof(T)); }
+	inline void deallocate(T *ptr, size_t n) { if (n == 1) BlockPool<sizeof(T)>::Free(ptr); else ::operator delete(ptr); }
+	template<typename U> inline bool operator==(const PoolAllocator<U> &) const { return true; }
+	template<typename U> inline bool operator!=(const PoolAllocator<U> &) const { return false; }
+};
+
+template<typename K, typename V>
+using pooled_map = std::map<K, V, std::less<K>, PoolAllocator<std::pair<const K, V>>>;
+
+// Interned name, equal names share one string. Table is process wide, because names may be released
+// on other threads than the loop thread. Copies only count references, lock is taken to add or remove names
+class MemberName {
+public:
+	inline MemberName() : entry(0) {}
+	inline MemberName(LPCOLESTR str) : entry(str ? Intern(str) : 0) {}
+	inline MemberName(const std::wstring &str) : entry(Intern(str)) {}
+	inline MemberName(const MemberName &src) : entry(src.entry) { if (entry) InterlockedIncrement(&entry->second); }
+	inline ~MemberName() { Release(); }
+	inline MemberName &operator=(const MemberName &src) {
+		if (src.entry) InterlockedIncrement(&src.entry->second);
+		Release();
+		entry = src.entry;
+		return *this;
+	}
+	inline const std::wstring &str() const { return entry ? entry->first : empty; }
+	inline operator const std::wstring &() const { return str(); }
+	inline LPCOLESTR c_str() const { return str().c_str(); }
+	static size_t Count();
+
+private:
+	typedef std::unordered_map<std::wstring, volatile LONG> table_t;
+	table_t::value_type *entry;
+	static table_t table;
+	static std::mutex locker;
+	static const std::wstring empty;
+	static table_t::value_type *Intern(const std::wstring &str);
+	void Release();
+};
+
+//-------------------------------------------------------------------------------------------------------
+
 template<typename IBASE = IUnknown>
 class UnknownImpl : public IBASE {
 public:
@@ -292,7 +493,8 @@ public:
 	struct name_t { 
 		DISPID dispid;
 		std::wstring name;
-		inline name_t(DISPID id, const std::wstring &nm): dispid(id), name(nm) {}
+		WORD kind; // Described as method or property, 0 for late bound member
+		inline name_t(DISPID id, const std::wstring &nm): dispid(id), name(nm), kind(0) {}
 	};
 	typedef std::shared_ptr<name_t> name_ptr;
 	typedef std::map<std::wstring, name_ptr> names_t;
@@ -301,14 +503,43 @@ public:
 	names_t names;
 	index_t index;
 
-	inline DispObjectImpl(const Local<Object> &_obj) : obj(Isolate::GetCurrent(), _obj), dispid_next(1) {}
-	virtual ~DispObjectImpl() { obj.Reset(); }
+	// Built on first request from own keys of the object, keys added later are late bound
+	CComPtr<ITypeInfo> typeinfo;
+
+	DWORD thread;
+	LoopQueuePtr queue;
+	bool wait, free_threaded;
+	std::mutex locker;
+
+	// Free-threaded marshaler is aggregated on request, so in-process callers of other apartments get direct pointer
+	// instead of proxy. Thread affinity is kept by Invoke, which waits for the loop thread, so the loop must not be
+	// blocked in a synchronous call to the caller, incoming calls of standard proxy are pumped by COM in that case
+	CComPtr<IUnknown> marshaler;
+
+	// Calls from foreign threads are executed on the loop thread, void calls are posted when wait is false
+	inline DispObjectImpl(const Local<Object> &_obj, bool _wait = true, bool _free_threaded = false) : obj(Isolate::GetCurrent(), _obj), dispid_next(1), thread(GetCurrentThreadId()), queue(LoopQueue::Current()), wait(_wait), free_threaded(_free_threaded) { InterlockedIncrement(&count); }
+	virtual ~DispObjectImpl() { obj.Reset(); InterlockedDecrement(&count); }
+
+	static volatile LONG count;
+	static volatile LONG direct; // Calls received on foreign threads without proxy
+
+	// IUnknown interface, last release is deferred to the loop thread
+	virtual HRESULT __stdcall QueryInterface(REFIID qiid, void **ppvObject);
+	virtual ULONG __stdcall Release();
 
 	// IDispatch interface
-	virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT *pctinfo) { *pctinfo = 0; return S_OK; }
-	virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo) { return E_NOTIMPL; }
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfoCount(UINT *pctinfo) { *pctinfo = 1; return S_OK; }
+	virtual HRESULT STDMETHODCALLTYPE GetTypeInfo(UINT iTInfo, LCID lcid, ITypeInfo **ppTInfo);
 	virtual HRESULT STDMETHODCALLTYPE GetIDsOfNames(REFIID riid, LPOLESTR *rgszNames, UINT cNames, LCID lcid, DISPID *rgDispId);
 	virtual HRESULT STDMETHODCALLTYPE Invoke(DISPID dispIdMember, REFIID riid, LCID lcid, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo, UINT *puArgErr);
+
+private:
+
+	// Exception of JS code is returned as DISP_E_EXCEPTION, without EXCEPINFO it is reported as uncaught
+	HRESULT Execute(DISPID dispIdMember, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult, EXCEPINFO *pExcepInfo);
+	HRESULT Execute(Isolate *isolate, const Local<Object> &self, DISPID dispIdMember, WORD wFlags, DISPPARAMS *pDispParams, VARIANT *pVarResult);
+	HRESULT Describe();
+	name_t &Register(const std::wstring &name);
 };
 
 //-------------------------------------------------------------------------------------------------------
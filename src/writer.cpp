@@ -0,0 +1,198 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: WriteBehind class implementations
+//-------------------------------------------------------------------------------------------------------
+
+#include "stdafx.h"
+#include "disp.h"
+
+thread_local WriteBehind::state_ptr WriteBehind::state;
+thread_local ApartmentPtr WriteBehind::apartment;
+
+//-------------------------------------------------------------------------------------------------------
+
+WriteTarget::~WriteTarget() {
+	if (!disp) return;
+	if (apartment->IsCurrent()) {
+		disp.Release();
+		return;
+	}
+
+	// Last reference dropped on other thread, proxy is released on its apartment. Stopped apartment 
+	// has disconnected its proxies already
+	IDispatch *ptr = disp.Detach();
+	apartment->Post([ptr]() { ptr->Release(); });
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Loop side
+
+WriteBehind::state_ptr &WriteBehind::State() {
+	if (!state) state.reset(new state_t());
+	return state;
+}
+
+bool WriteBehind::Accepts(IDispatch *disp) {
+	CComPtr<IClientSecurity> proxy;
+	return disp && SUCCEEDED(disp->QueryInterface(IID_IClientSecurity, (void**)&proxy));
+}
+
+HRESULT WriteBehind::Post(WriteTargetPtr &target, IDispatch *disp, DISPID dispid, WORD flags, std::vector<CComVariant> &args, LPCOLESTR member) {
+	if (!disp) return E_POINTER;
+
+	// Shared Buffer arguments reference JS memory and by reference arguments return values, both need the caller
+	bool interfaces = false;
+	for (CComVariant &arg : args) {
+		if ((arg.vt & VT_BYREF) != 0) return S_FALSE;
+		if ((arg.vt & VT_ARRAY) != 0 && arg.parray && (arg.parray->fFeatures & FADF_STATIC) != 0) return S_FALSE;
+		if (arg.vt == VT_DISPATCH || arg.vt == VT_UNKNOWN) interfaces = true;
+	}
+	if (!apartment || apartment->IsStopped()) apartment = Apartment::Get();
+	if (!apartment) return S_FALSE;
+
+	// Object is registered in global interface table once per writer apartment
+	if (!target || target->apartment != apartment) {
+		WriteTargetPtr ptr(new WriteTarget(disp, apartment));
+		if FAILED(ptr->global.Status()) return S_FALSE;
+		Release(target);
+		target = ptr;
+	}
+
+	// Arguments are moved, with interfaces they are copied and kept for synchronous call when marshaling fails
+	item_ptr item(new item_t);
+	item->target = target;
+	item->dispid = dispid;
+	item->flags = flags;
+	if (member) item->member = member;
+	if (!interfaces) item->args.swap(args);
+	else {
+		std::vector<CComVariant>(args).swap(item->args);
+		for (size_t i = 0; i < item->args.size(); i++) {
+			CComVariant &arg = item->args[i];
+			if ((arg.vt != VT_DISPATCH && arg.vt != VT_UNKNOWN) || VariantMarshal(arg)) continue;
+			for (size_t j = 0; j < i; j++) VariantMarshalRelease(item->args[j]);
+			return S_FALSE;
+		}
+	}
+
+	state_ptr st(State());
+	if (st->pending >= st->limit) Wait(st->limit / 2);
+	InterlockedIncrement(&st->pending);
+	if (!apartment->Post([st, item]() { Execute(st, item); })) {
+		InterlockedDecrement(&st->pending);
+		for (CComVariant &arg : item->args) VariantMarshalRelease(arg);
+		return RPC_E_DISCONNECTED;
+	}
+	st->posted++;
+	return S_OK;
+}
+
+void WriteBehind::Release(WriteTargetPtr &target) {
+
+	// Worker side pointer is released by the last pending write or by the target itself
+	target.reset();
+}
+
+void WriteBehind::Wait(LONG below) {
+
+	// Incoming calls are dispatched meanwhile, writes to objects of this thread are executed by them
+	while (state->pending > below) Apartment::Wait(state->idle);
+}
+
+bool WriteBehind::Flush(Isolate *isolate) {
+	if (!state) return true;
+	Wait(0);
+	if (!state->failed) return true;
+	HRESULT hrcode = state->hrcode;
+	std::wstring member, desc, source;
+	member.swap(state->member);
+	desc.swap(state->desc);
+	source.swap(state->source);
+	state->hrcode = S_OK;
+	InterlockedExchange(&state->failed, 0);
+	isolate->ThrowException(DispError(isolate, hrcode, L"DispWriteBehind", member.c_str(), desc, source));
+	return false;
+}
+
+void WriteBehind::Clear() {
+
+	// Pending writes are completed on exit, hung server does not hang it
+	if (state) {
+		DWORD started = GetTickCount();
+		while (state->pending > 0 && GetTickCount() - started < 5000) Apartment::Wait(state->idle, 5000);
+	}
+	state.reset();
+	apartment.reset();
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Worker side
+
+void WriteBehind::Execute(const state_ptr &st, const item_ptr &item) {
+	std::vector<CComVariant> &args = item->args;
+	if (st->failed) {
+		for (CComVariant &arg : args) VariantMarshalRelease(arg);
+		InterlockedIncrement64(&st->skipped);
+	}
+	else {
+		WriteTarget &target = *item->target;
+		for (CComVariant &arg : args) {
+			if (arg.vt == VT_UNKNOWN) VariantUnmarshal(arg);
+		}
+		HRESULT hrcode = target.disp ? S_OK : target.global.Get(&target.disp);
+		if SUCCEEDED(hrcode) hrcode = DispInvoke(target.disp, item->dispid, (UINT)args.size(), args.empty() ? 0 : &args.front(), 0, item->flags);
+		if FAILED(hrcode) {
+			st->hrcode = hrcode;
+			st->member = item->member;
+			DispErrorInfo(st->desc, st->source);
+			InterlockedExchange(&st->failed, 1);
+		}
+		InterlockedIncrement64(&st->executed);
+	}
+
+	// Unmarshaled arguments belong to this apartment
+	args.clear();
+	LONG left = InterlockedDecrement(&st->pending);
+	if (left == 0 || left == st->limit / 2) SetEvent(st->idle);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Static Node JS callbacks
+
+void WriteBehind::NodeInit(Handle<Object> target) {
+	NODE_SET_METHOD(target, "flush", NodeFlush);
+	NODE_SET_METHOD(target, "writeBehind", NodeWriteBehind);
+	NODE_DEBUG_MSG("WriteBehind initialized");
+}
+
+void WriteBehind::NodeFlush(const FunctionCallbackInfo<Value> &args) {
+	Flush(args.GetIsolate());
+}
+
+void WriteBehind::NodeWriteBehind(const FunctionCallbackInfo<Value> &args) {
+	Isolate *isolate = args.GetIsolate();
+	state_ptr st(State());
+
+	// Configure queue limit when options specified
+	if (args.Length() > 0) {
+		Local<Value> val = args[0]->IsObject() ? args[0]->ToObject()->Get(String::NewFromUtf8(isolate, "limit")) : Local<Value>();
+		if (val.IsEmpty() || (!val->IsUndefined() && (!val->IsUint32() || val->Uint32Value() < 2 || val->Uint32Value() > LONG_MAX))) {
+			isolate->ThrowException(TypeError(isolate, "innvalid arguments"));
+			return;
+		}
+		if (val->IsUint32()) st->limit = (LONG)val->Uint32Value();
+	}
+
+	// Return queue state and counters
+	Local<Object> result(Object::New(isolate));
+	result->Set(String::NewFromUtf8(isolate, "limit"), Int32::New(isolate, st->limit));
+	result->Set(String::NewFromUtf8(isolate, "pending"), Int32::New(isolate, st->pending));
+	result->Set(String::NewFromUtf8(isolate, "posted"), Number::New(isolate, (double)st->posted));
+	result->Set(String::NewFromUtf8(isolate, "executed"), Number::New(isolate, (double)st->executed));
+	result->Set(String::NewFromUtf8(isolate, "skipped"), Number::New(isolate, (double)st->skipped));
+	result->Set(String::NewFromUtf8(isolate, "failed"), Boolean::New(isolate, st->failed != 0));
+	args.GetReturnValue().Set(result);
+}
+
+//-------------------------------------------------------------------------------------------------------
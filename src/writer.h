@@ -0,0 +1,83 @@
+//-------------------------------------------------------------------------------------------------------
+// Project: NodeActiveX
+// Author: Yuri Dursin
+// Description: WriteBehind class declarations. Property puts and void method calls of objects created with
+//              writeBehind option are executed on worker apartment in posting order, the loop does not wait
+//              for them. Pending writes are flushed before synchronous calls, first error is thrown there
+//-------------------------------------------------------------------------------------------------------
+
+#pragma once
+
+//-------------------------------------------------------------------------------------------------------
+
+// Object used by deferred writes, its worker side pointer is used and released on writer apartment only
+struct WriteTarget {
+	GlobalPtr global;
+	ApartmentPtr apartment;
+	CComPtr<IDispatch> disp;
+	inline WriteTarget(IDispatch *ptr, const ApartmentPtr &apt) : global(ptr), apartment(apt) {}
+	~WriteTarget();
+};
+
+typedef std::shared_ptr<WriteTarget> WriteTargetPtr;
+
+//-------------------------------------------------------------------------------------------------------
+
+class WriteBehind {
+public:
+
+	// Writes are deferred only for proxies of out of process servers (or other apartments of the process),
+	// worker calls them directly. Objects of the loop thread would be reached through it, they are written synchronously
+	static bool Accepts(IDispatch *disp);
+
+	// S_FALSE when write may not be deferred (arguments reference caller memory) and should be executed synchronously
+	static HRESULT Post(WriteTargetPtr &target, IDispatch *disp, DISPID dispid, WORD flags, std::vector<CComVariant> &args, LPCOLESTR member);
+
+	// Worker side pointer is released on its apartment after pending writes
+	static void Release(WriteTargetPtr &target);
+
+	// Wait for pending writes of the isolate, first error since previous flush is thrown, false when thrown
+	static bool Flush(Isolate *isolate);
+	static inline bool IsBusy() { return state && (state->pending > 0 || state->failed != 0); }
+
+	static void Clear();
+	static void NodeInit(Handle<Object> target);
+
+private:
+	struct state_t {
+		volatile LONG pending, failed;
+		LONG limit;  // Posting waits while queue is full
+		HANDLE idle; // Signaled when queue is drained or falls to half of limit
+
+		// Error of the first failed write, later writes are skipped until flush. Written on worker, read after drain
+		HRESULT hrcode;
+		std::wstring member, desc, source;
+		uint64_t posted;
+		volatile LONG64 executed, skipped;
+		state_t() : pending(0), failed(0), limit(4096), hrcode(S_OK), posted(0), executed(0), skipped(0) { idle = CreateEvent(0, FALSE, FALSE, 0); }
+		~state_t() { if (idle) CloseHandle(idle); }
+	};
+	typedef std::shared_ptr<state_t> state_ptr;
+
+	struct item_t {
+		WriteTargetPtr target;
+		DISPID dispid;
+		WORD flags;
+		std::vector<CComVariant> args; // Reverse order, interfaces are marshal streams
+		std::wstring member;
+	};
+	typedef std::shared_ptr<item_t> item_ptr;
+
+	// Every isolate writes through one apartment, so writes of different objects keep their order
+	static thread_local state_ptr state;
+	static thread_local ApartmentPtr apartment;
+	static state_ptr &State();
+
+	static void Execute(const state_ptr &st, const item_ptr &item);
+	static void Wait(LONG below);
+
+	static void NodeFlush(const FunctionCallbackInfo<Value> &args);
+	static void NodeWriteBehind(const FunctionCallbackInfo<Value> &args);
+};
+
+//-------------------------------------------------------------------------------------------------------
@@ -1,4 +1,4 @@
-require('../activex');
+var ActiveX = require('../activex');
 
 var path = require('path'); 
 const assert = require('assert');
@@ -70,4 +70,757 @@ describe("ADODB.Connection", function() {
         }
     });
 
-});
\ No newline at end of file
+});
+
+describe("Instance pool", function() {
+
+    var progid = "Scripting.Dictionary";
+
+    it("pre-warm instances", function() {
+        var state = ActiveX.pool(progid, { min: 1, max: 2, idle: 60000 });
+        assert.equal(state.free, 1);
+    });
+
+    it("lease and release", function() {
+        var dict = ActiveX.lease(progid);
+        dict.Add("key", "value");
+        assert.equal(ActiveX.pool(progid).leased, 1);
+        assert.equal(ActiveX.release(dict), true);
+        assert.equal(ActiveX.pool(progid).leased, 0);
+    });
+
+    it("reject release of other objects", function() {
+        var handle = require('zlib').createDeflate()._handle;
+        assert.throws(function() { ActiveX.release(handle); }, TypeError);
+        assert.throws(function() { ActiveX.release({}); }, TypeError);
+    });
+
+});
+
+describe("Object lifetime", function() {
+
+    it("release and count live objects", function() {
+        var count = ActiveX.stats().objects;
+        var dict = new ActiveXObject("Scripting.Dictionary");
+        assert.equal(ActiveX.stats().objects, count + 1);
+        assert.equal(dict.release(), true);
+        assert.throws(function() { dict.Count; });
+    });
+
+    it("keep child of collected parent", function() {
+        if (typeof global.gc !== 'function') return this.skip(); // mocha --expose-gc
+        var drives = (function() { return new ActiveXObject("Scripting.FileSystemObject").Drives; })();
+        var count = drives.Count;
+        global.gc();
+        global.gc();
+        assert.equal(drives.Count, count);
+    });
+
+    it("reuse pooled wrappers and interned names", function() {
+        var round = function() {
+            for (var i = 0; i < 100; i++) {
+                var fso = new ActiveXObject("Scripting.FileSystemObject");
+                fso.Drives.Count;
+                fso.release();
+            }
+        };
+        round();
+        var before = ActiveX.stats();
+        for (var i = 0; i < 10; i++) round();
+        var after = ActiveX.stats();
+        assert.equal(after.slabs, before.slabs);
+        assert.ok(after.names <= before.names + 1);
+    });
+
+    it("create with and without class cache", function() {
+        assert.equal(ActiveX.classCache(false), true);
+        try { assert.equal(new ActiveXObject("Scripting.Dictionary").Count, 0); }
+        finally { ActiveX.classCache(true); }
+        assert.equal(new ActiveXObject("Scripting.Dictionary").Count, 0);
+    });
+
+});
+
+describe("ADODB.Stream", function() {
+
+    it("write and read Buffer", function() {
+        var data = Buffer.from ? Buffer.from([1, 2, 3, 4, 5]) : new Buffer([1, 2, 3, 4, 5]);
+        var ado_stream = new ActiveXObject("ADODB.Stream");
+        ado_stream.Type = 1; // adTypeBinary
+        ado_stream.Open();
+        ado_stream.Write(data);
+        ado_stream.Position = 0;
+        var result = ado_stream.Read();
+        assert.ok(Buffer.isBuffer(result));
+        assert.equal(result.toString('hex'), data.toString('hex'));
+        ado_stream.Close();
+    });
+
+    it("pipe chunks through async object", function(done) {
+        var data = Buffer.alloc(100000, 7), chunks = [];
+        ActiveX.createAsync("ADODB.Stream").then(function(ado_stream) {
+            ado_stream.Type = 1; // adTypeBinary
+            return ado_stream.Open().then(function() {
+                var writable = ActiveX.createWriteStream(ado_stream, { chunkSize: 16384 });
+                writable.on('error', done).on('finish', function() {
+                    ado_stream.Position = 0;
+                    ActiveX.createReadStream(ado_stream, { chunkSize: 16384 }).on('error', done).on('data', function(chunk) {
+                        chunks.push(chunk);
+                    }).on('end', function() {
+                        assert.equal(Buffer.concat(chunks).toString('hex'), data.toString('hex'));
+                        assert.ok(chunks.length > 1);
+                        done();
+                    });
+                });
+                writable.end(data);
+            });
+        }).catch(done);
+    });
+
+});
+
+describe("Collection projection", function() {
+
+    it("fields to array of rows and columns", function() {
+        var rs = new ActiveXObject("ADODB.Recordset");
+        rs.Fields.Append("Name", 200, 50); // adVarChar
+        rs.Fields.Append("Zip", 3); // adInteger
+        var rows = rs.Fields.toArray(['Name', 'Type']);
+        assert.deepEqual(rows, [{ Name: 'Name', Type: 200 }, { Name: 'Zip', Type: 3 }]);
+        var cols = rs.Fields.toArray(['Name'], { columns: true });
+        assert.deepEqual(cols.Name, ['Name', 'Zip']);
+    });
+
+});
+
+describe("Serialization", function() {
+
+    it("properties to plain object by type information", function() {
+        var fso = new ActiveXObject("Scripting.FileSystemObject");
+        var folder = fso.GetFolder(data_path);
+        var obj = folder.toJSON({ depth: 0, exclude: ['Size'] });
+        assert.equal(obj.Path.toLowerCase(), folder.Path.toLowerCase());
+        assert.ok(!('Size' in obj));
+        assert.ok(!('Drive' in obj));
+        var json = JSON.parse(JSON.stringify(folder));
+        assert.equal(typeof json.Drive, 'object');
+        assert.equal(json.Name, folder.Name);
+    });
+
+});
+
+describe("Property cache", function() {
+
+    it("memoize gets in scope and invalidate on put", function() {
+        var dict = new ActiveXObject("Scripting.Dictionary");
+        dict.Add("key", "value");
+        var hits = ActiveX.cache().hits;
+        ActiveX.withCache(function() {
+            assert.equal(dict.Count, 1);
+            assert.equal(dict.Count, 1);
+            assert.equal(ActiveX.cache().hits, hits + 1);
+            dict.Add("key2", "value2");
+            assert.equal(dict.Count, 2);
+        });
+        assert.equal(ActiveX.cache().scope, 0);
+    });
+
+});
+
+describe("Errors", function() {
+
+    it("carry hresult and member, message is formatted when read", function() {
+        var fso = new ActiveXObject("Scripting.FileSystemObject");
+        var error;
+        try { fso.GetFile(path.join(data_path, "missing.file")); }
+        catch (e) { error = e; }
+        assert.ok(error instanceof Error);
+        assert.ok(error.hresult >= 0x80000000);
+        assert.equal(error.operation, "DispInvoke");
+        assert.equal(error.member, "GetFile");
+        assert.ok(error.message.indexOf("GetFile") >= 0);
+    });
+
+});
+
+describe("Variant conversion", function() {
+
+    var dict = new ActiveXObject("Scripting.Dictionary");
+    var key = 0;
+    function roundtrip(value) {
+        dict.Add(++key, value);
+        return dict.Item(key);
+    }
+
+    it("numbers, strings, booleans and null", function() {
+        [0, -1, 2147483647, 4294967295, 1.5, -1e300, 'text', '', true, false, null].forEach(function(value) {
+            assert.strictEqual(roundtrip(value), value);
+        });
+    });
+
+    it("strings of ascii, latin-1, other characters and embedded zero", function() {
+        var long = new Array(1000).join('abcdefghij');
+        ['short', 'Größe', 'значение', long, long + 'я', 'zero\u0000inside'].forEach(function(value) {
+            assert.strictEqual(roundtrip(value), value);
+        });
+    });
+
+    it("dates", function() {
+        [new Date(2017, 0, 15, 10, 30), new Date(1800, 0, 1, 6, 0), new Date(1899, 11, 29, 18, 0)].forEach(function(value) {
+            var result = roundtrip(value);
+            assert.ok(result instanceof Date);
+            assert.equal(result.getTime(), value.getTime());
+        });
+
+        // Local wall clock on COM side, in winter and summer time
+        var wmi_date = new ActiveXObject("WbemScripting.SWbemDateTime");
+        [new Date(2017, 0, 15, 10, 30), new Date(2017, 6, 15, 23, 45)].forEach(function(value) {
+            wmi_date.SetVarDate(value, true);
+            assert.deepEqual([wmi_date.Year, wmi_date.Month, wmi_date.Day, wmi_date.Hours, wmi_date.Minutes],
+                [value.getFullYear(), value.getMonth() + 1, value.getDate(), value.getHours(), value.getMinutes()]);
+            assert.equal(wmi_date.GetVarDate(true).getTime(), value.getTime());
+        });
+    });
+
+    it("decimal field", function() {
+        if (!con) return;
+        var rs = con.Execute("Select * from " + filename);
+        assert.strictEqual(typeof rs.Fields("Zip").Value, 'number');
+    });
+
+});
+
+describe("Type information cache", function() {
+
+    var cache_filename = path.join(data_path, 'types.cache');
+
+    it("save and load", function() {
+        ActiveX.saveTypeCache(cache_filename);
+        ActiveX.clearTypeCache();
+        assert.equal(ActiveX.loadTypeCache(cache_filename), true);
+    });
+
+    it("use loaded types", function() {
+        var before = ActiveX.typeCacheStats();
+        var con = new ActiveXObject("ADODB.Connection");
+        assert.ok(con.__type.length > 0);
+        var after = ActiveX.typeCacheStats();
+        assert.ok(after.hits > before.hits);
+        assert.ok(after.decoded > before.decoded);
+        assert.equal(after.described, before.described);
+    });
+
+    it("share type description of JS objects of the same shape", function() {
+        var make = function() { return new ActiveXObject({ value: 1, twice: function(v) { return v * 2; } }); };
+        assert.equal(make().toJSON().value, 1);
+        var before = ActiveX.typeCacheStats();
+        for (var i = 0; i < 10; i++) assert.equal(make().toJSON().value, 1);
+        var after = ActiveX.typeCacheStats();
+        assert.equal(after.entries, before.entries);
+        assert.equal(after.described, before.described);
+        assert.ok(after.hits >= before.hits + 10);
+    });
+
+});
+
+describe("Async calls", function() {
+
+    it("create object on worker apartment and call members", function() {
+        return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+            return dict.Add("key", "value").then(function() {
+                return dict.Count;
+            }).then(function(count) {
+                assert.equal(count, 1);
+                return dict.Item("key");
+            }).then(function(value) {
+                assert.equal(value, "value");
+            });
+        });
+    });
+
+    it("reject hung call by deadline", function() {
+        this.timeout(10000);
+        return ActiveX.createAsync("WScript.Shell").then(function(shell) {
+            return ActiveX.invoke(shell, 'call', 'Run', ["ping -n 5 127.0.0.1", 0, true], { timeout: 500 });
+        }).then(function() {
+            assert.fail('call is not timed out');
+        }, function(e) {
+            assert.equal(e.hresult, 0x800705B4);
+            assert.equal(ActiveX.breaker().progids["WScript.Shell"].timeouts, 1);
+        });
+    });
+
+    it("let probe call through after call on stopped apartment", function() {
+        this.timeout(10000);
+        var progid = "WScript.Shell", prev = ActiveX.breaker(), stale;
+        var restore = function() {
+            ActiveX.breaker({ threshold: prev.threshold, reset: prev.reset });
+            ActiveX.apartments(1);
+        };
+        ActiveX.breaker({ threshold: 1, reset: 100 });
+        ActiveX.apartments(2);
+        return ActiveX.createAsync(progid, { apartment: 1 }).then(function(shell) {
+            stale = shell;
+            return ActiveX.createAsync(progid, { apartment: 0 });
+        }).then(function(shell) {
+            return ActiveX.invoke(shell, 'call', 'Run', ["ping -n 3 127.0.0.1", 0, true], { timeout: 200 }).then(function() {
+                assert.fail('call is not timed out');
+            }, function(e) {
+                assert.equal(e.hresult, 0x800705B4);
+            });
+        }).then(function() {
+            assert.equal(ActiveX.breaker().progids[progid].state, "open");
+            ActiveX.apartments(1); // Stops worker of the stale object
+            return new Promise(function(resolve) { setTimeout(resolve, 200); });
+        }).then(function() {
+            return ActiveX.invoke(stale, 'get', 'CurrentDirectory', []).then(function() {
+                assert.fail('call of stopped apartment');
+            }, function(e) {
+                assert.equal(e.hresult, 0x80010108); // RPC_E_DISCONNECTED
+            });
+        }).then(function() {
+            return ActiveX.createAsync(progid);
+        }).then(function() {
+            assert.equal(ActiveX.breaker().progids[progid].state, "closed");
+            restore();
+        }, function(e) {
+            restore();
+            throw e;
+        });
+    });
+
+    it("cancel call and settle its promise on next turn", function() {
+        this.timeout(10000);
+        return ActiveX.createAsync("WScript.Shell").then(function(shell) {
+            var settled = false;
+            var promise = ActiveX.invoke(shell, 'call', 'Run', ["ping -n 2 127.0.0.1", 0, true]);
+            var result = promise.then(function() {
+                assert.fail('call is not cancelled');
+            }, function(e) {
+                settled = true;
+                assert.equal(e.hresult, 0x80004004);
+            });
+            assert.equal(ActiveX.asyncCancel(promise.id), true);
+            assert.equal(settled, false);
+            return result;
+        });
+    });
+
+    it("reject JS object argument", function() {
+        return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+            assert.throws(function() { ActiveX.invoke(dict, 'call', 'Add', ["key", { value: 1 }]); }, TypeError);
+        });
+    });
+
+    it("pass free-threaded JS object to worker apartment", function() {
+        var twice = function(v) { return v * 2; };
+        var callback = new ActiveXObject({ twice: twice }, { freeThreaded: true });
+        var proxied = new ActiveXObject({ twice: twice });
+        var direct = ActiveX.stats().direct;
+        return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+            assert.throws(function() { dict.Add("proxied", proxied); }, TypeError);
+            return dict.Add("callback", callback).then(function() {
+                return dict.Item("callback").twice(21);
+            }).then(function(result) {
+                assert.equal(result, 42);
+                assert.ok(ActiveX.stats().direct > direct);
+            });
+        });
+    });
+
+    it("return exception of JS callback to caller", function() {
+        var callback = new ActiveXObject({ fail: function() { throw new Error("callback failed"); } }, { freeThreaded: true });
+        return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+            return dict.Add("callback", callback).then(function() {
+                return dict.Item("callback").fail();
+            }).then(function() {
+                assert.fail("exception of callback is lost");
+            }, function(e) {
+                assert.equal(e.hresult, 0x80020009);
+                assert.ok(/callback failed/.test(e.description));
+            });
+        });
+    });
+
+    it("pipeline calls on pending results", function() {
+        var root;
+        return ActiveX.createAsync("Scripting.Dictionary").then(function(dict) {
+            root = dict;
+            return ActiveX.createAsync("Scripting.Dictionary");
+        }).then(function(child) {
+            return child.Add("key", "value").then(function() {
+                return root.Add("child", child);
+            });
+        }).then(function() {
+            return root.Item("child").Item("key");
+        }).then(function(value) {
+            assert.equal(value, "value");
+            return root.Item("child").Count;
+        }).then(function(count) {
+            assert.equal(count, 1);
+            return root.Add("copy", root.Item("child").Item("key")); // pending argument
+        }).then(function() {
+            return root.Item("copy");
+        }).then(function(value) {
+            assert.equal(value, "value");
+            var missing = root.Item("missing");
+            return Promise.all([missing.Count.then(null, function(e) { return e; }), missing.then(function() {
+                return missing.Count.then(null, function(e) { return e; });
+            })]);
+        }).then(function(errors) {
+            assert.equal(errors[0].hresult, 0x80020005); // chained while pending
+            assert.equal(errors[1].hresult, 0x80020005); // chained after settled
+        });
+    });
+
+    it("pipeline property gets and errors of failed calls", function() {
+        var fso, folder;
+        return ActiveX.createAsync("Scripting.FileSystemObject").then(function(obj) {
+            fso = obj;
+            return fso.GetFolder(data_path).ParentFolder.Name; // ParentFolder is read on worker
+        }).then(function(name) {
+            assert.equal(name.toLowerCase(), path.basename(path.join(data_path, '..')).toLowerCase());
+            folder = fso.GetFolder(path.join(data_path, 'missing'));
+            return Promise.all([folder.then(null, function(e) { return e; }), folder.Files.Count.then(null, function(e) { return e; })]);
+        }).then(function(errors) {
+            assert.equal(errors[0].hresult, 0x800A004C); // path not found
+            assert.equal(errors[1].hresult, errors[0].hresult); // inherited by pipelined call
+            return folder.Name.then(null, function(e) { return e; });
+        }).then(function(e) {
+            assert.equal(e.hresult, 0x800A004C);
+        });
+    });
+
+    it("call on interactive lane and report lanes", function() {
+        return ActiveX.createAsync("Scripting.Dictionary", { priority: 'interactive' }).then(function(dict) {
+            return dict.Count;
+        }).then(function(count) {
+            assert.equal(count, 0);
+            var lanes = ActiveX.lanes();
+            assert.deepEqual(Object.keys(lanes), ['interactive', 'normal', 'bulk']);
+            assert.ok(lanes.interactive.executed >= 2);
+            assert.equal(lanes.interactive.queued, 0);
+            assert.ok(lanes.interactive.wait.max >= lanes.interactive.wait.avg);
+        });
+    });
+
+    // Lane policies are process wide, previous policy of the lane is restored however the test ends
+    function withLane(name, conf, run) {
+        var prev = ActiveX.lanes()[name], restore = {};
+        restore[name] = { weight: prev.weight, limit: prev.limit, policy: prev.policy, timeout: prev.timeout };
+        var settings = {};
+        settings[name] = conf;
+        ActiveX.lanes(settings);
+        var promise;
+        try { promise = run(); }
+        catch (e) { ActiveX.lanes(restore); throw e; }
+        return promise.then(function(result) {
+            ActiveX.lanes(restore);
+            return result;
+        }, function(e) {
+            ActiveX.lanes(restore);
+            throw e;
+        });
+    }
+
+    function runBulk(shell, count) {
+        var calls = [];
+        for (var i = 0; i < count; i++) {
+            calls.push(ActiveX.invoke(shell, 'call', 'Run', ["ping -n 2 127.0.0.1", 0, true], { priority: 'bulk' }).then(function() { return 0; }, function(e) { return e.hresult; }));
+        }
+        return calls;
+    }
+
+    it("reject call when lane is full", function() {
+        var rejected = ActiveX.lanes().bulk.rejected;
+        return withLane('bulk', { limit: 1, policy: 'reject' }, function() {
+            return ActiveX.createAsync("WScript.Shell").then(function(shell) {
+                return Promise.all(runBulk(shell, 3));
+            });
+        }).then(function(results) {
+            assert.ok(results.indexOf(0x8001010A) >= 0);
+            assert.ok(ActiveX.lanes().bulk.rejected > rejected);
+        });
+    });
+
+    it("wait for free slot without blocking the loop", function() {
+        this.timeout(20000);
+        return withLane('bulk', { limit: 1, policy: 'wait', timeout: 10000 }, function() {
+            return ActiveX.createAsync("WScript.Shell").then(function(shell) {
+                var started = Date.now(), calls = runBulk(shell, 3);
+                assert.ok(Date.now() - started < 500);
+                assert.ok(ActiveX.lanes().bulk.waiting >= 1);
+                return Promise.all(calls);
+            });
+        }).then(function(results) {
+            assert.deepEqual(results, [0, 0, 0]);
+            return withLane('bulk', { limit: 1, policy: 'wait', timeout: 100 }, function() {
+                return ActiveX.createAsync("WScript.Shell").then(function(shell) {
+                    return Promise.all(runBulk(shell, 3));
+                });
+            });
+        }).then(function(results) {
+            assert.equal(results[0], 0);
+            assert.ok(results.indexOf(0x8001010A) > 0);
+        });
+    });
+
+});
+
+describe("Write behind", function() {
+
+    it("write in-process object synchronously", function() {
+        var dict = new ActiveXObject("Scripting.Dictionary", { writeBehind: true });
+        var before = ActiveX.writeBehind();
+        for (var i = 0; i < 100; i++) dict.Add("key" + i, i);
+        assert.equal(ActiveX.writeBehind().posted, before.posted);
+        assert.equal(dict.Count, 100);
+        assert.throws(function() { dict.Add("key0", 0); }, function(e) {
+            return e.operation === "DispInvoke" && e.member === "Add";
+        });
+    });
+
+});
+
+// Decodes IPC stream by the format specification: flatbuffer messages of schema and record batches, 
+// column buffers with validity bitmaps. Returns fields and batches of rows
+function readArrow(buf) {
+    var u8 = function(p) { return buf.readUInt8(p); };
+    var i16 = function(p) { return buf.readInt16LE(p); };
+    var i32 = function(p) { return buf.readInt32LE(p); };
+    var i64 = function(p) { return buf.readUInt32LE(p) + buf.readInt32LE(p + 4) * 0x100000000; };
+    var table = function(pos) {
+        var vtable = pos - buf.readInt32LE(pos), size = buf.readUInt16LE(vtable);
+        var field = function(slot) { return (4 + slot * 2 < size) ? buf.readUInt16LE(vtable + 4 + slot * 2) : 0; };
+        return {
+            scalar: function(slot, read, def) { var off = field(slot); return off ? read(pos + off) : def; },
+            offset: function(slot) { var off = field(slot); return off ? pos + off + buf.readUInt32LE(pos + off) : 0; }
+        };
+    };
+    var vector = function(pos) { return { length: buf.readUInt32LE(pos), start: pos + 4 }; };
+    var string = function(pos) { var v = vector(pos); return buf.toString('utf8', v.start, v.start + v.length); };
+    var bit = function(start, i) { return (buf[start + (i >> 3)] & (1 << (i & 7))) !== 0; };
+
+    var fields = [], batches = [], pos = 0;
+    for (;;) {
+        assert.equal(buf.readUInt32LE(pos), 0xFFFFFFFF); // Continuation marker
+        var size = buf.readUInt32LE(pos + 4);
+        pos += 8;
+        if (size === 0) break;
+        assert.equal(size % 8, 0);
+        var message = table(pos + buf.readUInt32LE(pos));
+        assert.equal(message.scalar(0, i16, 0), 4); // MetadataVersion.V5
+        var kind = message.scalar(1, u8, 0), header = table(message.offset(2));
+        var body = pos + size, body_size = message.scalar(3, i64, 0);
+        assert.ok(body + body_size <= buf.length);
+        if (kind === 1) { // Schema
+            assert.equal(fields.length, 0);
+            assert.equal(header.scalar(0, i16, 0), 0); // Little endian
+            var items = vector(header.offset(1));
+            for (var i = 0; i < items.length; i++) {
+                var at = items.start + i * 4, field = table(at + buf.readUInt32LE(at));
+                var type_id = field.scalar(2, u8, 0), type = table(field.offset(3));
+                fields.push({
+                    name: string(field.offset(0)),
+                    nullable: field.scalar(1, u8, 0) === 1,
+                    type: type_id,
+                    param: (type_id === 2) ? type.scalar(0, i32, 0) : type.scalar(0, i16, 0), // Int bits, float precision, time unit
+                    signed: (type_id === 2) && type.scalar(1, u8, 0) === 1,
+                    children: vector(field.offset(5)).length
+                });
+            }
+        }
+        else if (kind === 3) { // RecordBatch
+            var length = header.scalar(0, i64, 0), nodes = vector(header.offset(1)), buffers = vector(header.offset(2)), next = 0;
+            assert.equal(nodes.length, fields.length);
+            var buffer = function() {
+                var at = buffers.start + (next++) * 16, start = i64(at);
+                assert.equal(start % 8, 0);
+                assert.ok(start + i64(at + 8) <= body_size);
+                return { start: body + start, length: i64(at + 8) };
+            };
+            var columns = fields.map(function(field, c) {
+                var nulls = i64(nodes.start + c * 16 + 8), counted = 0, values = [];
+                assert.equal(i64(nodes.start + c * 16), length);
+                var validity = buffer(), data = buffer(), bytes = (field.type === 4 || field.type === 5) ? buffer() : null;
+                assert.ok(validity.length === 0 ? nulls === 0 : validity.length >= Math.ceil(length / 8));
+                for (var r = 0; r < length; r++) {
+                    if (validity.length > 0 && !bit(validity.start, r)) {
+                        counted++;
+                        values.push(null);
+                        continue;
+                    }
+                    switch (field.type) {
+                    case 2: values.push(field.param === 32 ? i32(data.start + r * 4) : i64(data.start + r * 8)); break;
+                    case 3: values.push(buf.readDoubleLE(data.start + r * 8)); break;
+                    case 6: values.push(bit(data.start, r)); break;
+                    case 10: values.push(i64(data.start + r * 8)); break;
+                    default: {
+                        var from = i32(data.start + r * 4), to = i32(data.start + r * 4 + 4);
+                        assert.ok(from <= to && to <= bytes.length);
+                        values.push(field.type === 5 ? buf.toString('utf8', bytes.start + from, bytes.start + to) : buf.slice(bytes.start + from, bytes.start + to));
+                    }}
+                }
+                assert.equal(counted, nulls);
+                return values;
+            });
+            assert.equal(next, buffers.length);
+            var rows = [];
+            for (var r = 0; r < length; r++) rows.push(columns.map(function(values) { return values[r]; }));
+            batches.push(rows);
+        }
+        else assert.fail("unexpected message " + kind);
+        pos = body + body_size;
+    }
+    assert.equal(pos, buf.length);
+    return { fields: fields, batches: batches };
+}
+
+describe("Arrow export", function() {
+
+    it("reject wrapped object of other class", function() {
+        var handle = require('zlib').createDeflate()._handle;
+        assert.throws(function() { ActiveX.exportArrow(handle); }, TypeError);
+    });
+
+    it("write recordset as IPC stream", function() {
+        var rs = new ActiveXObject("ADODB.Recordset"), nullable = 0x20; // adFldIsNullable
+        rs.Fields.Append("Name", 202, 50, nullable); // adVarWChar
+        rs.Fields.Append("Zip", 3, 0, nullable); // adInteger
+        rs.Fields.Append("Born", 7, 0, nullable); // adDate
+        rs.Fields.Append("Active", 11, 0, nullable); // adBoolean
+        rs.Open();
+        var source = [];
+        for (var i = 0; i < 10; i++) {
+            var row = [(i === 3) ? null : "name" + i + ((i === 7) ? "\u00fc\u4e2d" : ""), (i === 5) ? null : i * 1000 - 3000, new Date(2020, 0, i + 1, 12, 30), (i === 9) ? null : i % 2 === 0];
+            rs.AddNew();
+            rs.Fields("Name").Value = row[0];
+            rs.Fields("Zip").Value = row[1];
+            rs.Fields("Born").Value = row[2];
+            rs.Fields("Active").Value = row[3];
+            source.push(row);
+        }
+        rs.Update();
+        rs.MoveFirst();
+        var buf = ActiveX.exportArrow(rs, { batch: 4 });
+        assert.ok(Buffer.isBuffer(buf));
+        assert.ok(rs.EOF);
+
+        var stream = readArrow(buf);
+        assert.deepEqual(stream.fields.map(function(f) { return [f.name, f.type, f.param, f.nullable, f.children]; }), [
+            ["Name", 5, 0, true, 0], // Utf8
+            ["Zip", 2, 32, true, 0], // Int(32)
+            ["Born", 10, 1, true, 0], // Timestamp(ms), no time zone
+            ["Active", 6, 0, true, 0] // Bool
+        ]);
+        assert.ok(stream.fields[1].signed);
+        assert.deepEqual(stream.batches.map(function(rows) { return rows.length; }), [4, 4, 2]);
+
+        // Timestamps are local wall clock of the dates
+        var rows = [].concat.apply([], stream.batches);
+        assert.deepEqual(rows, source.map(function(row) {
+            var d = row[2];
+            return [row[0], row[1], Date.UTC(d.getFullYear(), d.getMonth(), d.getDate(), d.getHours(), d.getMinutes()), row[3]];
+        }));
+    });
+
+});
+
+describe("Bulk commands", function() {
+
+    it("execute parameterized insert for columns", function() {
+        if (!con) return this.skip();
+        return ActiveX.createAsync("ADODB.Command").then(function(cmd) {
+            cmd.ActiveConnection = constr;
+            cmd.CommandText = "insert into " + filename + " (Name, Zip) values(?, ?)";
+            return ActiveX.executeMany(cmd, [['Bulk1', 'Bulk2', 'Bulk3'], new Int32Array([1, 2, 3])], { transaction: 2 });
+        }).then(function(result) {
+            assert.equal(result.rows, 3);
+            var rs = con.Execute("Select count(*) from " + filename + " where Name like 'Bulk%'");
+            assert.equal(rs.Fields(0).Value, 3);
+        });
+    });
+
+    it("reject synchronous command", function() {
+        var cmd = new ActiveXObject("ADODB.Command");
+        return ActiveX.executeMany(cmd, [['Bulk']]).then(function() {
+            assert.fail("executed");
+        }, function(e) {
+            assert.ok(e instanceof TypeError);
+        });
+    });
+
+    it("roll back transaction failed on its first row", function() {
+        if (!con) return this.skip();
+        var count = function() { return con.Execute("Select count(*) from " + filename + " where Name like 'Fail%'").Fields(0).Value; };
+        var cmd;
+        return ActiveX.createAsync("ADODB.Command").then(function(result) {
+            cmd = result;
+            cmd.ActiveConnection = constr;
+            cmd.CommandText = "insert into " + filename + " (Name, Zip) values(?, ?)";
+            return ActiveX.executeMany(cmd, [['Fail1', 'Fail2'], ['1', 'not a number']], { transaction: 1 });
+        }).then(function() {
+            assert.fail("executed");
+        }, function(e) {
+            assert.equal(e.row, 1);
+            assert.equal(count(), 1);
+
+            // Transaction is not left open, so next one is committed
+            return ActiveX.executeMany(cmd, [['Fail3'], ['3']], { transaction: 1 });
+        }).then(function(result) {
+            assert.equal(result.commits, 1);
+            assert.equal(count(), 2);
+        });
+    });
+
+});
+
+describe("Worker threads", function() {
+
+    var worker_threads;
+    try { worker_threads = require('worker_threads'); } catch (e) {}
+
+    it("use objects in worker apartment and transfer typed arrays", function(done) {
+        if (!worker_threads) return this.skip();
+        this.timeout(10000);
+        var code = "var ActiveX = require(" + JSON.stringify(path.join(__dirname, '../activex')) + ");\n" +
+            "var port = require('worker_threads').parentPort;\n" +
+            "var dict = new ActiveXObject('Scripting.Dictionary');\n" +
+            "for (var i = 0; i < 100; i++) dict.Add(i, i * 1.5);\n" +
+            "var values = new Float64Array(dict.Count);\n" +
+            "for (var i = 0; i < values.length; i++) values[i] = dict.Item(i);\n" +
+            "var result = { count: dict.Count, values: values };\n" +
+            "port.postMessage(result, ActiveX.transferList(result));\n";
+        var worker = new worker_threads.Worker(code, { eval: true });
+        worker.on('error', done);
+        worker.on('message', function(result) {
+            assert.equal(result.count, 100);
+            assert.ok(result.values instanceof Float64Array);
+            assert.equal(result.values[99], 148.5);
+            worker.terminate();
+            done();
+        });
+    });
+
+    it("reuse pooled blocks of exited workers", function() {
+        if (!worker_threads) return this.skip();
+        this.timeout(20000);
+        var code = "require(" + JSON.stringify(path.join(__dirname, '../activex')) + ");\n" +
+            "for (var i = 0; i < 100; i++) new ActiveXObject('Scripting.FileSystemObject').Drives.release();\n";
+        var run = function() {
+            return new Promise(function(resolve, reject) {
+                var worker = new worker_threads.Worker(code, { eval: true });
+                worker.on('error', reject);
+                worker.on('exit', resolve);
+            });
+        };
+        var slabs;
+        return run().then(function() {
+            slabs = ActiveX.stats().slabs;
+            return run();
+        }).then(run).then(run).then(function() {
+            assert.equal(ActiveX.stats().slabs, slabs);
+        });
+    });
+
+});
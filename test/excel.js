@@ -1,4 +1,4 @@
-require('../activex');
+var ActiveX = require('../activex');
 
 var path = require('path'); 
 const assert = require('assert');
@@ -66,6 +66,16 @@ describe("COM from JS object", function() {
         if (com_obj) assert.equal(com_obj.func(test_func_arg), js_obj.func(test_func_arg));
     });
 
+    it("describe members by synthesized type information", function() {
+        if (!com_obj) return;
+        var dict = new ActiveXObject("Scripting.Dictionary");
+        dict.Add("obj", com_obj);
+        var kinds = {};
+        dict.Item("obj").__type.forEach(function(item) { kinds[item.name] = (kinds[item.name] || 0) | item.invkind; });
+        assert.equal(kinds.func, 1); // INVOKE_FUNC
+        assert.equal(kinds.text, 2 | 4); // INVOKE_PROPERTYGET | INVOKE_PROPERTYPUT
+    });
+
 });
 
 describe("Excel with JS object", function() {
@@ -94,6 +104,59 @@ describe("Excel with JS object", function() {
         if (wbk && com_obj) assert.equal(js_obj.func(test_func_arg), wbk.Test(com_obj, 'func', 0, test_func_arg));
     });
 
+    it("receive workbook event", function(done) {
+        if (!wbk) return done();
+        var received = false;
+        wbk.on('NewSheet', function(sheet) {
+            if (!received) done();
+            received = true;
+        });
+        wbk.Sheets.Add();
+    });
+
+    it("write and read range by tiles", function(done) {
+        if (!wbk) return done();
+        var range = wbk.Worksheets.Item(1).Range("A1:B5");
+        var rows = [[1, 'a'], [2, 'b'], [3, 'c'], [4, 'd'], [5, 'e']];
+        ActiveX.writeRange(range, rows, { tile: 2 }, function(err) {
+            if (err) return done(err);
+            var tiles = [];
+            ActiveX.readRange(range, { tile: 2, columns: true }, function(err, tile) {
+                if (err) return done(err);
+                if (tile) return tiles.push(tile);
+                assert.equal(tiles.length, 3);
+                assert.ok(tiles[0].values[0] instanceof Float64Array);
+                assert.equal(tiles[0].values[0][1], 2);
+                assert.equal(tiles[2].values[1][0], 'e');
+                done();
+            });
+        });
+    });
+
+    it("defer puts until read and report errors at flush", function() {
+        if (!excel) return;
+        var app = new ActiveXObject("Excel.Application", { writeBehind: true });
+        var book = app.Workbooks.Add();
+        try {
+            var range = book.Worksheets.Item(1).Range("A1");
+            var before = ActiveX.writeBehind();
+            for (var i = 0; i < 100; i++) range.Value2 = i;
+            assert.equal(ActiveX.writeBehind().posted - before.posted, 100);
+            assert.equal(range.Value2, 99);
+            range.Formula = "=SUM(";
+            range.Value2 = 100;
+            assert.throws(function() { range.flush(); }, function(e) {
+                return e.operation === "DispWriteBehind" && e.member === "Formula";
+            });
+            assert.equal(ActiveX.writeBehind().failed, false);
+            assert.equal(range.Value2, 99);
+        }
+        finally {
+            book.Close(false);
+            app.Quit();
+        }
+    });
+
     it("quit", function() {
         if (wbk) wbk.Close(false);
         if (excel) excel.Quit();